@@ -28,6 +28,10 @@
 #include "mpfr/GmpInt.hh"
 #endif
 
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+#include "mpfr/GmpRational.hh"
+#endif
+
 #ifdef FP_SUPPORT_COMPLEX_NUMBERS
 #include <complex>
 #endif
@@ -53,6 +57,20 @@ namespace FUNCTIONPARSERTYPES
     };
 #endif
 
+    /* Integral types with a limited range. Eval() checks every operation
+       on them for overflow, and the parser doesn't fold or regroup their
+       constants, as that would be done unchecked at parse time. */
+    template<typename>
+    struct IsOverflowingType
+    {
+        enum { result = false };
+    };
+    template<>
+    struct IsOverflowingType<long>
+    {
+        enum { result = true };
+    };
+
     template<typename>
     struct IsComplexType
     {
@@ -107,21 +125,24 @@ namespace FUNCTIONPARSERTYPES
         return Value_t(0.434294481903251827651128918916605082294397L);
     }
 
+    // These two return by value so that types whose constants depend on
+    // the precision (MpfrFloat) can specialize them.
     template<typename Value_t>
-    inline const Value_t& fp_const_deg_to_rad() // CONSTANT_DR
+    inline Value_t fp_const_deg_to_rad() // CONSTANT_DR
     {
         static const Value_t factor = fp_const_pi<Value_t>() / Value_t(180); // to rad from deg
         return factor;
     }
 
     template<typename Value_t>
-    inline const Value_t& fp_const_rad_to_deg() // CONSTANT_RD
+    inline Value_t fp_const_rad_to_deg() // CONSTANT_RD
     {
         static const Value_t factor = Value_t(180) / fp_const_pi<Value_t>(); // to deg from rad
         return factor;
     }
 
 #ifdef FP_SUPPORT_MPFR_FLOAT_TYPE
+    // All of these are cached by MpfrFloat for each precision.
     template<>
     inline MpfrFloat fp_const_pi<MpfrFloat>() { return MpfrFloat::const_pi(); }
 
@@ -129,21 +150,64 @@ namespace FUNCTIONPARSERTYPES
     inline MpfrFloat fp_const_e<MpfrFloat>() { return MpfrFloat::const_e(); }
 
     template<>
-    inline MpfrFloat fp_const_einv<MpfrFloat>() { return MpfrFloat(1) / MpfrFloat::const_e(); }
+    inline MpfrFloat fp_const_einv<MpfrFloat>() { return MpfrFloat::const_einv(); }
 
     template<>
     inline MpfrFloat fp_const_log2<MpfrFloat>() { return MpfrFloat::const_log2(); }
 
-    /*
     template<>
-    inline MpfrFloat fp_const_log10<MpfrFloat>() { return fp_log(MpfrFloat(10)); }
+    inline MpfrFloat fp_const_log10<MpfrFloat>() { return MpfrFloat::const_log10(); }
 
     template<>
-    inline MpfrFloat fp_const_log2inv<MpfrFloat>() { return MpfrFloat(1) / MpfrFloat::const_log2(); }
+    inline MpfrFloat fp_const_log2inv<MpfrFloat>() { return MpfrFloat::const_log2inv(); }
 
     template<>
-    inline MpfrFloat fp_const_log10inv<MpfrFloat>() { return fp_log10(MpfrFloat::const_e()); }
-    */
+    inline MpfrFloat fp_const_log10inv<MpfrFloat>() { return MpfrFloat::const_log10inv(); }
+
+    template<>
+    inline MpfrFloat fp_const_deg_to_rad<MpfrFloat>() { return MpfrFloat::const_deg_to_rad(); }
+
+    template<>
+    inline MpfrFloat fp_const_rad_to_deg<MpfrFloat>() { return MpfrFloat::const_rad_to_deg(); }
+#endif
+
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+    // These are MpfrFloat approximations, so they are inexact fractions.
+    template<>
+    inline GmpRational fp_const_pi<GmpRational>()
+    { return GmpRational(MpfrFloat::const_pi()); }
+
+    template<>
+    inline GmpRational fp_const_e<GmpRational>()
+    { return GmpRational(MpfrFloat::const_e()); }
+
+    template<>
+    inline GmpRational fp_const_einv<GmpRational>()
+    { return GmpRational(MpfrFloat::const_einv()); }
+
+    template<>
+    inline GmpRational fp_const_log2<GmpRational>()
+    { return GmpRational(MpfrFloat::const_log2()); }
+
+    template<>
+    inline GmpRational fp_const_log10<GmpRational>()
+    { return GmpRational(MpfrFloat::const_log10()); }
+
+    template<>
+    inline GmpRational fp_const_log2inv<GmpRational>()
+    { return GmpRational(MpfrFloat::const_log2inv()); }
+
+    template<>
+    inline GmpRational fp_const_log10inv<GmpRational>()
+    { return GmpRational(MpfrFloat::const_log10inv()); }
+
+    template<>
+    inline GmpRational fp_const_deg_to_rad<GmpRational>()
+    { return GmpRational(MpfrFloat::const_deg_to_rad()); }
+
+    template<>
+    inline GmpRational fp_const_rad_to_deg<GmpRational>()
+    { return GmpRational(MpfrFloat::const_rad_to_deg()); }
 #endif
 
 
@@ -360,8 +424,8 @@ namespace FUNCTIONPARSERTYPES
     inline long fp_log(const long&) { return 0; }
     inline long fp_log2(const long&) { return 0; }
     inline long fp_log10(const long&) { return 0; }
-    inline long fp_mod(const long& x, const long& y) { return x % y; }
-    inline long fp_pow(const long&, const long&) { return 0; }
+    inline long fp_mod(const long& x, const long& y)
+    { return y == -1 ? 0 : x % y; } // LONG_MIN % -1 traps on some CPUs
     inline long fp_sin(const long&) { return 0; }
     inline long fp_sinh(const long&) { return 0; }
     inline long fp_sqrt(const long&) { return 1; }
@@ -374,6 +438,54 @@ namespace FUNCTIONPARSERTYPES
     inline void fp_sinCos(long&, long&, const long&) {}
     inline void fp_sinhCosh(long&, long&, const long&) {}
 
+    /* Overflow-checked versions of the operators (see "Overflow-checked
+       arithmetic" below). On overflow the value of x is unspecified. */
+    inline bool fp_checkedAdd(long& x, const long& y)
+    { return !__builtin_add_overflow(x, y, &x); }
+    inline bool fp_checkedSub(long& x, const long& y)
+    { return !__builtin_sub_overflow(x, y, &x); }
+    inline bool fp_checkedMul(long& x, const long& y)
+    { return !__builtin_mul_overflow(x, y, &x); }
+    inline bool fp_checkedNeg(long& x)
+    { return !__builtin_sub_overflow(0L, x, &x); }
+    inline bool fp_checkedAbs(long& x)
+    { return x >= 0 || fp_checkedNeg(x); }
+
+    inline bool fp_checkedDiv(long& x, const long& y)
+    {
+        if(y == -1) return fp_checkedNeg(x);
+        x /= y;
+        return true;
+    }
+
+    /* Integer power by squaring. A negative exponent gives the integer
+       part of 1/x^-y, ie. 0 unless x is 1 or -1. */
+    inline bool fp_checkedPow(long& x, const long& y)
+    {
+        if(y < 0)
+        {
+            x = x == 1 ? 1 : x == -1 ? (y % 2 ? -1 : 1) : 0;
+            return true;
+        }
+        long result = 1, base = x;
+        for(unsigned long n = y; n != 0; n >>= 1)
+        {
+            if((n & 1) && __builtin_mul_overflow(result, base, &result))
+                return false;
+            // |base| >= 2 here, so the result would overflow too
+            if(n > 1 && __builtin_mul_overflow(base, base, &base))
+                return false;
+        }
+        x = result;
+        return true;
+    }
+
+    inline long fp_pow(const long& x, const long& y)
+    {
+        long result = x;
+        return fp_checkedPow(result, y) ? result : 0;
+    }
+
     //template<> inline long fp_epsilon<long>() { return 0; }
 
 
@@ -455,7 +567,6 @@ namespace FUNCTIONPARSERTYPES
     inline GmpInt fp_log2(const GmpInt&) { return 0; }
     inline GmpInt fp_log10(const GmpInt&) { return 0; }
     inline GmpInt fp_mod(const GmpInt& x, const GmpInt& y) { return x % y; }
-    inline GmpInt fp_pow(const GmpInt&, const GmpInt&) { return 0; }
     inline GmpInt fp_sin(const GmpInt&) { return 0; }
     inline GmpInt fp_sinh(const GmpInt&) { return 0; }
     inline GmpInt fp_sqrt(const GmpInt&) { return 0; }
@@ -465,9 +576,148 @@ namespace FUNCTIONPARSERTYPES
     inline GmpInt fp_pow_base(const GmpInt&, const GmpInt&) { return 0; }
     inline void fp_sinCos(GmpInt&, GmpInt&, const GmpInt&) {}
     inline void fp_sinhCosh(GmpInt&, GmpInt&, const GmpInt&) {}
+
+    /* GmpInt arithmetic is exact, but a power is refused if the result
+       could have more than this many bits, so that something like
+       "10^10^10^10" fails instead of running out of memory. x^y has at most
+       y * numberOfBits(x) bits, and that is the bound checked. */
+    const unsigned long GmpIntMaxPowBits = 1UL << 20;
+
+    inline bool fp_checkedPow(GmpInt& x, const GmpInt& y)
+    {
+        if(y < 0 || (x >= -1 && x <= 1))
+        {
+            const bool odd = y % 2 != 0;
+            x = x == 1 ? 1 : x == -1 ? (odd ? -1 : 1) : y == 0 ? 1 : 0;
+            return true;
+        }
+        if(y > long(GmpIntMaxPowBits / x.numberOfBits()))
+            return false;
+        x = GmpInt::pow(x, y.toInt());
+        return true;
+    }
+
+    inline GmpInt fp_pow(const GmpInt& x, const GmpInt& y)
+    {
+        GmpInt result = x;
+        return fp_checkedPow(result, y) ? result : GmpInt(0);
+    }
 #endif // FP_SUPPORT_GMP_INT_TYPE
 
 
+// -------------------------------------------------------------------------
+// GMP rational
+// -------------------------------------------------------------------------
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+    /* Results that are fractions whenever the arguments are (abs, floor,
+       powers, ...) are computed exactly, as are roots that happen to be
+       fractions. Everything else is computed with MpfrFloat and comes back
+       as an inexact fraction. */
+    inline GmpRational fp_withMpfr(MpfrFloat (*function)(const MpfrFloat&),
+                                   const GmpRational& x)
+    {
+        return GmpRational(function(x.toMpfrFloat()));
+    }
+
+    inline GmpRational fp_abs(const GmpRational& x) { return GmpRational::abs(x); }
+    inline GmpRational fp_acos(const GmpRational& x) { return fp_withMpfr(MpfrFloat::acos, x); }
+    inline GmpRational fp_acosh(const GmpRational& x) { return fp_withMpfr(MpfrFloat::acosh, x); }
+    inline GmpRational fp_asin(const GmpRational& x) { return fp_withMpfr(MpfrFloat::asin, x); }
+    inline GmpRational fp_asinh(const GmpRational& x) { return fp_withMpfr(MpfrFloat::asinh, x); }
+    inline GmpRational fp_atan(const GmpRational& x) { return fp_withMpfr(MpfrFloat::atan, x); }
+    inline GmpRational fp_atan2(const GmpRational& x, const GmpRational& y)
+    { return GmpRational(MpfrFloat::atan2(x.toMpfrFloat(), y.toMpfrFloat())); }
+    inline GmpRational fp_atanh(const GmpRational& x) { return fp_withMpfr(MpfrFloat::atanh, x); }
+    inline GmpRational fp_ceil(const GmpRational& x) { return GmpRational::ceil(x); }
+    inline GmpRational fp_cos(const GmpRational& x) { return fp_withMpfr(MpfrFloat::cos, x); }
+    inline GmpRational fp_cosh(const GmpRational& x) { return fp_withMpfr(MpfrFloat::cosh, x); }
+    inline GmpRational fp_exp(const GmpRational& x) { return fp_withMpfr(MpfrFloat::exp, x); }
+    inline GmpRational fp_floor(const GmpRational& x) { return GmpRational::floor(x); }
+    inline GmpRational fp_int(const GmpRational& x) { return GmpRational::round(x); }
+    inline GmpRational fp_log(const GmpRational& x) { return fp_withMpfr(MpfrFloat::log, x); }
+    inline GmpRational fp_log2(const GmpRational& x) { return fp_withMpfr(MpfrFloat::log2, x); }
+    inline GmpRational fp_log10(const GmpRational& x) { return fp_withMpfr(MpfrFloat::log10, x); }
+    inline GmpRational fp_mod(const GmpRational& x, const GmpRational& y) { return x % y; }
+    inline GmpRational fp_sin(const GmpRational& x) { return fp_withMpfr(MpfrFloat::sin, x); }
+    inline GmpRational fp_sinh(const GmpRational& x) { return fp_withMpfr(MpfrFloat::sinh, x); }
+    inline GmpRational fp_tan(const GmpRational& x) { return fp_withMpfr(MpfrFloat::tan, x); }
+    inline GmpRational fp_tanh(const GmpRational& x) { return fp_withMpfr(MpfrFloat::tanh, x); }
+    inline GmpRational fp_trunc(const GmpRational& x) { return GmpRational::trunc(x); }
+
+    inline GmpRational fp_sqrt(const GmpRational& x)
+    {
+        GmpRational result;
+        if(x.isExact() && GmpRational::root(x, 2, result)) return result;
+        return fp_withMpfr(MpfrFloat::sqrt, x);
+    }
+
+    inline GmpRational fp_cbrt(const GmpRational& x)
+    {
+        GmpRational result;
+        if(x.isExact() && GmpRational::root(x, 3, result)) return result;
+        return fp_withMpfr(MpfrFloat::cbrt, x);
+    }
+
+    inline GmpRational fp_hypot(const GmpRational& x, const GmpRational& y)
+    {
+        return fp_sqrt(x*x + y*y);
+    }
+
+    inline GmpRational fp_pow_base(const GmpRational& x, const GmpRational& y)
+    {
+        return GmpRational(MpfrFloat::pow(x.toMpfrFloat(), y.toMpfrFloat()));
+    }
+
+    // Exponents with a denominator above this are not tried as exact roots.
+    const long GmpRationalMaxRootDegree = 64;
+
+    /* Integral exponents give exact powers, and an exponent p/q gives one
+       if the q-th root of the base is a fraction. Otherwise a negative base
+       is handled as with the other types (see fp_pow() in fparser.cc). */
+    inline GmpRational fp_pow(const GmpRational& x, const GmpRational& y)
+    {
+        GmpRational result;
+        if(y.isExact() && y.numerator().fitsInLong())
+        {
+            if(y.isInteger())
+            {
+                if(GmpRational::pow(x, y.toInt(), result)) return result;
+            }
+            else if(x.isExact() && y.denominator() <= GmpRationalMaxRootDegree
+                 && GmpRational::root(x, y.denominator().toInt(), result)
+                 && GmpRational::pow(result, y.numerator().toInt(), result))
+                return result;
+        }
+
+        if(x < GmpRational() && !y.isInteger())
+            return -fp_pow_base(-x, y);
+        return fp_pow_base(x, y);
+    }
+
+    inline GmpRational fp_exp2(const GmpRational& x)
+    {
+        return fp_pow(GmpRational(2), x);
+    }
+
+    inline void fp_sinCos(GmpRational& sin, GmpRational& cos,
+                          const GmpRational& a)
+    {
+        MpfrFloat sinValue, cosValue;
+        MpfrFloat::sincos(a.toMpfrFloat(), sinValue, cosValue);
+        sin = GmpRational(sinValue);
+        cos = GmpRational(cosValue);
+    }
+
+    inline void fp_sinhCosh(GmpRational& sinhvalue, GmpRational& coshvalue,
+                            const GmpRational& param)
+    {
+        const MpfrFloat value = param.toMpfrFloat();
+        sinhvalue = GmpRational(MpfrFloat::sinh(value));
+        coshvalue = GmpRational(MpfrFloat::cosh(value));
+    }
+#endif // FP_SUPPORT_GMP_RATIONAL_TYPE
+
+
 #ifdef FP_SUPPORT_CPLUSPLUS11_MATH_FUNCS
     template<typename Value_t>
     inline Value_t fp_cbrt(const Value_t& x) { return std::cbrt(x); }
@@ -1152,6 +1402,29 @@ namespace FUNCTIONPARSERTYPES
     }
 #endif
 
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+    template<>
+    inline bool isInteger(const GmpRational& value) { return value.isInteger(); }
+
+    template<>
+    inline bool isEvenInteger(const GmpRational& value)
+    {
+        return value.isInteger() && value.numerator() % 2 == 0;
+    }
+
+    template<>
+    inline bool isOddInteger(const GmpRational& value)
+    {
+        return value.isInteger() && value.numerator() % 2 != 0;
+    }
+
+    template<>
+    inline long makeLongInteger(const GmpRational& value)
+    {
+        return value.toInt();
+    }
+#endif
+
 #ifdef FP_SUPPORT_LONG_INT_TYPE
     template<>
     inline bool isOddInteger(const long& value)
@@ -1234,6 +1507,41 @@ namespace FUNCTIONPARSERTYPES
     {
         return fp_pow(Value_t(2), x);
     }
+
+
+// -------------------------------------------------------------------------
+// Overflow-checked arithmetic
+// -------------------------------------------------------------------------
+    /* These do "x op= y" and return false if the result can't be
+       represented. Only long can overflow (its versions are above); for
+       every other type they are the plain operators. */
+    template<typename Value_t>
+    inline bool fp_checkedAdd(Value_t& x, const Value_t& y)
+    { x += y; return true; }
+
+    template<typename Value_t>
+    inline bool fp_checkedSub(Value_t& x, const Value_t& y)
+    { x -= y; return true; }
+
+    template<typename Value_t>
+    inline bool fp_checkedMul(Value_t& x, const Value_t& y)
+    { x *= y; return true; }
+
+    template<typename Value_t>
+    inline bool fp_checkedDiv(Value_t& x, const Value_t& y)
+    { x /= y; return true; }
+
+    template<typename Value_t>
+    inline bool fp_checkedNeg(Value_t& x)
+    { x = -x; return true; }
+
+    template<typename Value_t>
+    inline bool fp_checkedAbs(Value_t& x)
+    { x = fp_abs(x); return true; }
+
+    template<typename Value_t>
+    inline bool fp_checkedPow(Value_t& x, const Value_t& y)
+    { x = fp_pow(x, y); return true; }
 } // namespace FUNCTIONPARSERTYPES
 
 #endif // ONCE_FPARSER_H_
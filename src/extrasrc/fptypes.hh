@@ -84,6 +84,18 @@ namespace FUNCTIONPARSERTYPES
         cRSub,  /* reverse subtraction (not x-y, but y-x) */
         cRSqrt, /* inverse square-root (1/sqrt(x)) */
 
+        cIntegrate, /* integrate(f,x,a,b): adaptive quadrature of a
+                     * sub-program (next value is the sub-program index) */
+        cSolve,     /* solve(f,x,x0): root of a sub-program near x0 */
+        cSum,       /* sum(f,i,a,b): sub-program summed over i=a..b */
+        cProd,      /* prod(f,i,a,b): product of sub-program over i=a..b */
+        cMean,      /* List functions: a sub-program evaluated over list */
+        cVar,       /* literals, whose elements precede the opcode on */
+        cStdev,     /* the stack, reduced to a single value */
+        cMedian,
+        cListMin,
+        cListMax,
+
         VarBegin
     };
 
@@ -264,6 +276,21 @@ struct FunctionParserBase<Value_t>::Data
     std::vector<FuncWrapperPtrData> mFuncPtrs;
     std::vector<FuncParserPtrData> mFuncParsers;
 
+    /* Expressions given as arguments to integrate() and alike are
+       compiled into separate parsers which take the same variables as
+       this one, plus the variable bound by the construct. */
+    struct SubProgramData
+    {
+        FunctionParserBase<Value_t> mParser;
+        unsigned mVarIndex;
+        unsigned mVarsAmount;
+        bool mParallelSafe; /* copies may be evaluated on other threads */
+        unsigned mListLength; /* list functions: length of the lists bound
+                                 to variables mVarIndex..mVarsAmount-1 */
+    };
+
+    std::vector<SubProgramData> mSubPrograms;
+
     std::vector<unsigned> mByteCode;
     std::vector<Value_t> mImmed;
 
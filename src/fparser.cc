@@ -14,10 +14,21 @@
 #include <set>
 #include <cstdlib>
 #include <cstring>
+#include <cerrno>
 #include <cctype>
 #include <cmath>
 #include <cassert>
 #include <limits>
+#include <algorithm>
+
+#ifdef FP_ENABLE_PARALLEL_REDUCTION
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef FP_SUPPORT_MPFR_FLOAT_TYPE
+#include <mpfr.h>
+#endif
 
 #include "extrasrc/fptypes.hh"
 #include "extrasrc/fpaux.hh"
@@ -37,6 +48,26 @@ using namespace FUNCTIONPARSERTYPES;
 # define unlikely(x) (x)
 #endif
 
+//=========================================================================
+// Cancellation of evaluations
+//=========================================================================
+namespace
+{
+    __thread const int* gCancelFlag = 0;
+
+    inline bool evalCancelled()
+    {
+        return unlikely(gCancelFlag != 0)
+            && __atomic_load_n(gCancelFlag, __ATOMIC_RELAXED) != 0;
+    }
+}
+
+template<typename Value_t>
+void FunctionParserBase<Value_t>::SetCancelFlag(const int* flag)
+{
+    gCancelFlag = flag;
+}
+
 //=========================================================================
 // Opcode analysis functions
 //=========================================================================
@@ -470,7 +501,11 @@ namespace
     template<>
     inline long fp_parseLiteral<long>(const char* str, char** endptr)
     {
-        return std::strtol(str, endptr, 10);
+        // A literal that doesn't fit is a parse error rather than clamped.
+        errno = 0;
+        const long value = std::strtol(str, endptr, 10);
+        if(errno == ERANGE) *endptr = const_cast<char*>(str);
+        return value;
     }
 #endif
 
@@ -628,7 +663,10 @@ namespace
     template<>
     long parseHexLiteral<long>(const char* str, char** endptr)
     {
-        return std::strtol(str, endptr, 16);
+        errno = 0;
+        const long value = std::strtol(str, endptr, 16);
+        if(errno == ERANGE) *endptr = const_cast<char*>(str);
+        return value;
     }
 #endif
 
@@ -735,6 +773,7 @@ FunctionParserBase<Value_t>::Data::Data(const Data& rhs):
     mNamePtrs(),
     mFuncPtrs(rhs.mFuncPtrs),
     mFuncParsers(rhs.mFuncParsers),
+    mSubPrograms(rhs.mSubPrograms),
     mByteCode(rhs.mByteCode),
     mImmed(rhs.mImmed),
 #ifndef FP_USE_THREAD_SAFE_EVAL
@@ -1112,6 +1151,122 @@ namespace
             FunctionParserBase<Value_t>::MISSING_PARENTH;
     }
 
+    // Constructs taking an expression and the name of a variable bound in
+    // it, followed by ordinary parameters, eg. "integrate(x^2, x, 0, 1)".
+    // They are recognized only if the name isn't defined otherwise.
+    struct SubProgramConstruct
+    {
+        const char* name;
+        unsigned opcode;
+        unsigned params;
+        bool okForInt;
+    };
+
+    const SubProgramConstruct SubProgramConstructs[] =
+    {
+        { "integrate", cIntegrate, 2, false },
+        { "solve",     cSolve,     1, false },
+        { "sum",       cSum,       2, true  },
+        { "prod",      cProd,      2, true  }
+    };
+
+    template<typename Value_t>
+    inline const SubProgramConstruct* findSubProgramConstruct
+    (const NamePtr& name)
+    {
+        const unsigned amount =
+            sizeof(SubProgramConstructs) / sizeof(SubProgramConstructs[0]);
+        for(unsigned i = 0; i < amount; ++i)
+        {
+            const SubProgramConstruct& construct = SubProgramConstructs[i];
+            if(name == NamePtr(construct.name,
+                               unsigned(std::strlen(construct.name)))
+            && (construct.okForInt || !IsIntType<Value_t>::result))
+                return &construct;
+        }
+        return 0;
+    }
+
+    // List functions, eg. "mean([1,2,3]^2)". Their argument is evaluated
+    // elementwise over the list literals "[...]" it contains. Like the
+    // constructs above they are recognized only if the name isn't defined
+    // otherwise; min() and max() become list functions when their only
+    // argument contains a list literal.
+    struct ListFunction
+    {
+        const char* name;
+        unsigned opcode;
+        bool okForInt;
+    };
+
+    const ListFunction ListFunctions[] =
+    {
+        { "mean",   cMean,   false },
+        { "var",    cVar,    false },
+        { "stdev",  cStdev,  false },
+        { "median", cMedian, true  }
+    };
+
+    template<typename Value_t>
+    inline const ListFunction* findListFunction(const NamePtr& name)
+    {
+        const unsigned amount = sizeof(ListFunctions) / sizeof(ListFunctions[0]);
+        for(unsigned i = 0; i < amount; ++i)
+        {
+            const ListFunction& function = ListFunctions[i];
+            if(name == NamePtr(function.name, unsigned(std::strlen(function.name)))
+            && (function.okForInt || !IsIntType<Value_t>::result))
+                return &function;
+        }
+        return 0;
+    }
+
+    // Maps the text of a list function's sub-program back to the source.
+    struct SourceSegment
+    {
+        unsigned offset;   // in the sub-program text
+        const char* source;
+        bool verbatim;     // else the segment replaces a list literal
+    };
+
+    // Returns a pointer to the ',' or ')' which ends the function parameter
+    // beginning at ptr, or to the terminating null if there is none.
+    inline const char* findParamEnd(const char* ptr)
+    {
+        unsigned depth = 0;
+        for(; *ptr; ++ptr)
+        {
+            if(*ptr == '(' || *ptr == '[') ++depth;
+            else if(*ptr == ')' || *ptr == ']')
+            {
+                if(depth == 0) break;
+                --depth;
+            }
+            else if(*ptr == ',' && depth == 0) break;
+        }
+        return ptr;
+    }
+
+    // Whether ptr points to "(<argument>)" with a list literal in it.
+    inline bool isListArgument(const char* ptr)
+    {
+        if(*ptr != '(') return false;
+        const char* end = findParamEnd(ptr + 1);
+        return *end == ')' && std::find(ptr + 1, end, '[') != end;
+    }
+
+    // Returns a pointer past the ')' closing the parameters beginning at ptr.
+    inline const char* skipParams(const char* ptr)
+    {
+        while(true)
+        {
+            ptr = findParamEnd(ptr);
+            if(*ptr != ',') break;
+            ++ptr;
+        }
+        return *ptr == ')' ? ptr + 1 : ptr;
+    }
+
     template<unsigned offset>
     struct IntLiteralMask
     {
@@ -1381,6 +1536,7 @@ int FunctionParserBase<Value_t>::ParseFunction(const char* function,
     mData->mInlineVarNames.clear();
     mData->mByteCode.clear(); mData->mByteCode.reserve(128);
     mData->mImmed.clear(); mData->mImmed.reserve(128);
+    mData->mSubPrograms.clear();
     mData->mStackSize = mStackPtr = 0;
 
     mData->mHasByteCodeFlags = false;
@@ -1648,15 +1804,13 @@ inline void FunctionParserBase<Value_t>::AddFunctionOpcode(unsigned opcode)
 }
 
 #ifdef FP_SUPPORT_LONG_INT_TYPE
+/* The bytecode optimizer folds constants with plain long arithmetic, which
+   would wrap around silently, so with long the bytecode is kept as parsed
+   and every operation goes through the overflow checks of Eval(). */
 template<>
 inline void FunctionParserBase<long>::AddFunctionOpcode(unsigned opcode)
 {
-    typedef long Value_t;
-#define FP_FLOAT_VERSION 0
-#define FP_COMPLEX_VERSION 0
-#include "extrasrc/fp_opcode_add.inc"
-#undef FP_COMPLEX_VERSION
-#undef FP_FLOAT_VERSION
+    mData->mByteCode.push_back(opcode);
 }
 #endif
 
@@ -1775,6 +1929,19 @@ FunctionParserBase<GmpInt>::ParseLiteral(const char* function)
 }
 #endif
 
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+template<>
+std::pair<const char*, GmpRational>
+FunctionParserBase<GmpRational>::ParseLiteral(const char* function)
+{
+    char* endPtr;
+    const GmpRational val = GmpRational::parseString(function, &endPtr);
+    if(endPtr == function)
+        return std::pair<const char*,GmpRational> (function, GmpRational());
+    return std::pair<const char*,GmpRational> (endPtr, val);
+}
+#endif
+
 
 template<typename Value_t>
 inline const char*
@@ -1853,6 +2020,241 @@ const char* FunctionParserBase<Value_t>::CompileIf(const char* function)
     return function;
 }
 
+template<typename Value_t>
+const char* FunctionParserBase<Value_t>::CompileSubProgramCall
+(const char* function, unsigned opcode, unsigned requiredParams)
+{
+    if(*function != '(') return SetErrorType(EXPECT_PARENTH_FUNC, function);
+
+    // The bound variable must be known before the expression can be
+    // compiled, so the expression is skipped over first.
+    const char* exprBegin = function + 1;
+    const char* exprEnd = findParamEnd(exprBegin);
+    if(*exprEnd != ',')
+        return SetErrorType(noCommaError<Value_t>(*exprEnd), exprEnd);
+
+    const char* varBegin = exprEnd + 1;
+    SkipSpace(varBegin);
+    const unsigned varLength = readIdentifier<Value_t>(varBegin);
+    if(varLength == 0 || (varLength & 0x80000000U))
+        return SetErrorType(SYNTAX_ERROR, varBegin);
+
+    function = varBegin + varLength;
+    SkipSpace(function);
+
+    // The sub-program takes the variables of this parser, with the bound
+    // variable either shadowing one of them or appended after them.
+    std::vector<std::string> varNames;
+    GetVariableNames(varNames);
+
+    const std::string varName(varBegin, varLength);
+    unsigned varIndex = 0;
+    while(varIndex < varNames.size() && varNames[varIndex] != varName)
+        ++varIndex;
+    if(varIndex == varNames.size()) varNames.push_back(varName);
+
+    std::string subVarString;
+    for(unsigned i = 0; i < varNames.size(); ++i)
+    {
+        if(i) subVarString += ',';
+        subVarString += varNames[i];
+    }
+
+    typename Data::SubProgramData subProgram =
+        { *this, varIndex, unsigned(varNames.size()), true, 0 };
+    const int errorIndex =
+        subProgram.mParser.Parse(std::string(exprBegin, exprEnd),
+                                 subVarString, mData->mUseDegreeConversion);
+    if(errorIndex >= 0)
+    {
+        const ParseErrorType error = subProgram.mParser.GetParseErrorType();
+        if(error == INVALID_VARS) return SetErrorType(SYNTAX_ERROR, varBegin);
+        return SetErrorType(error == FP_NO_ERROR ? SYNTAX_ERROR : error,
+                            exprBegin + errorIndex);
+    }
+
+    // A deep copy of the sub-program can run on another thread only if it
+    // doesn't call into other parsers or function wrappers (which would
+    // still be shared). Plain C++ functions are assumed to be reentrant.
+    const Data& subData = *subProgram.mParser.mData;
+    if(!subData.mSubPrograms.empty()) subProgram.mParallelSafe = false;
+    for(unsigned i = 0; i < subData.mByteCode.size(); ++i)
+    {
+        switch(subData.mByteCode[i])
+        {
+          case cFCall:
+              if(!subData.mFuncPtrs[subData.mByteCode[++i]].mRawFuncPtr)
+                  subProgram.mParallelSafe = false;
+              break;
+          case cPCall: subProgram.mParallelSafe = false; ++i; break;
+          case cIf: case cAbsIf: case cJump: i += 2; break;
+          case cFetch: ++i; break;
+#ifdef FP_SUPPORT_OPTIMIZER
+          case cPopNMov: i += 2; break;
+#endif
+          default: break;
+        }
+    }
+
+    for(unsigned i = 0; i < requiredParams; ++i)
+    {
+        if(*function != ',')
+            return SetErrorType(noCommaError<Value_t>(*function), function);
+
+        function = CompileExpression(function + 1);
+        if(!function) return 0;
+    }
+    if(*function != ')')
+        return SetErrorType(noParenthError<Value_t>(*function), function);
+    ++function;
+    SkipSpace(function);
+
+    // No need for incStackPtr() because each parse parameter calls it
+    mStackPtr -= requiredParams - 1;
+
+    mData->mSubPrograms.push_back(subProgram);
+    mData->mByteCode.push_back(opcode);
+    PushOpcodeParam<true>(unsigned(mData->mSubPrograms.size() - 1));
+    return function;
+}
+
+template<typename Value_t>
+const char* FunctionParserBase<Value_t>::CompileListFunction
+(const char* function, unsigned opcode)
+{
+    if(*function != '(') return SetErrorType(EXPECT_PARENTH_FUNC, function);
+
+    const char* exprBegin = function + 1;
+    const char* exprEnd = findParamEnd(exprBegin);
+    if(*exprEnd != ')')
+        return SetErrorType(noParenthError<Value_t>(*exprEnd), exprEnd);
+
+    // The elements of each list literal are compiled in place, so that they
+    // end up on the stack one list after another, and the literal itself is
+    // replaced in the argument by a variable of the sub-program. Arguments
+    // of nested list functions are left for them to handle.
+    const SourceSegment firstSegment = { 0, exprBegin, true };
+    std::vector<SourceSegment> segments(1, firstSegment);
+
+    std::vector<std::string> varNames;
+    GetVariableNames(varNames);
+    const unsigned varIndex = unsigned(varNames.size());
+
+    std::string subFunction;
+    unsigned listLength = 1;
+    for(const char* ptr = exprBegin; ptr < exprEnd; )
+    {
+        if(*ptr == '[')
+        {
+            const char* listBegin = ptr++;
+            unsigned length = 0;
+            while(true)
+            {
+                ptr = CompileExpression(ptr);
+                if(!ptr) return 0;
+                ++length;
+                if(*ptr == ']') break;
+                if(*ptr != ',') return SetErrorType(SYNTAX_ERROR, ptr);
+                ++ptr;
+            }
+            ++ptr;
+
+            if(varNames.size() > varIndex && length != listLength)
+                return SetErrorType(ILL_PARAMS_AMOUNT, listBegin);
+            listLength = length;
+
+            std::string listName = "__list";
+            // Numbered after all the variables, so that the names of nested
+            // list functions don't collide.
+            for(unsigned n = unsigned(varNames.size()); ; n /= 10)
+            {
+                listName.insert(6, 1, char('0' + n % 10));
+                if(n < 10) break;
+            }
+            varNames.push_back(listName);
+
+            const SourceSegment listSegment =
+                { unsigned(subFunction.size()), listBegin, false };
+            segments.push_back(listSegment);
+            subFunction += listName;
+            const SourceSegment nextSegment =
+                { unsigned(subFunction.size()), ptr, true };
+            segments.push_back(nextSegment);
+            continue;
+        }
+
+        const char* next = ptr + 1;
+        const unsigned nameLength = readIdentifier<Value_t>(ptr);
+        if(nameLength)
+        {
+            next = ptr + (nameLength & 0xFFFF);
+            const char* paramsPtr = next;
+            SkipSpace(paramsPtr);
+            const unsigned funcOpcode = (nameLength >> 16) & 0x7FFF;
+            const bool isListFunction = (nameLength & 0x80000000U)
+                ? (funcOpcode == cMin || funcOpcode == cMax)
+                : (findListFunction<Value_t>(NamePtr(ptr, nameLength)) != 0);
+            if(isListFunction && isListArgument(paramsPtr))
+                next = skipParams(paramsPtr + 1);
+        }
+        subFunction.append(ptr, next);
+        ptr = next;
+    }
+
+    std::string subVarString;
+    for(unsigned i = 0; i < varNames.size(); ++i)
+    {
+        if(i) subVarString += ',';
+        subVarString += varNames[i];
+    }
+
+    typename Data::SubProgramData subProgram =
+        { *this, varIndex, unsigned(varNames.size()), false, listLength };
+    const int errorIndex =
+        subProgram.mParser.Parse(subFunction, subVarString,
+                                 mData->mUseDegreeConversion);
+    if(errorIndex >= 0)
+    {
+        const ParseErrorType error = subProgram.mParser.GetParseErrorType();
+        unsigned i = unsigned(segments.size()) - 1;
+        while(segments[i].offset > unsigned(errorIndex)) --i;
+        const char* errorPtr = segments[i].source;
+        if(segments[i].verbatim) errorPtr += errorIndex - segments[i].offset;
+        return SetErrorType(error == FP_NO_ERROR || error == INVALID_VARS ?
+                            SYNTAX_ERROR : error, errorPtr);
+    }
+
+    // The elements were pushed by CompileExpression(), and are replaced by
+    // the result.
+    const unsigned elements = (subProgram.mVarsAmount - varIndex) * listLength;
+    if(elements == 0) incStackPtr();
+    else mStackPtr -= elements - 1;
+
+    ++exprEnd;
+    SkipSpace(exprEnd);
+
+    mData->mSubPrograms.push_back(subProgram);
+    mData->mByteCode.push_back(opcode);
+    PushOpcodeParam<true>(unsigned(mData->mSubPrograms.size() - 1));
+    return exprEnd;
+}
+
+template<typename Value_t>
+void FunctionParserBase<Value_t>::GetVariableNames
+(std::vector<std::string>& varNames) const
+{
+    varNames.assign(mData->mVariablesAmount, std::string());
+    for(typename NamePtrsMap<Value_t>::const_iterator i =
+            mData->mNamePtrs.begin();
+        i != mData->mNamePtrs.end();
+        ++i)
+    {
+        if(i->second.type == NameData<Value_t>::VARIABLE)
+            varNames[i->second.index - VarBegin].assign
+                (i->first.name, i->first.nameLength);
+    }
+}
+
 template<typename Value_t>
 const char* FunctionParserBase<Value_t>::CompileFunctionParams
 (const char* function, unsigned requiredParams)
@@ -1918,7 +2320,16 @@ const char* FunctionParserBase<Value_t>::CompileElement(const char* function)
     if(nameLength & 0x80000000U) // Function
     {
         OPCODE func_opcode = OPCODE( (nameLength >> 16) & 0x7FFF );
-        return CompileFunction(function + (nameLength & 0xFFFF), func_opcode);
+        function += nameLength & 0xFFFF;
+        if(func_opcode == cMin || func_opcode == cMax)
+        {
+            const char* paramsPtr = function;
+            SkipSpace(paramsPtr);
+            if(isListArgument(paramsPtr))
+                return CompileListFunction
+                    (paramsPtr, func_opcode == cMin ? cListMin : cListMax);
+        }
+        return CompileFunction(function, func_opcode);
     }
 
     NamePtr name(function, nameLength);
@@ -1951,6 +2362,16 @@ const char* FunctionParserBase<Value_t>::CompileElement(const char* function)
             }
         }
 
+        const SubProgramConstruct* construct =
+            findSubProgramConstruct<Value_t>(name);
+        if(construct)
+            return CompileSubProgramCall
+                (endPtr, construct->opcode, construct->params);
+
+        const ListFunction* listFunction = findListFunction<Value_t>(name);
+        if(listFunction)
+            return CompileListFunction(endPtr, listFunction->opcode);
+
         return SetErrorType(UNKNOWN_IDENTIFIER, function);
     }
 
@@ -2112,13 +2533,11 @@ FunctionParserBase<Value_t>::CompilePow(const char* function)
     return function;
 }
 
-/* Currently the power operator is skipped for integral types because its
-   usefulness with them is questionable, and in the case of GmpInt, for safety
-   reasons:
-   - With long int almost any power, except for very small ones, would
-     overflow the result, so the usefulness of this is rather questionable.
-   - With GmpInt the power operator could be easily abused to make the program
-     run out of memory (think of a function like "10^10^10^10^1000000").
+/* With the integral types the power operator is always a cPow, which
+   Eval() computes exactly by repeated squaring. A result that doesn't fit
+   in a long is an overflow error, and with GmpInt so is one that would be
+   absurdly large (think of a function like "10^10^10^10^1000000"), so that
+   it can't be abused to make the program run out of memory.
 */
 #ifdef FP_SUPPORT_LONG_INT_TYPE
 template<>
@@ -2127,7 +2546,20 @@ FunctionParserBase<long>::CompilePow(const char* function)
 {
     function = CompileElement(function);
     if(!function) return 0;
-    return CompilePossibleUnit(function);
+    function = CompilePossibleUnit(function);
+
+    if(*function == '^')
+    {
+        ++function;
+        SkipSpace(function);
+
+        function = CompileUnaryMinus(function);
+        if(!function) return 0;
+
+        AddFunctionOpcode(cPow);
+        --mStackPtr;
+    }
+    return function;
 }
 #endif
 
@@ -2138,7 +2570,20 @@ FunctionParserBase<GmpInt>::CompilePow(const char* function)
 {
     function = CompileElement(function);
     if(!function) return 0;
-    return CompilePossibleUnit(function);
+    function = CompilePossibleUnit(function);
+
+    if(*function == '^')
+    {
+        ++function;
+        SkipSpace(function);
+
+        function = CompileUnaryMinus(function);
+        if(!function) return 0;
+
+        AddFunctionOpcode(cPow);
+        --mStackPtr;
+    }
+    return function;
 }
 #endif
 
@@ -2206,7 +2651,8 @@ FunctionParserBase<Value_t>::CompileMult(const char* function)
         }
         if(c != '*' && c != '/') break;
 
-        bool safe_cumulation = (c == '*' || !IsIntType<Value_t>::result);
+        bool safe_cumulation = (c == '*' || !IsIntType<Value_t>::result)
+                            && !IsOverflowingType<Value_t>::result;
         if(!safe_cumulation)
         {
             FP_FlushImmed(true);
@@ -2317,6 +2763,7 @@ FunctionParserBase<Value_t>::CompileAddition(const char* function)
     function = CompileMult(function);
     if(!function) return 0;
 
+    const bool safe_cumulation = !IsOverflowingType<Value_t>::result;
     Value_t pending_immed(0);
     #define FP_FlushImmed(do_reset) \
         if(pending_immed != Value_t(0)) \
@@ -2341,7 +2788,7 @@ FunctionParserBase<Value_t>::CompileAddition(const char* function)
         if(c != '+' && c != '-') break;
         ++function;
         SkipSpace(function);
-        if(mData->mByteCode.back() == cImmed)
+        if(safe_cumulation && mData->mByteCode.back() == cImmed)
         {
             // 5 (...) cAdd --> (...)      ||| 5 cAdd
             // 5 (...) cSub --> (...) cNeg ||| 5 cAdd
@@ -2356,7 +2803,8 @@ FunctionParserBase<Value_t>::CompileAddition(const char* function)
                 AddFunctionOpcode(cNeg);
             continue;
         }
-        if(mData->mByteCode.back() == cAdd
+        if(safe_cumulation
+        && mData->mByteCode.back() == cAdd
         && mData->mByteCode[mData->mByteCode.size()-2] == cImmed)
         {
             // (:::) 5 cAdd (...) cAdd -> (:::) (...) cAdd  ||| 5 cAdd
@@ -2370,7 +2818,7 @@ FunctionParserBase<Value_t>::CompileAddition(const char* function)
         // cSub is not tested here because the bytecode
         // optimizer will convert this kind of cSubs into cAdds.
         bool lhs_negated = false;
-        if(mData->mByteCode.back() == cNeg)
+        if(safe_cumulation && mData->mByteCode.back() == cNeg)
         {
             // (:::) cNeg (...) cAdd -> (:::) (...) cRSub
             // (:::) cNeg (...) cSub -> (:::) (...) cAdd cNeg
@@ -2380,7 +2828,8 @@ FunctionParserBase<Value_t>::CompileAddition(const char* function)
         }
         function = CompileMult(function);
         if(!function) return 0;
-        if(mData->mByteCode.back() == cAdd
+        if(safe_cumulation
+        && mData->mByteCode.back() == cAdd
         && mData->mByteCode[mData->mByteCode.size()-2] == cImmed)
         {
             // (:::) (...) 5 cAdd cAdd -> (:::) (...) cAdd  |||  5 Add
@@ -2395,7 +2844,8 @@ FunctionParserBase<Value_t>::CompileAddition(const char* function)
             mData->mByteCode.pop_back();
         }
         else
-        if(mData->mByteCode.back() == cRSub
+        if(safe_cumulation
+        && mData->mByteCode.back() == cRSub
         && mData->mByteCode[mData->mByteCode.size()-2] == cImmed)
         {
             // (:::) (...) 5 cRSub cAdd -> (:::) (...) cSub  |||  5 cAdd
@@ -2581,70 +3031,1140 @@ inline void FunctionParserBase<Value_t>::PutOpcodeParamAt
 }
 
 //===========================================================================
-// Function evaluation
+// Numerical methods for sub-program constructs
 //===========================================================================
-template<typename Value_t>
-Value_t FunctionParserBase<Value_t>::Eval(const Value_t* Vars)
+namespace
 {
-    if(mData->mParseErrorType != FP_NO_ERROR) return Value_t(0);
+    // Gauss-Kronrod 7-15 rule on [-1, 1]. The rule is symmetric, so only the
+    // non-negative nodes are listed; every odd node is also a Gauss node.
+    const double GK15Nodes[8] =
+    {
+        0.991455371120812639206854697526329,
+        0.949107912342758524526189684047851,
+        0.864864423359769072789712788640926,
+        0.741531185599394439863864773280788,
+        0.586087235467691130294144845693013,
+        0.405845151377397166906606412076961,
+        0.207784955007898467600689403773245,
+        0.000000000000000000000000000000000
+    };
+    const double GK15Weights[8] =
+    {
+        0.022935322010529224963732008058970,
+        0.063092092629978553290700663189204,
+        0.104790010322250183839876322541518,
+        0.140653259715525918745189590510238,
+        0.169004726639267902826583426598550,
+        0.190350578064785409913256402421014,
+        0.204432940075298892414161999234649,
+        0.209482141084727828012999174891714
+    };
+    const double G7Weights[4] =
+    {
+        0.129484966168869693270611432679082,
+        0.279705391489276667901467771423780,
+        0.381830050505118944950369775488975,
+        0.417959183673469387755102040816327
+    };
 
-    const unsigned* const byteCode = &(mData->mByteCode[0]);
-    const Value_t* const immed = mData->mImmed.empty() ? 0 : &(mData->mImmed[0]);
-    const unsigned byteCodeSize = unsigned(mData->mByteCode.size());
-    unsigned IP, DP=0;
-    int SP=-1;
+    const unsigned IntegrationMaxIntervals = 1000;
 
-#ifdef FP_USE_THREAD_SAFE_EVAL
-    /* If Eval() may be called by multiple threads simultaneously,
-     * then Eval() must allocate its own stack.
-     */
-#ifdef FP_USE_THREAD_SAFE_EVAL_WITH_ALLOCA
-    /* alloca() allocates room from the hardware stack.
-     * It is automatically freed when the function returns.
-     */
-    Value_t* const Stack = (Value_t*)alloca(mData->mStackSize*sizeof(Value_t));
-#else
-    /* Allocate from the heap. Ensure that it is freed
-     * automatically no matter which exit path is taken.
-     */
-    struct AutoDealloc
+    template<typename Value_t>
+    struct IntegrationInterval
     {
-        Value_t* ptr;
-        ~AutoDealloc() { delete[] ptr; }
-    } AutoDeallocStack = { new Value_t[mData->mStackSize] };
-    Value_t*& Stack = AutoDeallocStack.ptr;
-#endif
-#else
-    /* No thread safety, so use a global stack. */
-    std::vector<Value_t>& Stack = mData->mStack;
-#endif
+        Value_t begin, end, value, error;
+    };
 
-    for(IP=0; IP<byteCodeSize; ++IP)
+    /* Applies the G7K15 rule to [begin, end]. All 15 nodes are evaluated in
+       one batch. Returns the evaluation error of the integrand, if any. */
+    template<typename Value_t>
+    int integrateGK15(FunctionParserBase<Value_t>& integrand,
+                      Value_t* vars, unsigned varIndex,
+                      IntegrationInterval<Value_t>& interval)
     {
-        switch(byteCode[IP])
-        {
-// Functions:
-          case   cAbs: Stack[SP] = fp_abs(Stack[SP]); break;
+        const Value_t center = (interval.begin + interval.end) * Value_t(0.5);
+        const Value_t halfLength = (interval.end - interval.begin) * Value_t(0.5);
 
-          case  cAcos:
-              if(IsComplexType<Value_t>::result == false
-              && (Stack[SP] < Value_t(-1) || Stack[SP] > Value_t(1)))
-              { mData->mEvalErrorType=4; return Value_t(0); }
-              Stack[SP] = fp_acos(Stack[SP]); break;
+        Value_t points[15], values[15];
+        for(unsigned i = 0; i < 7; ++i)
+        {
+            const Value_t dx = halfLength * Value_t(GK15Nodes[i]);
+            points[2*i] = center - dx;
+            points[2*i+1] = center + dx;
+        }
+        points[14] = center;
 
-          case cAcosh:
-              if(IsComplexType<Value_t>::result == false
-              && Stack[SP] < Value_t(1))
-              { mData->mEvalErrorType=4; return Value_t(0); }
-              Stack[SP] = fp_acosh(Stack[SP]); break;
+        if(integrand.EvalBatch(vars, varIndex, points, values, 15) != 15)
+            return integrand.EvalError();
 
-          case  cAsin:
-              if(IsComplexType<Value_t>::result == false
-              && (Stack[SP] < Value_t(-1) || Stack[SP] > Value_t(1)))
-              { mData->mEvalErrorType=4; return Value_t(0); }
-              Stack[SP] = fp_asin(Stack[SP]); break;
+        Value_t kronrod = values[14] * Value_t(GK15Weights[7]);
+        Value_t gauss = values[14] * Value_t(G7Weights[3]);
+        for(unsigned i = 0; i < 7; ++i)
+        {
+            const Value_t sum = values[2*i] + values[2*i+1];
+            kronrod += sum * Value_t(GK15Weights[i]);
+            if(i % 2 == 1) gauss += sum * Value_t(G7Weights[i/2]);
+        }
 
-          case cAsinh: Stack[SP] = fp_asinh(Stack[SP]); break;
+        interval.value = kronrod * halfLength;
+        interval.error = fp_abs((kronrod - gauss) * halfLength);
+        return 0;
+    }
+
+    /* Globally adaptive quadrature: the interval with the largest error
+       estimate is bisected until the total estimate falls within the
+       tolerance. Returns an evaluation error code (6 if the tolerance
+       couldn't be reached). */
+    template<typename Value_t>
+    int integrateSubProgram(FunctionParserBase<Value_t>& integrand,
+                            Value_t* vars, unsigned varIndex,
+                            const Value_t& begin, const Value_t& end,
+                            Value_t& result)
+    {
+        // The nodes and weights are doubles, which bounds the accuracy
+        // that types with more precision can reach.
+        const Value_t tolerance =
+            fp_max(Epsilon<Value_t>::value * Value_t(10), Value_t(1e-14));
+
+        std::vector<IntegrationInterval<Value_t> > intervals(1);
+        intervals[0].begin = begin;
+        intervals[0].end = end;
+        int error = integrateGK15(integrand, vars, varIndex, intervals[0]);
+        if(error) return error;
+
+        while(true)
+        {
+            Value_t totalValue = Value_t(0), totalError = Value_t(0);
+            std::size_t worst = 0;
+            for(std::size_t i = 0; i < intervals.size(); ++i)
+            {
+                totalValue += intervals[i].value;
+                totalError += intervals[i].error;
+                if(intervals[worst].error < intervals[i].error) worst = i;
+            }
+
+            result = totalValue;
+            if(totalError <= tolerance * fp_max(Value_t(1), fp_abs(totalValue)))
+                return 0;
+            if(intervals.size() >= IntegrationMaxIntervals)
+                return 6;
+
+            IntegrationInterval<Value_t> upper = intervals[worst];
+            IntegrationInterval<Value_t>& lower = intervals[worst];
+            lower.end = upper.begin = (lower.begin + lower.end) * Value_t(0.5);
+
+            error = integrateGK15(integrand, vars, varIndex, lower);
+            if(!error) error = integrateGK15(integrand, vars, varIndex, upper);
+            if(error) return error;
+            intervals.push_back(upper);
+        }
+    }
+
+    const long ReductionMaxTerms = 1000000000L;
+
+    /* Kahan-Babuska (Neumaier) compensated summation */
+    template<typename Value_t>
+    struct CompensatedSum
+    {
+        Value_t sum, compensation;
+
+        CompensatedSum(): sum(0), compensation(0) {}
+
+        // Returns false if an integral sum overflows.
+        bool add(const Value_t& value)
+        {
+            if(IsIntType<Value_t>::result) return fp_checkedAdd(sum, value);
+
+            const Value_t t = sum + value;
+            if(fp_abs(value) <= fp_abs(sum))
+                compensation += (sum - t) + value;
+            else
+                compensation += (value - t) + sum;
+            sum = t;
+            return true;
+        }
+
+        Value_t get() const { return sum + compensation; }
+    };
+
+    /* Sums (or multiplies) f(first + k) for k = begin..end-1, evaluating
+       the sub-program in batches. */
+    template<typename Value_t>
+    int reduceSubProgram(FunctionParserBase<Value_t>& f,
+                         Value_t* vars, unsigned varIndex,
+                         const Value_t& first, long begin, long end,
+                         bool product, Value_t& result)
+    {
+        const long BatchSize = 64;
+        Value_t points[BatchSize], values[BatchSize];
+        CompensatedSum<Value_t> sum;
+        Value_t prod = Value_t(1);
+
+        for(long k = begin; k < end; k += BatchSize)
+        {
+            const unsigned amount = unsigned(std::min(BatchSize, end - k));
+            for(unsigned i = 0; i < amount; ++i)
+                points[i] = first + Value_t(k + long(i));
+
+            if(f.EvalBatch(vars, varIndex, points, values, amount) != amount)
+                return f.EvalError();
+
+            for(unsigned i = 0; i < amount; ++i)
+            {
+                if(product ? !fp_checkedMul(prod, values[i])
+                           : !sum.add(values[i]))
+                    return 8;
+            }
+        }
+
+        result = product ? prod : sum.get();
+        return 0;
+    }
+
+#ifdef FP_ENABLE_PARALLEL_REDUCTION
+    const long ParallelReductionThreshold = 16384;
+    const long ParallelReductionMaxThreads = 8;
+
+    template<typename Value_t>
+    struct ReductionTask
+    {
+        FunctionParserBase<Value_t> parser;
+        std::vector<Value_t> vars;
+        unsigned varIndex;
+        Value_t first;
+        long begin, end;
+        bool product;
+        Value_t result;
+        int error;
+        const int* cancelFlag;
+    };
+
+    template<typename Value_t>
+    void* runReductionTask(void* arg)
+    {
+        ReductionTask<Value_t>& task = *static_cast<ReductionTask<Value_t>*>(arg);
+        gCancelFlag = task.cancelFlag;
+        task.error = reduceSubProgram(task.parser, &task.vars[0], task.varIndex,
+                                      task.first, task.begin, task.end,
+                                      task.product, task.result);
+        return 0;
+    }
+#endif
+
+    /* sum(f, i, a, b) and prod(f, i, a, b). Large ranges of self-contained
+       sub-programs are split between threads, each one evaluating its own
+       deep copy of the sub-program; partial sums are combined with the
+       same compensated summation. */
+    template<typename Value_t>
+    int reduceSubProgramRange(FunctionParserBase<Value_t>& f,
+                              Value_t* vars, unsigned varsAmount,
+                              unsigned varIndex, bool parallelSafe,
+                              const Value_t& a, const Value_t& b,
+                              bool product, Value_t& result)
+    {
+        if(b < a)
+        {
+            result = Value_t(product ? 1 : 0);
+            return 0;
+        }
+        /* b - a + 1 terms, at most ReductionMaxTerms - 1; written so that
+           a NaN span (a and b the same infinity) is rejected as well */
+        Value_t span = b;
+        if(!fp_checkedSub(span, a) || !(span < Value_t(ReductionMaxTerms - 1)))
+            return 7;
+        const long count = makeLongInteger(fp_floor(span)) + 1;
+
+#ifdef FP_ENABLE_PARALLEL_REDUCTION
+        long threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if(parallelSafe && threads > 1 && count >= ParallelReductionThreshold)
+        {
+            threads = std::min(threads, ParallelReductionMaxThreads);
+            std::vector<ReductionTask<Value_t> > tasks(threads);
+            std::vector<pthread_t> ids(threads);
+            std::vector<bool> started(threads, false);
+
+            for(long t = 0; t < threads; ++t)
+            {
+                ReductionTask<Value_t>& task = tasks[t];
+                task.parser = f;
+                task.parser.ForceDeepCopy();
+                task.vars.assign(vars, vars + varsAmount);
+                task.varIndex = varIndex;
+                task.first = a;
+                task.begin = count * t / threads;
+                task.end = count * (t + 1) / threads;
+                task.product = product;
+                task.error = 0;
+                task.cancelFlag = gCancelFlag;
+            }
+
+            for(long t = 1; t < threads; ++t)
+                started[t] = pthread_create(&ids[t], 0, &runReductionTask<Value_t>,
+                                            &tasks[t]) == 0;
+            for(long t = 0; t < threads; ++t)
+            {
+                if(started[t]) pthread_join(ids[t], 0);
+                else runReductionTask<Value_t>(&tasks[t]);
+            }
+
+            CompensatedSum<Value_t> sum;
+            Value_t prod = Value_t(1);
+            for(long t = 0; t < threads; ++t)
+            {
+                if(tasks[t].error) return tasks[t].error;
+                if(product ? !fp_checkedMul(prod, tasks[t].result)
+                           : !sum.add(tasks[t].result))
+                    return 8;
+            }
+            result = product ? prod : sum.get();
+            return 0;
+        }
+#else
+        (void) varsAmount; (void) parallelSafe;
+#endif
+
+        return reduceSubProgram(f, vars, varIndex, a, 0, count, product, result);
+    }
+
+    const unsigned SolveMaxIterations = 100;
+    const unsigned SolveMaxStepHalvings = 16;
+
+    template<typename Value_t>
+    inline bool sameSign(const Value_t& a, const Value_t& b)
+    {
+        return (a < Value_t(0)) == (b < Value_t(0));
+    }
+
+    template<typename Value_t>
+    inline int evalSubProgramAt(FunctionParserBase<Value_t>& f,
+                                Value_t* vars, unsigned varIndex,
+                                const Value_t& x, Value_t& fx)
+    {
+        return f.EvalBatch(vars, varIndex, &x, &fx, 1) == 1 ? 0 : f.EvalError();
+    }
+
+    /* Brent's method on a bracket [a, b] where f(a) and f(b) have opposite
+       signs. */
+    template<typename Value_t>
+    int solveBrent(FunctionParserBase<Value_t>& f,
+                   Value_t* vars, unsigned varIndex,
+                   Value_t a, Value_t fa, Value_t b, Value_t fb,
+                   Value_t& result)
+    {
+        const Value_t eps = Epsilon<Value_t>::value;
+        Value_t c = a, fc = fa, d = b - a, e = d;
+
+        for(unsigned iteration = 0; iteration < SolveMaxIterations; ++iteration)
+        {
+            if(sameSign(fb, fc))
+            {
+                c = a; fc = fa;
+                d = e = b - a;
+            }
+            if(fp_abs(fc) < fp_abs(fb))
+            {
+                a = b; b = c; c = a;
+                fa = fb; fb = fc; fc = fa;
+            }
+
+            const Value_t tol = Value_t(2) * eps * fp_abs(b) + Value_t(0.5) * eps;
+            const Value_t xm = Value_t(0.5) * (c - b);
+            if(fp_abs(xm) <= tol || fb == Value_t(0))
+            {
+                result = b;
+                return 0;
+            }
+
+            if(fp_abs(e) >= tol && fp_abs(fb) < fp_abs(fa))
+            {
+                // Inverse quadratic interpolation, or secant if a == c
+                const Value_t s = fb / fa;
+                Value_t p, q;
+                if(a == c)
+                {
+                    p = Value_t(2) * xm * s;
+                    q = Value_t(1) - s;
+                }
+                else
+                {
+                    const Value_t qa = fa / fc, r = fb / fc;
+                    p = s * (Value_t(2) * xm * qa * (qa - r) - (b - a) * (r - Value_t(1)));
+                    q = (qa - Value_t(1)) * (r - Value_t(1)) * (s - Value_t(1));
+                }
+                if(p > Value_t(0)) q = -q;
+                p = fp_abs(p);
+
+                if(Value_t(2) * p < fp_min(Value_t(3) * xm * q - fp_abs(tol * q),
+                                           fp_abs(e * q)))
+                {
+                    e = d;
+                    d = p / q;
+                }
+                else
+                    d = e = xm;
+            }
+            else
+                d = e = xm;
+
+            a = b; fa = fb;
+            if(fp_abs(d) > tol) b += d;
+            else b += (xm > Value_t(0) ? tol : -tol);
+
+            const int error = evalSubProgramAt(f, vars, varIndex, b, fb);
+            if(error) return error;
+        }
+        return 6;
+    }
+
+    /* Newton's method from x0, with the derivative estimated from a forward
+       difference evaluated in the same batch as f(x). Steps which don't
+       reduce |f| are halved. As soon as a sign change is seen, the root is
+       bracketed and the search continues with Brent's method. Returns an
+       evaluation error code (6 if no root was found). */
+    template<typename Value_t>
+    int solveSubProgram(FunctionParserBase<Value_t>& f,
+                        Value_t* vars, unsigned varIndex,
+                        const Value_t& x0, Value_t& result)
+    {
+        const Value_t eps = Epsilon<Value_t>::value;
+        const Value_t diffStep = fp_sqrt(eps);
+
+        Value_t x = x0, prevX = x0, prevFx = Value_t(0), step = Value_t(0);
+        bool havePrev = false;
+        unsigned halvings = 0;
+
+        for(unsigned iteration = 0; iteration < SolveMaxIterations; ++iteration)
+        {
+            const Value_t h =
+                diffStep * (x == Value_t(0) ? Value_t(1) : fp_abs(x));
+            Value_t points[2] = { x, x + h }, values[2];
+            const unsigned evaluated =
+                f.EvalBatch(vars, varIndex, points, values, 2);
+
+            if(evaluated < 2 || (havePrev && !(fp_abs(values[0]) < fp_abs(prevFx))))
+            {
+                // Failed or not improving: retry with a shorter step
+                if(!havePrev) return f.EvalError();
+                if(evaluated > 0 && !sameSign(values[0], prevFx))
+                    return solveBrent(f, vars, varIndex, prevX, prevFx,
+                                      x, values[0], result);
+                if(halvings < SolveMaxStepHalvings)
+                {
+                    ++halvings;
+                    step *= Value_t(0.5);
+                    x = prevX + step;
+                    continue;
+                }
+                if(evaluated < 2) return f.EvalError();
+            }
+            halvings = 0;
+
+            const Value_t fx = values[0], fxh = values[1];
+            if(fx == Value_t(0))
+            {
+                result = x;
+                return 0;
+            }
+            if(havePrev && !sameSign(fx, prevFx))
+                return solveBrent(f, vars, varIndex, prevX, prevFx, x, fx, result);
+            if(!sameSign(fx, fxh))
+                return solveBrent(f, vars, varIndex, x, fx, x + h, fxh, result);
+
+            const Value_t derivative = (fxh - fx) / h;
+            step = derivative == Value_t(0)
+                ? fp_max(Value_t(1), fp_abs(x))
+                : -fx / derivative;
+            if(fp_abs(step) <= eps * fp_max(Value_t(1), fp_abs(x)))
+            {
+                result = x;
+                return 0;
+            }
+
+            prevX = x;
+            prevFx = fx;
+            havePrev = true;
+            x += step;
+        }
+        return 6;
+    }
+}
+
+//===========================================================================
+// List functions
+//===========================================================================
+namespace
+{
+    // EvalColumns() evaluates this many lanes at a time.
+    const unsigned LaneBlockSize = 64;
+
+    /* Whether the bytecode can be run by EvalColumns() on whole blocks of
+       lanes at once, ie. it has no jumps, calls or sub-programs. */
+    inline bool isLaneEvaluable(const std::vector<unsigned>& byteCode)
+    {
+        for(unsigned i = 0; i < byteCode.size(); ++i)
+        {
+            if(byteCode[i] >= VarBegin) continue;
+            switch(byteCode[i])
+            {
+              case cFetch: ++i; break;
+
+              case cAbs: case cAcos: case cAcosh: case cAsin: case cAsinh:
+              case cAtan: case cAtan2: case cAtanh: case cCbrt: case cCeil:
+              case cCos: case cCosh: case cCot: case cCsc: case cExp:
+              case cExp2: case cFloor: case cHypot: case cInt: case cLog:
+              case cLog10: case cLog2: case cMax: case cMin: case cPow:
+              case cTrunc: case cSec: case cSin: case cSinh: case cSqrt:
+              case cTan: case cTanh: case cImmed: case cNeg: case cAdd:
+              case cSub: case cMul: case cDiv: case cMod: case cEqual:
+              case cNEqual: case cLess: case cLessOrEq: case cGreater:
+              case cGreaterOrEq: case cNot: case cNotNot: case cAnd: case cOr:
+              case cDeg: case cRad: case cSinCos: case cSinhCosh:
+              case cAbsNot: case cAbsNotNot: case cAbsAnd: case cAbsOr:
+              case cDup: case cInv: case cSqr: case cRDiv: case cRSub:
+              case cRSqrt:
+                  break;
+
+              default: return false;
+            }
+        }
+        return true;
+    }
+
+    /* Mean and sum of squared deviations in a single pass. Welford's update
+       is applied per block of values (as generalized by Chan et al.), which
+       keeps the inner loops free of divisions and dependencies so that they
+       can be vectorized. */
+    template<typename Value_t>
+    void listMoments(const std::vector<Value_t>& values,
+                     Value_t& mean, Value_t& squares)
+    {
+        mean = squares = Value_t(0);
+        long count = 0;
+        for(unsigned first = 0; first < values.size(); first += LaneBlockSize)
+        {
+            const unsigned n =
+                std::min(LaneBlockSize, unsigned(values.size()) - first);
+            const Value_t* const x = &values[first];
+
+            Value_t blockSum = Value_t(0);
+            for(unsigned i = 0; i < n; ++i) blockSum += x[i];
+            const Value_t blockMean = blockSum / Value_t(long(n));
+            Value_t blockSquares = Value_t(0);
+            for(unsigned i = 0; i < n; ++i)
+            {
+                const Value_t d = x[i] - blockMean;
+                blockSquares += d * d;
+            }
+
+            const long total = count + long(n);
+            const Value_t delta = blockMean - mean;
+            mean += delta * Value_t(long(n)) / Value_t(total);
+            squares += blockSquares + delta * delta *
+                (Value_t(count) * Value_t(long(n)) / Value_t(total));
+            count = total;
+        }
+    }
+
+    // std algorithms don't see the comparison operators of complex types.
+    template<typename Value_t>
+    struct ValueLess
+    {
+        bool operator()(const Value_t& a, const Value_t& b) const
+        { return a < b; }
+    };
+
+    /* Reduces the (non-empty) list of values of a list function. The list
+       may be reordered. */
+    template<typename Value_t>
+    int reduceList(unsigned opcode, std::vector<Value_t>& values,
+                   Value_t& result)
+    {
+        const unsigned n = unsigned(values.size());
+        switch(opcode)
+        {
+          case cMean:
+          case cVar:
+          case cStdev:
+              {
+                  Value_t mean, squares;
+                  listMoments(values, mean, squares);
+                  if(opcode == cMean)
+                  {
+                      result = mean;
+                      break;
+                  }
+                  // Sample variance
+                  if(n < 2) return 4;
+                  result = squares / Value_t(long(n - 1));
+                  if(opcode == cStdev) result = fp_sqrt(result);
+                  break;
+              }
+
+          case cListMin:
+          case cListMax:
+              {
+                  Value_t best = values[0];
+                  if(opcode == cListMin)
+                  {
+                      for(unsigned i = 1; i < n; ++i)
+                          if(values[i] < best) best = values[i];
+                  }
+                  else
+                  {
+                      for(unsigned i = 1; i < n; ++i)
+                          if(best < values[i]) best = values[i];
+                  }
+                  result = best;
+                  break;
+              }
+
+          case cMedian:
+              {
+                  const typename std::vector<Value_t>::iterator middle =
+                      values.begin() + n / 2;
+                  std::nth_element(values.begin(), middle, values.end(),
+                                   ValueLess<Value_t>());
+                  result = *middle;
+                  if(n % 2 == 0)
+                      result = (*std::max_element(values.begin(), middle,
+                                                  ValueLess<Value_t>()) +
+                                result) / Value_t(2);
+                  break;
+              }
+        }
+        return 0;
+    }
+}
+
+//===========================================================================
+// In-place MpfrFloat evaluation
+//===========================================================================
+namespace
+{
+    /* Types without an in-place evaluator use the generic loop of Eval(). */
+    template<typename Value_t>
+    inline bool evalInPlace(const std::vector<unsigned>&,
+                            const std::vector<Value_t>&, const Value_t*,
+                            unsigned, Value_t&, int&)
+    {
+        return false;
+    }
+
+#ifdef FP_SUPPORT_MPFR_FLOAT_TYPE
+    /* The opcodes that the in-place MpfrFloat evaluator implements; any
+       other opcode makes Eval() use the generic loop. */
+    bool isMpfrInPlaceEvaluable(const std::vector<unsigned>& byteCode)
+    {
+        using namespace FUNCTIONPARSERTYPES;
+        for(unsigned IP = 0; IP < byteCode.size(); ++IP)
+        {
+            switch(byteCode[IP])
+            {
+              case cAbs: case cAcos: case cAcosh: case cAsin: case cAsinh:
+              case cAtan: case cAtan2: case cAtanh: case cCbrt: case cCeil:
+              case cCos: case cCosh: case cCot: case cCsc: case cExp:
+              case cExp2: case cFloor: case cHypot: case cInt: case cLog:
+              case cLog10: case cLog2: case cMax: case cMin: case cPow:
+              case cTrunc: case cSec: case cSin: case cSinh: case cSqrt:
+              case cTan: case cTanh: case cImmed: case cNeg: case cAdd:
+              case cSub: case cMul: case cDiv: case cMod: case cEqual:
+              case cNEqual: case cLess: case cLessOrEq: case cGreater:
+              case cGreaterOrEq: case cNot: case cNotNot: case cAnd:
+              case cOr: case cDeg: case cRad: case cDup: case cInv:
+              case cSqr: case cRDiv: case cRSub: case cRSqrt:
+                  break;
+
+              case cIf: case cJump:
+                  IP += 2;
+                  break;
+
+              case cFetch:
+                  ++IP;
+                  break;
+
+              default:
+                  if(byteCode[IP] < VarBegin) return false;
+            }
+        }
+        return true;
+    }
+
+    /* Evaluation stack of raw mpfr numbers, set up with the MPFR custom
+       interface in one block of memory (a local buffer for small stacks),
+       so that the stack itself costs no allocations.
+       Each entry is read through an operand pointer. Pushing a variable or
+       an immediate only points the entry at the value's own mpfr data; the
+       entry gets a value of its own when an operation writes to it. */
+    class MpfrEvalStack
+    {
+        enum { LocalLimbs = 1024 };
+        mp_limb_t mLocal[LocalLimbs];
+        std::vector<mp_limb_t> mHeap;
+        mpfr_t* mValues;
+        mpfr_t* mReferences;
+        mpfr_srcptr* mOperands;
+
+        static size_t limbsFor(size_t bytes)
+        {
+            return (bytes + sizeof(mp_limb_t) - 1) / sizeof(mp_limb_t);
+        }
+
+     public:
+        MpfrEvalStack(unsigned size, mpfr_prec_t precision)
+        {
+            const size_t valueLimbs =
+                limbsFor(mpfr_custom_get_size(precision));
+            const size_t entryLimbs = 2 * limbsFor(sizeof(mpfr_t)) +
+                limbsFor(sizeof(mpfr_srcptr)) + valueLimbs;
+
+            mp_limb_t* block = mLocal;
+            if(size * entryLimbs > LocalLimbs)
+            {
+                mHeap.resize(size * entryLimbs);
+                block = &mHeap[0];
+            }
+
+            mValues = reinterpret_cast<mpfr_t*>(block);
+            block += size * limbsFor(sizeof(mpfr_t));
+            mReferences = reinterpret_cast<mpfr_t*>(block);
+            block += size * limbsFor(sizeof(mpfr_t));
+            mOperands = reinterpret_cast<mpfr_srcptr*>(block);
+            block += limbsFor(size * sizeof(mpfr_srcptr));
+
+            for(unsigned i = 0; i < size; ++i, block += valueLimbs)
+            {
+                mpfr_custom_init(block, precision);
+                mpfr_custom_init_set(mValues[i], MPFR_ZERO_KIND, 0,
+                                     precision, block);
+            }
+        }
+
+        mpfr_srcptr operator[](int index) const
+        {
+            return mOperands[index];
+        }
+
+        // The entry's own value, for an operation to write its result to.
+        mpfr_ptr result(int index)
+        {
+            mOperands[index] = mValues[index];
+            return mValues[index];
+        }
+
+        void load(int index, const MpfrFloat& value)
+        {
+            value.get_raw_mpfr_data(mReferences[index]);
+            mOperands[index] = mReferences[index];
+        }
+
+        // Entry to = entry from, where from is the top of the stack.
+        void move(int to, int from)
+        {
+            if(mOperands[from] == mValues[from])
+            {
+                mpfr_swap(mValues[to], mValues[from]);
+                mOperands[to] = mValues[to];
+            }
+            else if(mOperands[from] == mReferences[from])
+            {
+                mReferences[to][0] = mReferences[from][0];
+                mOperands[to] = mReferences[to];
+            }
+            else
+                mOperands[to] = mOperands[from];
+        }
+
+        // Pushes entry from on top of the stack at index to. Entries below
+        // the top can't change while the new one exists, so it can refer to
+        // the same data.
+        void copy(int to, int from)
+        {
+            mOperands[to] = mOperands[from];
+        }
+    };
+
+    /* |x| >= 0.5, as fp_truth(); a regular x is m*2^e with 0.5 <= |m| < 1 */
+    inline bool mpfrTruth(mpfr_srcptr x)
+    {
+        if(mpfr_number_p(x) && !mpfr_zero_p(x)) return mpfr_get_exp(x) >= 0;
+        return mpfr_inf_p(x) != 0;
+    }
+
+    /* Runs the bytecode with each operation writing its result straight
+       into the stack entry of its first operand, so that an opcode is a
+       single MPFR call instead of a temporary MpfrFloat allocated from and
+       released to the container. The comparison and truth semantics are
+       those of fpaux.hh. */
+    inline bool evalInPlace(const std::vector<unsigned>& byteCodeVector,
+                            const std::vector<MpfrFloat>& immedVector,
+                            const MpfrFloat* Vars, unsigned stackSize,
+                            MpfrFloat& result, int& error)
+    {
+        using namespace FUNCTIONPARSERTYPES;
+        if(!isMpfrInPlaceEvaluable(byteCodeVector)) return false;
+
+        const mpfr_prec_t precision =
+            mpfr_prec_t(MpfrFloat::getCurrentDefaultMantissaBits());
+        // The last entry is scratch space for the comparisons.
+        MpfrEvalStack Stack(stackSize + 1, precision);
+        const mpfr_ptr tmp = Stack.result(int(stackSize));
+
+        mpfr_t epsilon;
+        Epsilon<MpfrFloat>::value.get_raw_mpfr_data(epsilon);
+
+        const unsigned* const byteCode = &byteCodeVector[0];
+        const unsigned byteCodeSize = unsigned(byteCodeVector.size());
+        const MpfrFloat* const immed =
+            immedVector.empty() ? 0 : &immedVector[0];
+        unsigned IP, DP=0;
+        int SP=-1;
+        error = 0;
+
+#define FP_MPFR_UNARY(f) \
+        { mpfr_srcptr x = Stack[SP]; f(Stack.result(SP), x, GMP_RNDN); }
+#define FP_MPFR_UNARY_EXACT(f) \
+        { mpfr_srcptr x = Stack[SP]; f(Stack.result(SP), x); }
+#define FP_MPFR_BINARY(f) \
+        { mpfr_srcptr x = Stack[SP-1], y = Stack[SP]; \
+          f(Stack.result(SP-1), x, y, GMP_RNDN); --SP; }
+#define FP_MPFR_INVERSE \
+        { mpfr_srcptr x = Stack[SP]; \
+          mpfr_ui_div(Stack.result(SP), 1, x, GMP_RNDN); }
+// value reads the operands, so it must be computed before Stack.result()
+// repoints the slot.
+#define FP_MPFR_TRUTH(index, value) \
+        { const bool truth = (value); \
+          mpfr_set_si(Stack.result(index), truth ? 1 : 0, GMP_RNDN); }
+#define FP_MPFR_FAIL(code) { error = code; return true; }
+
+        for(IP=0; IP<byteCodeSize; ++IP)
+        {
+            switch(byteCode[IP])
+            {
+              case   cAbs: FP_MPFR_UNARY(mpfr_abs); break;
+
+              case  cAcos:
+                  if(mpfr_cmp_si(Stack[SP], -1) < 0
+                  || mpfr_cmp_si(Stack[SP], 1) > 0) FP_MPFR_FAIL(4);
+                  FP_MPFR_UNARY(mpfr_acos); break;
+
+              case cAcosh:
+                  if(mpfr_cmp_si(Stack[SP], 1) < 0) FP_MPFR_FAIL(4);
+                  FP_MPFR_UNARY(mpfr_acosh); break;
+
+              case  cAsin:
+                  if(mpfr_cmp_si(Stack[SP], -1) < 0
+                  || mpfr_cmp_si(Stack[SP], 1) > 0) FP_MPFR_FAIL(4);
+                  FP_MPFR_UNARY(mpfr_asin); break;
+
+              case cAsinh: FP_MPFR_UNARY(mpfr_asinh); break;
+              case  cAtan: FP_MPFR_UNARY(mpfr_atan); break;
+              case cAtan2: FP_MPFR_BINARY(mpfr_atan2); break;
+
+              case cAtanh:
+                  if(!mpfr_nan_p(Stack[SP])
+                  && mpfr_cmpabs_ui(Stack[SP], 1) >= 0) FP_MPFR_FAIL(4);
+                  FP_MPFR_UNARY(mpfr_atanh); break;
+
+              case  cCbrt: FP_MPFR_UNARY(mpfr_cbrt); break;
+              case  cCeil: FP_MPFR_UNARY_EXACT(mpfr_ceil); break;
+              case   cCos: FP_MPFR_UNARY(mpfr_cos); break;
+              case  cCosh: FP_MPFR_UNARY(mpfr_cosh); break;
+
+              case   cCot:
+                  FP_MPFR_UNARY(mpfr_tan);
+                  if(mpfr_zero_p(Stack[SP])) FP_MPFR_FAIL(1);
+                  FP_MPFR_INVERSE; break;
+
+              case   cCsc:
+                  FP_MPFR_UNARY(mpfr_sin);
+                  if(mpfr_zero_p(Stack[SP])) FP_MPFR_FAIL(1);
+                  FP_MPFR_INVERSE; break;
+
+              case   cExp: FP_MPFR_UNARY(mpfr_exp); break;
+              case  cExp2: FP_MPFR_UNARY(mpfr_exp2); break;
+              case cFloor: FP_MPFR_UNARY_EXACT(mpfr_floor); break;
+              case cHypot: FP_MPFR_BINARY(mpfr_hypot); break;
+
+              case    cIf:
+                  if(mpfrTruth(Stack[SP--]))
+                      IP += 2;
+                  else
+                  {
+                      const unsigned* buf = &byteCode[IP+1];
+                      IP = buf[0];
+                      DP = buf[1];
+                  }
+                  break;
+
+              case   cInt: FP_MPFR_UNARY_EXACT(mpfr_round); break;
+
+              case   cLog:
+                  if(!(mpfr_cmp_ui(Stack[SP], 0) > 0)) FP_MPFR_FAIL(3);
+                  FP_MPFR_UNARY(mpfr_log); break;
+
+              case cLog10:
+                  if(!(mpfr_cmp_ui(Stack[SP], 0) > 0)) FP_MPFR_FAIL(3);
+                  FP_MPFR_UNARY(mpfr_log10); break;
+
+              case  cLog2:
+                  if(!(mpfr_cmp_ui(Stack[SP], 0) > 0)) FP_MPFR_FAIL(3);
+                  FP_MPFR_UNARY(mpfr_log2); break;
+
+              case   cMax:
+                  if(!mpfr_greater_p(Stack[SP-1], Stack[SP]))
+                      Stack.move(SP-1, SP);
+                  --SP; break;
+
+              case   cMin:
+                  if(!mpfr_less_p(Stack[SP-1], Stack[SP]))
+                      Stack.move(SP-1, SP);
+                  --SP; break;
+
+              case   cPow:
+                  if(mpfr_zero_p(Stack[SP-1]) && mpfr_sgn(Stack[SP]) < 0)
+                      FP_MPFR_FAIL(3);
+                  FP_MPFR_BINARY(mpfr_pow); break;
+
+              case cTrunc: FP_MPFR_UNARY_EXACT(mpfr_trunc); break;
+
+              case   cSec:
+                  FP_MPFR_UNARY(mpfr_cos);
+                  if(mpfr_zero_p(Stack[SP])) FP_MPFR_FAIL(1);
+                  FP_MPFR_INVERSE; break;
+
+              case   cSin: FP_MPFR_UNARY(mpfr_sin); break;
+              case  cSinh: FP_MPFR_UNARY(mpfr_sinh); break;
+
+              case  cSqrt:
+                  if(mpfr_sgn(Stack[SP]) < 0) FP_MPFR_FAIL(2);
+                  FP_MPFR_UNARY(mpfr_sqrt); break;
+
+              case   cTan: FP_MPFR_UNARY(mpfr_tan); break;
+              case  cTanh: FP_MPFR_UNARY(mpfr_tanh); break;
+
+              case cImmed: Stack.load(++SP, immed[DP++]); break;
+
+              case  cJump:
+                  {
+                      const unsigned* buf = &byteCode[IP+1];
+                      IP = buf[0];
+                      DP = buf[1];
+                      break;
+                  }
+
+              case   cNeg: FP_MPFR_UNARY(mpfr_neg); break;
+              case   cAdd: FP_MPFR_BINARY(mpfr_add); break;
+              case   cSub: FP_MPFR_BINARY(mpfr_sub); break;
+              case   cMul: FP_MPFR_BINARY(mpfr_mul); break;
+
+              case   cDiv:
+                  if(mpfr_zero_p(Stack[SP])) FP_MPFR_FAIL(1);
+                  FP_MPFR_BINARY(mpfr_div); break;
+
+              case   cMod:
+                  if(mpfr_zero_p(Stack[SP])) FP_MPFR_FAIL(1);
+                  FP_MPFR_BINARY(mpfr_fmod); break;
+
+              case cEqual:
+              case cNEqual:
+                  {
+                      mpfr_sub(tmp, Stack[SP-1], Stack[SP], GMP_RNDN);
+                      const int cmp = mpfr_cmpabs(tmp, epsilon);
+                      --SP;
+                      FP_MPFR_TRUTH(SP, !mpfr_nan_p(tmp)
+                          && (byteCode[IP] == cEqual ? cmp <= 0 : cmp > 0));
+                      break;
+                  }
+
+              case  cLess:
+                  mpfr_sub(tmp, Stack[SP], epsilon, GMP_RNDN);
+                  FP_MPFR_TRUTH(SP-1, mpfr_less_p(Stack[SP-1], tmp));
+                  --SP; break;
+
+              case  cLessOrEq:
+                  mpfr_add(tmp, Stack[SP], epsilon, GMP_RNDN);
+                  FP_MPFR_TRUTH(SP-1, mpfr_lessequal_p(Stack[SP-1], tmp));
+                  --SP; break;
+
+              case cGreater:
+                  mpfr_sub(tmp, Stack[SP-1], epsilon, GMP_RNDN);
+                  FP_MPFR_TRUTH(SP-1, mpfr_less_p(Stack[SP], tmp));
+                  --SP; break;
+
+              case cGreaterOrEq:
+                  mpfr_add(tmp, Stack[SP-1], epsilon, GMP_RNDN);
+                  FP_MPFR_TRUTH(SP-1, mpfr_lessequal_p(Stack[SP], tmp));
+                  --SP; break;
+
+              case   cNot: FP_MPFR_TRUTH(SP, !mpfrTruth(Stack[SP])); break;
+              case cNotNot: FP_MPFR_TRUTH(SP, mpfrTruth(Stack[SP])); break;
+
+              case   cAnd:
+                  FP_MPFR_TRUTH(SP-1, mpfrTruth(Stack[SP-1])
+                                   && mpfrTruth(Stack[SP]));
+                  --SP; break;
+
+              case    cOr:
+                  FP_MPFR_TRUTH(SP-1, mpfrTruth(Stack[SP-1])
+                                   || mpfrTruth(Stack[SP]));
+                  --SP; break;
+
+              case   cDeg:
+                  {
+                      const MpfrFloat factor = MpfrFloat::const_rad_to_deg();
+                      mpfr_t f;
+                      factor.get_raw_mpfr_data(f);
+                      mpfr_srcptr x = Stack[SP];
+                      mpfr_mul(Stack.result(SP), x, f, GMP_RNDN);
+                      break;
+                  }
+
+              case   cRad:
+                  {
+                      const MpfrFloat factor = MpfrFloat::const_deg_to_rad();
+                      mpfr_t f;
+                      factor.get_raw_mpfr_data(f);
+                      mpfr_srcptr x = Stack[SP];
+                      mpfr_mul(Stack.result(SP), x, f, GMP_RNDN);
+                      break;
+                  }
+
+              case   cFetch: Stack.copy(SP+1, byteCode[++IP]); ++SP; break;
+              case   cDup: Stack.copy(SP+1, SP); ++SP; break;
+
+              case   cInv:
+                  if(mpfr_zero_p(Stack[SP])) FP_MPFR_FAIL(1);
+                  FP_MPFR_INVERSE; break;
+
+              case   cSqr: FP_MPFR_UNARY(mpfr_sqr); break;
+
+              case   cRDiv:
+                  if(mpfr_zero_p(Stack[SP-1])) FP_MPFR_FAIL(1);
+                  {
+                      mpfr_srcptr x = Stack[SP-1], y = Stack[SP];
+                      mpfr_div(Stack.result(SP-1), y, x, GMP_RNDN);
+                      --SP; break;
+                  }
+
+              case   cRSub:
+                  {
+                      mpfr_srcptr x = Stack[SP-1], y = Stack[SP];
+                      mpfr_sub(Stack.result(SP-1), y, x, GMP_RNDN);
+                      --SP; break;
+                  }
+
+              case   cRSqrt:
+                  if(mpfr_zero_p(Stack[SP])) FP_MPFR_FAIL(1);
+                  FP_MPFR_UNARY(mpfr_rec_sqrt); break;
+
+              default:
+                  Stack.load(++SP, Vars[byteCode[IP]-VarBegin]);
+            }
+        }
+
+#undef FP_MPFR_UNARY
+#undef FP_MPFR_UNARY_EXACT
+#undef FP_MPFR_BINARY
+#undef FP_MPFR_INVERSE
+#undef FP_MPFR_TRUTH
+#undef FP_MPFR_FAIL
+
+        mpfr_t top;
+        top[0] = Stack[SP][0];
+        result.set_raw_mpfr_data(top);
+        return true;
+    }
+#endif
+}
+
+//===========================================================================
+// Function evaluation
+//===========================================================================
+template<typename Value_t>
+Value_t FunctionParserBase<Value_t>::Eval(const Value_t* Vars)
+{
+    if(mData->mParseErrorType != FP_NO_ERROR) return Value_t(0);
+
+    // Sub-programs of integrate(), sum(), solve() etc. are evaluated with
+    // Eval() too, so long evaluations come here often.
+    if(evalCancelled())
+    {
+        mData->mEvalErrorType = 9;
+        return Value_t(0);
+    }
+
+    {
+        Value_t result;
+        int error;
+        if(evalInPlace(mData->mByteCode, mData->mImmed, Vars,
+                       mData->mStackSize, result, error))
+        {
+            mData->mEvalErrorType = error;
+            return error ? Value_t(0) : result;
+        }
+    }
+
+    const unsigned* const byteCode = &(mData->mByteCode[0]);
+    const Value_t* const immed = mData->mImmed.empty() ? 0 : &(mData->mImmed[0]);
+    const unsigned byteCodeSize = unsigned(mData->mByteCode.size());
+    unsigned IP, DP=0;
+    int SP=-1;
+
+#ifdef FP_USE_THREAD_SAFE_EVAL
+    /* If Eval() may be called by multiple threads simultaneously,
+     * then Eval() must allocate its own stack.
+     */
+#ifdef FP_USE_THREAD_SAFE_EVAL_WITH_ALLOCA
+    /* alloca() allocates room from the hardware stack.
+     * It is automatically freed when the function returns.
+     */
+    Value_t* const Stack = (Value_t*)alloca(mData->mStackSize*sizeof(Value_t));
+#else
+    /* Allocate from the heap. Ensure that it is freed
+     * automatically no matter which exit path is taken.
+     */
+    struct AutoDealloc
+    {
+        Value_t* ptr;
+        ~AutoDealloc() { delete[] ptr; }
+    } AutoDeallocStack = { new Value_t[mData->mStackSize] };
+    Value_t*& Stack = AutoDeallocStack.ptr;
+#endif
+#else
+    /* No thread safety, so use a global stack. */
+    std::vector<Value_t>& Stack = mData->mStack;
+#endif
+
+    for(IP=0; IP<byteCodeSize; ++IP)
+    {
+        switch(byteCode[IP])
+        {
+// Functions:
+          case   cAbs:
+              if(!fp_checkedAbs(Stack[SP]))
+              { mData->mEvalErrorType=8; return Value_t(0); }
+              break;
+
+          case  cAcos:
+              if(IsComplexType<Value_t>::result == false
+              && (Stack[SP] < Value_t(-1) || Stack[SP] > Value_t(1)))
+              { mData->mEvalErrorType=4; return Value_t(0); }
+              Stack[SP] = fp_acos(Stack[SP]); break;
+
+          case cAcosh:
+              if(IsComplexType<Value_t>::result == false
+              && Stack[SP] < Value_t(1))
+              { mData->mEvalErrorType=4; return Value_t(0); }
+              Stack[SP] = fp_acosh(Stack[SP]); break;
+
+          case  cAsin:
+              if(IsComplexType<Value_t>::result == false
+              && (Stack[SP] < Value_t(-1) || Stack[SP] > Value_t(1)))
+              { mData->mEvalErrorType=4; return Value_t(0); }
+              Stack[SP] = fp_asin(Stack[SP]); break;
+
+          case cAsinh: Stack[SP] = fp_asinh(Stack[SP]); break;
 
           case  cAtan: Stack[SP] = fp_atan(Stack[SP]); break;
 
@@ -2747,7 +4267,8 @@ Value_t FunctionParserBase<Value_t>::Eval(const Value_t* Vars)
               if(Stack[SP-1] == Value_t(0) &&
                  Stack[SP] < Value_t(0))
               { mData->mEvalErrorType=3; return Value_t(0); }
-              Stack[SP-1] = fp_pow(Stack[SP-1], Stack[SP]);
+              if(!fp_checkedPow(Stack[SP-1], Stack[SP]))
+              { mData->mEvalErrorType=8; return Value_t(0); }
               --SP; break;
 
           case  cTrunc: Stack[SP] = fp_trunc(Stack[SP]); break;
@@ -2787,15 +4308,33 @@ Value_t FunctionParserBase<Value_t>::Eval(const Value_t* Vars)
               }
 
 // Operators:
-          case   cNeg: Stack[SP] = -Stack[SP]; break;
-          case   cAdd: Stack[SP-1] += Stack[SP]; --SP; break;
-          case   cSub: Stack[SP-1] -= Stack[SP]; --SP; break;
-          case   cMul: Stack[SP-1] *= Stack[SP]; --SP; break;
+// (With long, the results that don't fit are overflow errors.)
+          case   cNeg:
+              if(!fp_checkedNeg(Stack[SP]))
+              { mData->mEvalErrorType=8; return Value_t(0); }
+              break;
+
+          case   cAdd:
+              if(!fp_checkedAdd(Stack[SP-1], Stack[SP]))
+              { mData->mEvalErrorType=8; return Value_t(0); }
+              --SP; break;
+
+          case   cSub:
+              if(!fp_checkedSub(Stack[SP-1], Stack[SP]))
+              { mData->mEvalErrorType=8; return Value_t(0); }
+              --SP; break;
+
+          case   cMul:
+              if(!fp_checkedMul(Stack[SP-1], Stack[SP]))
+              { mData->mEvalErrorType=8; return Value_t(0); }
+              --SP; break;
 
           case   cDiv:
               if(Stack[SP] == Value_t(0))
               { mData->mEvalErrorType=1; return Value_t(0); }
-              Stack[SP-1] /= Stack[SP]; --SP; break;
+              if(!fp_checkedDiv(Stack[SP-1], Stack[SP]))
+              { mData->mEvalErrorType=8; return Value_t(0); }
+              --SP; break;
 
           case   cMod:
               if(Stack[SP] == Value_t(0))
@@ -2885,6 +4424,87 @@ Value_t FunctionParserBase<Value_t>::Eval(const Value_t* Vars)
                   break;
               }
 
+// Sub-program constructs:
+          case cIntegrate:
+          case cSolve:
+          case cSum:
+          case cProd:
+              {
+                  const unsigned opcode = byteCode[IP];
+                  typename Data::SubProgramData& sub =
+                      mData->mSubPrograms[byteCode[++IP]];
+                  std::vector<Value_t> subVars
+                      (Vars, Vars + mData->mVariablesAmount);
+                  subVars.resize(sub.mVarsAmount);
+
+                  int error = 0;
+                  switch(opcode)
+                  {
+                    case cIntegrate:
+                        error = integrateSubProgram
+                            (sub.mParser, &subVars[0], sub.mVarIndex,
+                             Stack[SP-1], Stack[SP], Stack[SP-1]);
+                        --SP;
+                        break;
+                    case cSolve:
+                        error = solveSubProgram
+                            (sub.mParser, &subVars[0], sub.mVarIndex,
+                             Stack[SP], Stack[SP]);
+                        break;
+                    case cSum:
+                    case cProd:
+                        error = reduceSubProgramRange
+                            (sub.mParser, &subVars[0], sub.mVarsAmount,
+                             sub.mVarIndex, sub.mParallelSafe,
+                             Stack[SP-1], Stack[SP], opcode == cProd,
+                             Stack[SP-1]);
+                        --SP;
+                        break;
+                  }
+                  if(error)
+                  {
+                      mData->mEvalErrorType = error;
+                      return Value_t(0);
+                  }
+                  break;
+              }
+
+          case cMean:
+          case cVar:
+          case cStdev:
+          case cMedian:
+          case cListMin:
+          case cListMax:
+              {
+                  const unsigned opcode = byteCode[IP];
+                  typename Data::SubProgramData& sub =
+                      mData->mSubPrograms[byteCode[++IP]];
+                  const unsigned length = sub.mListLength;
+                  const unsigned lists = sub.mVarsAmount - sub.mVarIndex;
+                  SP -= int(lists * length);
+
+                  std::vector<Value_t> subVars
+                      (Vars, Vars + mData->mVariablesAmount);
+                  subVars.resize(sub.mVarsAmount);
+                  std::vector<const Value_t*> columns(sub.mVarsAmount);
+                  for(unsigned i = 0; i < lists; ++i)
+                      columns[sub.mVarIndex + i] = &Stack[SP + 1 + i * length];
+
+                  std::vector<Value_t> values(length);
+                  int error = 0;
+                  if(!sub.mParser.EvalColumns
+                     (&subVars[0], &columns[0], &values[0], length))
+                      error = sub.mParser.EvalError();
+                  else
+                      error = reduceList(opcode, values, Stack[++SP]);
+                  if(error)
+                  {
+                      mData->mEvalErrorType = error;
+                      return Value_t(0);
+                  }
+                  break;
+              }
+
 #ifdef FP_SUPPORT_OPTIMIZER
           case   cPopNMov:
               {
@@ -2946,15 +4566,21 @@ Value_t FunctionParserBase<Value_t>::Eval(const Value_t* Vars)
               break;
 
           case   cSqr:
-              Stack[SP] = Stack[SP]*Stack[SP];
+              if(!fp_checkedMul(Stack[SP], Stack[SP]))
+              { mData->mEvalErrorType=8; return Value_t(0); }
               break;
 
           case   cRDiv:
               if(Stack[SP-1] == Value_t(0))
               { mData->mEvalErrorType=1; return Value_t(0); }
-              Stack[SP-1] = Stack[SP] / Stack[SP-1]; --SP; break;
+              if(!fp_checkedDiv(Stack[SP], Stack[SP-1]))
+              { mData->mEvalErrorType=8; return Value_t(0); }
+              Stack[SP-1] = Stack[SP]; --SP; break;
 
-          case   cRSub: Stack[SP-1] = Stack[SP] - Stack[SP-1]; --SP; break;
+          case   cRSub:
+              if(!fp_checkedSub(Stack[SP], Stack[SP-1]))
+              { mData->mEvalErrorType=8; return Value_t(0); }
+              Stack[SP-1] = Stack[SP]; --SP; break;
 
           case   cRSqrt:
               if(Stack[SP] == Value_t(0))
@@ -2982,6 +4608,308 @@ Value_t FunctionParserBase<Value_t>::Eval(const Value_t* Vars)
     return Stack[SP];
 }
 
+// ---------------------------------------------------------------------------
+// Evaluate the same compiled function for a sequence of values of one
+// variable. The bytecode, immed list and stack are reused for all points;
+// evaluation stops at the first point which causes an error, and the amount
+// of successfully evaluated points is returned.
+// ---------------------------------------------------------------------------
+template<typename Value_t>
+unsigned FunctionParserBase<Value_t>::EvalBatch(Value_t* Vars,
+                                                unsigned varIndex,
+                                                const Value_t* points,
+                                                Value_t* results,
+                                                unsigned amount)
+{
+    if(mData->mParseErrorType != FP_NO_ERROR) return 0;
+
+    for(unsigned i = 0; i < amount; ++i)
+    {
+        Vars[varIndex] = points[i];
+        results[i] = Eval(Vars);
+        if(mData->mEvalErrorType) return i;
+    }
+    return amount;
+}
+
+/* Evaluates the function for amount sets of variable values at once. The
+   i'th variable takes the values columns[i][0..amount-1], or Vars[i] in
+   every set if columns[i] is null. Functions consisting of plain operators
+   and functions are run on blocks of sets with one loop per opcode. */
+template<typename Value_t>
+bool FunctionParserBase<Value_t>::EvalColumns(const Value_t* Vars,
+                                              const Value_t* const* columns,
+                                              Value_t* results,
+                                              unsigned amount)
+{
+    if(mData->mParseErrorType != FP_NO_ERROR) return false;
+    mData->mEvalErrorType = 0;
+    const unsigned varsAmount = mData->mVariablesAmount;
+
+    // The lane loops don't check for integer overflow, Eval() does.
+    if(IsIntType<Value_t>::result || !isLaneEvaluable(mData->mByteCode))
+    {
+        std::vector<Value_t> vars(Vars, Vars + varsAmount);
+        for(unsigned i = 0; i < amount; ++i)
+        {
+            for(unsigned v = 0; v < varsAmount; ++v)
+                if(columns[v]) vars[v] = columns[v][i];
+            results[i] = Eval(vars.empty() ? 0 : &vars[0]);
+            if(mData->mEvalErrorType) return false;
+        }
+        return true;
+    }
+
+    const unsigned* const byteCode = &(mData->mByteCode[0]);
+    const Value_t* const immed = mData->mImmed.empty() ? 0 : &(mData->mImmed[0]);
+    const unsigned byteCodeSize = unsigned(mData->mByteCode.size());
+
+    // Stack element i of lane j is stack[i * LaneBlockSize + j].
+    std::vector<Value_t> stack(mData->mStackSize * LaneBlockSize);
+
+// x is the stack top, y the element below it (the result of binary ops).
+#define FP_LANES_UNARY(expr) \
+    { Value_t* const x = &stack[unsigned(SP) * LaneBlockSize]; \
+      for(unsigned i = 0; i < n; ++i) x[i] = (expr); }
+#define FP_LANES_BINARY(expr) \
+    { Value_t* const y = &stack[unsigned(SP-1) * LaneBlockSize]; \
+      const Value_t* const x = y + LaneBlockSize; \
+      for(unsigned i = 0; i < n; ++i) y[i] = (expr); \
+      --SP; }
+#define FP_LANES_CHECK(depth, cond, error) \
+    { const Value_t* const x = &stack[unsigned(SP-(depth)) * LaneBlockSize]; \
+      for(unsigned i = 0; i < n; ++i) \
+          if(cond) { mData->mEvalErrorType=(error); return false; } }
+
+    for(unsigned first = 0; first < amount; first += LaneBlockSize)
+    {
+        if(evalCancelled())
+        {
+            mData->mEvalErrorType = 9;
+            return false;
+        }
+
+        const unsigned n = std::min(LaneBlockSize, amount - first);
+        unsigned DP = 0;
+        int SP = -1;
+
+        for(unsigned IP = 0; IP < byteCodeSize; ++IP)
+        {
+            const unsigned opcode = byteCode[IP];
+            if(opcode >= VarBegin)
+            {
+                Value_t* const x = &stack[unsigned(++SP) * LaneBlockSize];
+                const Value_t* const column = columns[opcode - VarBegin];
+                if(column) std::copy(column + first, column + first + n, x);
+                else std::fill(x, x + n, Vars[opcode - VarBegin]);
+                continue;
+            }
+
+            switch(opcode)
+            {
+// Functions:
+              case   cAbs: FP_LANES_UNARY(fp_abs(x[i])); break;
+
+              case  cAcos:
+                  if(IsComplexType<Value_t>::result == false)
+                      FP_LANES_CHECK(0, x[i] < Value_t(-1) || x[i] > Value_t(1), 4);
+                  FP_LANES_UNARY(fp_acos(x[i])); break;
+
+              case cAcosh:
+                  if(IsComplexType<Value_t>::result == false)
+                      FP_LANES_CHECK(0, x[i] < Value_t(1), 4);
+                  FP_LANES_UNARY(fp_acosh(x[i])); break;
+
+              case  cAsin:
+                  if(IsComplexType<Value_t>::result == false)
+                      FP_LANES_CHECK(0, x[i] < Value_t(-1) || x[i] > Value_t(1), 4);
+                  FP_LANES_UNARY(fp_asin(x[i])); break;
+
+              case cAsinh: FP_LANES_UNARY(fp_asinh(x[i])); break;
+
+              case  cAtan: FP_LANES_UNARY(fp_atan(x[i])); break;
+
+              case cAtan2: FP_LANES_BINARY(fp_atan2(y[i], x[i])); break;
+
+              case cAtanh:
+                  if(IsComplexType<Value_t>::result)
+                      FP_LANES_CHECK(0, x[i] == Value_t(-1) || x[i] == Value_t(1), 4)
+                  else
+                      FP_LANES_CHECK(0, x[i] <= Value_t(-1) || x[i] >= Value_t(1), 4)
+                  FP_LANES_UNARY(fp_atanh(x[i])); break;
+
+              case  cCbrt: FP_LANES_UNARY(fp_cbrt(x[i])); break;
+
+              case  cCeil: FP_LANES_UNARY(fp_ceil(x[i])); break;
+
+              case   cCos: FP_LANES_UNARY(fp_cos(x[i])); break;
+
+              case  cCosh: FP_LANES_UNARY(fp_cosh(x[i])); break;
+
+              case   cCot:
+                  FP_LANES_UNARY(fp_tan(x[i]));
+                  FP_LANES_CHECK(0, x[i] == Value_t(0), 1);
+                  FP_LANES_UNARY(Value_t(1) / x[i]); break;
+
+              case   cCsc:
+                  FP_LANES_UNARY(fp_sin(x[i]));
+                  FP_LANES_CHECK(0, x[i] == Value_t(0), 1);
+                  FP_LANES_UNARY(Value_t(1) / x[i]); break;
+
+              case   cExp: FP_LANES_UNARY(fp_exp(x[i])); break;
+
+              case  cExp2: FP_LANES_UNARY(fp_exp2(x[i])); break;
+
+              case cFloor: FP_LANES_UNARY(fp_floor(x[i])); break;
+
+              case cHypot: FP_LANES_BINARY(fp_hypot(y[i], x[i])); break;
+
+              case   cInt: FP_LANES_UNARY(fp_int(x[i])); break;
+
+              case   cLog:
+              case cLog10:
+              case  cLog2:
+                  if(IsComplexType<Value_t>::result)
+                      FP_LANES_CHECK(0, x[i] == Value_t(0), 3)
+                  else
+                      FP_LANES_CHECK(0, !(x[i] > Value_t(0)), 3)
+                  if(opcode == cLog) FP_LANES_UNARY(fp_log(x[i]))
+                  else if(opcode == cLog10) FP_LANES_UNARY(fp_log10(x[i]))
+                  else FP_LANES_UNARY(fp_log2(x[i]))
+                  break;
+
+              case   cMax: FP_LANES_BINARY(fp_max(y[i], x[i])); break;
+
+              case   cMin: FP_LANES_BINARY(fp_min(y[i], x[i])); break;
+
+              case   cPow:
+                  // x:0 ^ y:negative is failure
+                  FP_LANES_CHECK(0, x[i] < Value_t(0) &&
+                                    x[i - LaneBlockSize] == Value_t(0), 3);
+                  FP_LANES_BINARY(fp_pow(y[i], x[i])); break;
+
+              case  cTrunc: FP_LANES_UNARY(fp_trunc(x[i])); break;
+
+              case   cSec:
+                  FP_LANES_UNARY(fp_cos(x[i]));
+                  FP_LANES_CHECK(0, x[i] == Value_t(0), 1);
+                  FP_LANES_UNARY(Value_t(1) / x[i]); break;
+
+              case   cSin: FP_LANES_UNARY(fp_sin(x[i])); break;
+
+              case  cSinh: FP_LANES_UNARY(fp_sinh(x[i])); break;
+
+              case  cSqrt:
+                  if(IsComplexType<Value_t>::result == false)
+                      FP_LANES_CHECK(0, x[i] < Value_t(0), 2);
+                  FP_LANES_UNARY(fp_sqrt(x[i])); break;
+
+              case   cTan: FP_LANES_UNARY(fp_tan(x[i])); break;
+
+              case  cTanh: FP_LANES_UNARY(fp_tanh(x[i])); break;
+
+// Misc:
+              case cImmed:
+                  {
+                      Value_t* const x = &stack[unsigned(++SP) * LaneBlockSize];
+                      std::fill(x, x + n, immed[DP++]);
+                      break;
+                  }
+
+// Operators:
+              case   cNeg: FP_LANES_UNARY(-x[i]); break;
+              case   cAdd: FP_LANES_BINARY(y[i] + x[i]); break;
+              case   cSub: FP_LANES_BINARY(y[i] - x[i]); break;
+              case   cMul: FP_LANES_BINARY(y[i] * x[i]); break;
+
+              case   cDiv:
+                  FP_LANES_CHECK(0, x[i] == Value_t(0), 1);
+                  FP_LANES_BINARY(y[i] / x[i]); break;
+
+              case   cMod:
+                  FP_LANES_CHECK(0, x[i] == Value_t(0), 1);
+                  FP_LANES_BINARY(fp_mod(y[i], x[i])); break;
+
+              case cEqual: FP_LANES_BINARY(fp_equal(y[i], x[i])); break;
+              case cNEqual: FP_LANES_BINARY(fp_nequal(y[i], x[i])); break;
+              case  cLess: FP_LANES_BINARY(fp_less(y[i], x[i])); break;
+              case cLessOrEq: FP_LANES_BINARY(fp_lessOrEq(y[i], x[i])); break;
+              case cGreater: FP_LANES_BINARY(fp_less(x[i], y[i])); break;
+              case cGreaterOrEq: FP_LANES_BINARY(fp_lessOrEq(x[i], y[i])); break;
+
+              case   cNot: FP_LANES_UNARY(fp_not(x[i])); break;
+              case cNotNot: FP_LANES_UNARY(fp_notNot(x[i])); break;
+              case   cAnd: FP_LANES_BINARY(fp_and(y[i], x[i])); break;
+              case    cOr: FP_LANES_BINARY(fp_or(y[i], x[i])); break;
+
+// Degrees-radians conversion:
+              case   cDeg: FP_LANES_UNARY(RadiansToDegrees(x[i])); break;
+              case   cRad: FP_LANES_UNARY(DegreesToRadians(x[i])); break;
+
+              case   cFetch:
+                  {
+                      const Value_t* const source =
+                          &stack[byteCode[++IP] * LaneBlockSize];
+                      std::copy(source, source + n,
+                                &stack[unsigned(++SP) * LaneBlockSize]);
+                      break;
+                  }
+
+              case cSinCos:
+              case cSinhCosh:
+                  {
+                      Value_t* const x = &stack[unsigned(SP) * LaneBlockSize];
+                      Value_t* const c = x + LaneBlockSize;
+                      for(unsigned i = 0; i < n; ++i)
+                      {
+                          if(opcode == cSinCos) fp_sinCos(x[i], c[i], x[i]);
+                          else fp_sinhCosh(x[i], c[i], x[i]);
+                      }
+                      ++SP;
+                      break;
+                  }
+
+              case cAbsNot: FP_LANES_UNARY(fp_absNot(x[i])); break;
+              case cAbsNotNot: FP_LANES_UNARY(fp_absNotNot(x[i])); break;
+              case cAbsAnd: FP_LANES_BINARY(fp_absAnd(y[i], x[i])); break;
+              case cAbsOr: FP_LANES_BINARY(fp_absOr(y[i], x[i])); break;
+
+              case   cDup:
+                  {
+                      Value_t* const x = &stack[unsigned(SP) * LaneBlockSize];
+                      std::copy(x, x + n, x + LaneBlockSize);
+                      ++SP;
+                      break;
+                  }
+
+              case   cInv:
+                  FP_LANES_CHECK(0, x[i] == Value_t(0), 1);
+                  FP_LANES_UNARY(Value_t(1) / x[i]); break;
+
+              case   cSqr: FP_LANES_UNARY(x[i] * x[i]); break;
+
+              case   cRDiv:
+                  FP_LANES_CHECK(1, x[i] == Value_t(0), 1);
+                  FP_LANES_BINARY(x[i] / y[i]); break;
+
+              case   cRSub: FP_LANES_BINARY(x[i] - y[i]); break;
+
+              case   cRSqrt:
+                  FP_LANES_CHECK(0, x[i] == Value_t(0), 1);
+                  FP_LANES_UNARY(Value_t(1) / fp_sqrt(x[i])); break;
+            }
+        }
+
+        std::copy(&stack[0], &stack[0] + n, results + first);
+    }
+
+#undef FP_LANES_UNARY
+#undef FP_LANES_BINARY
+#undef FP_LANES_CHECK
+
+    return true;
+}
+
 
 //===========================================================================
 // Variable deduction
@@ -3528,6 +5456,47 @@ void FunctionParserBase<Value_t>::PrintByteCode(std::ostream& dest,
                       break;
                   }
 
+              case cIntegrate:
+                  ++IP;
+                  n = "integrate";
+                  params = 2;
+                  out_params = true;
+                  break;
+
+              case cSolve:
+                  ++IP;
+                  n = "solve";
+                  params = 1;
+                  break;
+
+              case cSum:
+              case cProd:
+                  ++IP;
+                  n = opcode == cSum ? "sum" : "prod";
+                  params = 2;
+                  out_params = true;
+                  break;
+
+              case cMean:
+              case cVar:
+              case cStdev:
+              case cMedian:
+              case cListMin:
+              case cListMax:
+                  {
+                      const typename Data::SubProgramData& sub =
+                          mData->mSubPrograms[ByteCode[++IP]];
+                      n = opcode == cMean ? "mean" :
+                          opcode == cVar ? "var" :
+                          opcode == cStdev ? "stdev" :
+                          opcode == cMedian ? "median" :
+                          opcode == cListMin ? "min" : "max";
+                      params = (sub.mVarsAmount - sub.mVarIndex) *
+                          sub.mListLength;
+                      out_params = true;
+                      break;
+                  }
+
               default:
                   if(IsVarOpcode(opcode))
                   {
@@ -3787,6 +5756,10 @@ FUNCTIONPARSER_INSTANTIATE_CLASS(MpfrFloat)
 FUNCTIONPARSER_INSTANTIATE_CLASS(GmpInt)
 #endif
 
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+FUNCTIONPARSER_INSTANTIATE_CLASS(GmpRational)
+#endif
+
 #ifdef FP_SUPPORT_COMPLEX_DOUBLE_TYPE
 FUNCTIONPARSER_INSTANTIATE_CLASS(std::complex<double>)
 #endif
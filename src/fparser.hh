@@ -57,8 +57,19 @@ class FunctionParserBase
     ParseErrorType GetParseErrorType() const;
 
     Value_t Eval(const Value_t* Vars);
+    unsigned EvalBatch(Value_t* Vars, unsigned varIndex,
+                       const Value_t* points, Value_t* results,
+                       unsigned amount);
+    bool EvalColumns(const Value_t* Vars, const Value_t* const* columns,
+                     Value_t* results, unsigned amount);
     int EvalError() const;
 
+    // While *flag is nonzero, Eval() of any parser on the calling thread
+    // (and on the threads a sum or product is split to) fails with
+    // EvalError() 9. Another thread sets *flag to cancel an evaluation.
+    // A null flag, the default, disables the check.
+    static void SetCancelFlag(const int* flag);
+
     bool AddConstant(const std::string& name, Value_t value);
     bool AddUnit(const std::string& name, Value_t value);
 
@@ -156,6 +167,9 @@ class FunctionParserBase
     bool TryCompilePowi(Value_t);
 
     const char* CompileIf(const char*);
+    const char* CompileSubProgramCall(const char*, unsigned, unsigned);
+    const char* CompileListFunction(const char*, unsigned);
+    void GetVariableNames(std::vector<std::string>&) const;
     const char* CompileFunctionParams(const char*, unsigned);
     const char* CompileElement(const char*);
     const char* CompilePossibleUnit(const char*);
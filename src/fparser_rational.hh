@@ -0,0 +1,15 @@
+/***************************************************************************\
+|* Function Parser for C++ v4.5.1                                          *|
+|*-------------------------------------------------------------------------*|
+|* Copyright: Juha Nieminen                                                *|
+\***************************************************************************/
+
+#ifndef ONCE_FPARSER_RATIONAL_H_
+#define ONCE_FPARSER_RATIONAL_H_
+
+#include "fparser.hh"
+#include "mpfr/GmpRational.hh"
+
+class FunctionParser_rational: public FunctionParserBase<GmpRational> {};
+
+#endif
@@ -30,6 +30,7 @@
 //#define FP_SUPPORT_LONG_INT_TYPE
 //#define FP_SUPPORT_MPFR_FLOAT_TYPE
 //#define FP_SUPPORT_GMP_INT_TYPE
+//#define FP_SUPPORT_GMP_RATIONAL_TYPE
 //#define FP_SUPPORT_COMPLEX_DOUBLE_TYPE
 //#define FP_SUPPORT_COMPLEX_FLOAT_TYPE
 //#define FP_SUPPORT_COMPLEX_LONG_DOUBLE_TYPE
@@ -61,6 +62,14 @@
 #define FP_ENABLE_SHORTCUT_LOGICAL_EVALUATION
 #endif
 
+/*
+ Whether sum() and prod() over large ranges may be split across several
+ threads (requires pthreads):
+*/
+#ifndef FP_DISABLE_PARALLEL_REDUCTION
+#define FP_ENABLE_PARALLEL_REDUCTION
+#endif
+
 /*
  Comment out the following lines out if you are not going to use the
  optimizer and want a slightly smaller library. The Optimize() method
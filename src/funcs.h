@@ -67,9 +67,9 @@ button_func functions[CFG_GRID_ROWS][CFG_GRID_COLS] = {
 		F_SIMPLE("^"),
 		F_SEP,
 		F_SIMPLE(","),
-		F_SEP,
-		F_SEP,
-		F_SEP
+		F_FULL("integ","integrate","(",",x,",",",")","",3),
+		F_FULL("solve","solve","(",",x,",")","","",2),
+		F_FULL("sum","sum","(",",i,",",",")","",3)
 	},
 	/* row 4 */
 	{
@@ -96,9 +96,9 @@ button_func functions[CFG_GRID_ROWS][CFG_GRID_COLS] = {
 		F_BR("cot","cot"),
 		F_BR("asin","asin"),
 		F_SEP,
-		F_SEP,
-		F_SEP,
-		F_SEP,
+		F_FULL("prod","prod","(",",i,",",",")","",3),
+		F_SIMPLE("["),
+		F_SIMPLE("]"),
 		F_SEP
 	},
 	/* row 7 */
@@ -109,10 +109,10 @@ button_func functions[CFG_GRID_ROWS][CFG_GRID_COLS] = {
 		F_BR("ln","ln"),
 		F_BR("log10","log10"),
 		F_SEP,
-		F_SEP,
-		F_SEP,
-		F_SEP,
-		F_SEP
+		F_BR("mean","mean"),
+		F_BR("stdev","stdev"),
+		F_BR("var","var"),
+		F_BR("median","median")
 	},
 	/* row 8 */
 	{
@@ -8,8 +8,23 @@
 #include <iostream>
 #include <clocale>
 #include <deque>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <cfloat>
+#include <pthread.h>
 #include "inkview.h"
 #include "fparser.hh"
+#ifdef FP_SUPPORT_GMP_INT_TYPE
+#include "fparser_gmpint.hh"
+#endif
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+#include "fparser_rational.hh"
+#endif
+#include "matrix.h"
+#include "numformat.h"
 #include "funcs.h"
 
 #define uint unsigned int
@@ -31,6 +46,7 @@ const unsigned EVT_TEXTBOX_POSITION = EVT_BASE + 3; //sent when changing cursor
 const unsigned EVT_MENU_SELECT = EVT_BASE + 4; //sent when menu item is activated
 const unsigned EVT_LIST_ACTION = EVT_BASE + 5; //FullscreenList action (e.g. close, open, menu)
 const unsigned EVT_KEYBOARD = EVT_BASE + 6; //sent when the keyboard is closed
+const unsigned EVT_EVALUATION = EVT_BASE + 7; //background evaluation is finished
 
 using std::string;
 using std::vector;
@@ -38,6 +54,302 @@ using std::deque;
 
 /* ****************** forward declarations ********************************** */
 int global_event_handler(int, int, int);
+void evaluation_timer();
+void preview_timer();
+
+/* ********************** Dirty-region compositor *************************** */
+
+/* Each e-ink refresh costs hundreds of milliseconds, so screen updates
+   requested while an event is handled are collected and merged, and issued
+   when the outermost handler returns. Updates requested outside of an
+   event are issued at once.
+
+   With diffing on, a copy of what the panel shows is kept, and each update
+   is shrunk to the pixels that differ from it (or dropped if none do). The
+   copy is taken at every full update; code showing system dialogs, which
+   draw over the screen behind our back, must call dialogOpened(). */
+class Compositor {
+public:
+	static void begin() {
+		m_depth++;
+	}
+
+	static void end() {
+		if(--m_depth == 0)
+			flush();
+	}
+
+	/* dynamic updates are faster and coarser; a region merged from both
+	   kinds gets a partial update */
+	static void add(unsigned x, unsigned y, unsigned w, unsigned h, bool dynamic) {
+		if(!w || !h)
+			return;
+		if(m_depth == 0) {
+			issue(x, y, w, h, dynamic);
+			return;
+		}
+
+		Region r = { x, y, x + w, y + h, dynamic };
+		/* merging can make the region reach others, so repeat until it doesn't */
+		for(unsigned i = 0; i < m_regions.size(); ) {
+			const Region& o = m_regions[i];
+			if(r.x0 <= o.x1 + c_mergeGap && o.x0 <= r.x1 + c_mergeGap &&
+			   r.y0 <= o.y1 + c_mergeGap && o.y0 <= r.y1 + c_mergeGap) {
+				r.x0 = std::min(r.x0, o.x0);
+				r.y0 = std::min(r.y0, o.y0);
+				r.x1 = std::max(r.x1, o.x1);
+				r.y1 = std::max(r.y1, o.y1);
+				r.dynamic = r.dynamic && o.dynamic;
+				m_regions[i] = m_regions.back();
+				m_regions.pop_back();
+				i = 0;
+			}
+			else
+				i++;
+		}
+		m_regions.push_back(r);
+	}
+
+	/* drops what is pending and records the screen, after a full update */
+	static void discard() {
+		m_regions.clear();
+
+		const icanvas* canvas = GetCanvas();
+		m_shadowValid = canvas && canvas->addr && canvas->depth > 0;
+		if(m_shadowValid) {
+			m_shadow.assign(canvas->addr, canvas->addr + canvas->height * canvas->scanline);
+			m_shadowWidth = canvas->width;
+			m_shadowHeight = canvas->height;
+			m_shadowScanline = canvas->scanline;
+			m_shadowDepth = canvas->depth;
+		}
+	}
+
+	/* The screen no longer matches the copy, until the next full update.
+	   Timers keep firing while the dialog is open, and what they draw would
+	   show over it, so they check dialogOpen() first. */
+	static void dialogOpened() {
+		m_shadowValid = false;
+		m_dialogOpen = true;
+	}
+
+	static void dialogClosed() {
+		m_dialogOpen = false;
+	}
+
+	static bool dialogOpen() {
+		return m_dialogOpen;
+	}
+
+	/* the "diffing" entry of the config, on by default; off, updates go
+	   out with the rectangles the widgets asked for */
+	static void setDiffing(bool enabled) {
+		m_diffing = enabled;
+	}
+
+	static bool diffing() {
+		return m_diffing;
+	}
+
+private:
+	struct Region {
+		unsigned x0, y0, x1, y1;
+		bool dynamic;
+	};
+
+	static void flush() {
+		for(unsigned i = 0; i < m_regions.size(); i++) {
+			const Region& r = m_regions[i];
+			issue(r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, r.dynamic);
+		}
+		m_regions.clear();
+	}
+
+	static void issue(unsigned x, unsigned y, unsigned w, unsigned h, bool dynamic) {
+		if(m_diffing && shadowMatches() && !shrink(x, y, w, h))
+			return;
+
+		if(dynamic)
+			DynamicUpdateBW(x, y, w, h);
+		else
+			PartialUpdateBW(x, y, w, h);
+
+		if(shadowMatches()) {
+			const icanvas* canvas = GetCanvas();
+			const unsigned x1 = std::min(x + w, (unsigned) m_shadowWidth);
+			const unsigned y1 = std::min(y + h, (unsigned) m_shadowHeight);
+			const unsigned b0 = x * m_shadowDepth / 8;
+			const unsigned b1 = (x1 * m_shadowDepth + 7) / 8;
+			for(unsigned row = y; row < y1 && b0 < b1; row++)
+				memcpy(&m_shadow[row * m_shadowScanline + b0], canvas->addr + row * m_shadowScanline + b0, b1 - b0);
+		}
+	}
+
+	static bool shadowMatches() {
+		if(!m_shadowValid)
+			return false;
+		const icanvas* canvas = GetCanvas();
+		return canvas && canvas->addr && canvas->width == m_shadowWidth && canvas->height == m_shadowHeight &&
+		       canvas->scanline == m_shadowScanline && canvas->depth == m_shadowDepth;
+	}
+
+	/* Shrinks the region to the bounding box of the pixels that changed,
+	   returns false if none did. Rows are compared with memcmp, and the
+	   changed columns found a word at a time. */
+	static bool shrink(unsigned& x, unsigned& y, unsigned& w, unsigned& h) {
+		const unsigned x1 = std::min(x + w, (unsigned) m_shadowWidth);
+		const unsigned y1 = std::min(y + h, (unsigned) m_shadowHeight);
+		if(x >= x1 || y >= y1)
+			return false;
+
+		const unsigned char* screen = GetCanvas()->addr;
+		const unsigned b0 = x * m_shadowDepth / 8;
+		const unsigned b1 = (x1 * m_shadowDepth + 7) / 8;
+		unsigned lo = b1, hi = b0, top = y1, bottom = y;
+		for(unsigned row = y; row < y1; row++) {
+			const unsigned char* a = screen + row * m_shadowScanline;
+			const unsigned char* b = &m_shadow[row * m_shadowScanline];
+			if(memcmp(a + b0, b + b0, b1 - b0) == 0)
+				continue;
+			top = std::min(top, row);
+			bottom = row + 1;
+			/* only the part outside of what is known to change is scanned */
+			lo = b0 + firstDifference(a + b0, b + b0, lo - b0);
+			hi += lastDifference(a + hi, b + hi, b1 - hi);
+		}
+		if(top == y1)
+			return false;
+
+		const unsigned px0 = std::max(lo * 8 / m_shadowDepth, x);
+		const unsigned px1 = std::min((hi * 8 + m_shadowDepth - 1) / m_shadowDepth, x1);
+		x = px0;
+		y = top;
+		w = px1 - px0;
+		h = bottom - top;
+		return true;
+	}
+
+	/* index of the first differing byte, n if there is none */
+	static unsigned firstDifference(const unsigned char* a, const unsigned char* b, unsigned n) {
+		unsigned i = 0;
+		for(; i + sizeof(unsigned long) <= n; i += sizeof(unsigned long)) {
+			unsigned long wa, wb;
+			memcpy(&wa, a + i, sizeof(wa));
+			memcpy(&wb, b + i, sizeof(wb));
+			if(wa != wb)
+				break;
+		}
+		while(i < n && a[i] == b[i])
+			i++;
+		return i;
+	}
+
+	/* one past the last differing byte, 0 if there is none */
+	static unsigned lastDifference(const unsigned char* a, const unsigned char* b, unsigned n) {
+		unsigned i = n;
+		for(; i >= sizeof(unsigned long); i -= sizeof(unsigned long)) {
+			unsigned long wa, wb;
+			memcpy(&wa, a + i - sizeof(wa), sizeof(wa));
+			memcpy(&wb, b + i - sizeof(wb), sizeof(wb));
+			if(wa != wb)
+				break;
+		}
+		while(i > 0 && a[i - 1] == b[i - 1])
+			i--;
+		return i;
+	}
+
+	/* regions closer than this (the spacing between widgets) are merged */
+	static const unsigned c_mergeGap = 16;
+
+	static unsigned m_depth;
+	static vector<Region> m_regions;
+
+	/* what the panel shows, as of the updates issued */
+	static bool m_diffing;
+	static bool m_dialogOpen;
+	static bool m_shadowValid;
+	static vector<unsigned char> m_shadow;
+	static int m_shadowWidth;
+	static int m_shadowHeight;
+	static int m_shadowScanline;
+	static int m_shadowDepth;
+};
+
+unsigned Compositor::m_depth = 0;
+vector<Compositor::Region> Compositor::m_regions;
+bool Compositor::m_diffing = true;
+bool Compositor::m_dialogOpen = false;
+bool Compositor::m_shadowValid = false;
+vector<unsigned char> Compositor::m_shadow;
+int Compositor::m_shadowWidth = 0;
+int Compositor::m_shadowHeight = 0;
+int Compositor::m_shadowScanline = 0;
+int Compositor::m_shadowDepth = 0;
+
+/* ************************* Font metrics cache ***************************** */
+
+/* Widths and heights of text in a font, measured once and kept until the
+   font is closed, so that layout and drawing don't go to the font engine
+   for them. Measuring sets the font, with black text. */
+class FontMetrics {
+public:
+	static FontMetrics& of(const ifont* font) {
+		std::map<const ifont*, FontMetrics*>::iterator it = m_all.find(font);
+		if(it != m_all.end())
+			return *(*it).second;
+		return *(m_all[font] = new FontMetrics(font));
+	}
+
+	/* must be called before the font is closed */
+	static void forget(const ifont* font) {
+		std::map<const ifont*, FontMetrics*>::iterator it = m_all.find(font);
+		if(it != m_all.end()) {
+			delete (*it).second;
+			m_all.erase(it);
+		}
+	}
+
+	unsigned charWidth(unsigned char c) const {
+		if(c < c_ascii)
+			return m_advance[c];
+		SetFont(m_font, BLACK);
+		return CharWidth(c);
+	}
+
+	/* height of a line of text */
+	unsigned lineHeight() const {
+		return m_lineHeight;
+	}
+
+	unsigned stringWidth(const string& str) {
+		std::map<string, unsigned>::iterator it = m_stringWidths.find(str);
+		if(it != m_stringWidths.end())
+			return (*it).second;
+		SetFont(m_font, BLACK);
+		return m_stringWidths[str] = StringWidth(str.c_str());
+	}
+
+private:
+	FontMetrics(const ifont* font) {
+		m_font = const_cast<ifont*>(font);
+		SetFont(m_font, BLACK);
+		for(unsigned c = 0; c < c_ascii; c++)
+			m_advance[c] = c < ' ' ? 0 : CharWidth(c);
+		m_lineHeight = TextRectHeight(40, "#", ALIGN_LEFT);
+	}
+
+	static const unsigned c_ascii = 128;
+
+	ifont* m_font;
+	unsigned m_advance[c_ascii];
+	unsigned m_lineHeight;
+	std::map<string, unsigned> m_stringWidths; /* widget labels, mostly */
+
+	static std::map<const ifont*, FontMetrics*> m_all;
+};
+
+std::map<const ifont*, FontMetrics*> FontMetrics::m_all;
 
 /* ***************** Simple abstract widget class *************************** */
 class Widget {
@@ -51,8 +363,11 @@ public:
 		this->m_h = 0;
 		this->m_font = NULL;
 		this->m_visible = true;
+		this->m_gridRow = c_noCell;
+		this->m_gridCol = c_noCell;
 
 		m_all_widgets[this->getID()] = this;
+		m_indexValid = false;
 	}
 
 	Widget(const string& label, unsigned x, unsigned y, unsigned w, unsigned h) {
@@ -64,8 +379,11 @@ public:
 		this->m_h = h;
 		this->m_font = NULL;
 		this->m_visible = true;
+		this->m_gridRow = c_noCell;
+		this->m_gridCol = c_noCell;
 
 		m_all_widgets[this->getID()] = this;
+		m_indexValid = false;
 	}
 
 	virtual ~Widget() {
@@ -77,16 +395,17 @@ public:
 
 		if(Widget::m_focus == this)
 			m_focus = NULL;
+		m_indexValid = false;
 	}
 
 	virtual void draw() const = 0;
 
 	virtual void update() {
-		PartialUpdateBW(m_x, m_y, m_w, m_h);
+		Compositor::add(m_x, m_y, m_w, m_h, false);
 	}
 
 	virtual void asyncUpdate() {
-		DynamicUpdateBW(m_x, m_y, m_w, m_h);
+		Compositor::add(m_x, m_y, m_w, m_h, true);
 	}
 
 	unsigned getID() const {
@@ -119,11 +438,27 @@ public:
 	void setSize(unsigned w, unsigned h) {
 		this->m_w = w;
 		this->m_h = h;
+		m_indexValid = false;
 	}
 
 	void setPos(unsigned x, unsigned y) {
 		this->m_x = x;
 		this->m_y = y;
+		m_indexValid = false;
+	}
+
+	/* the cell of the GridLayout holding the widget, c_noCell if none */
+	void setGridCell(unsigned row, unsigned col) {
+		m_gridRow = row;
+		m_gridCol = col;
+	}
+
+	unsigned getGridRow() const {
+		return m_gridRow;
+	}
+
+	unsigned getGridCol() const {
+		return m_gridCol;
 	}
 
 	void setVisibility(bool is_visible) {
@@ -157,23 +492,70 @@ public:
 			}
 		}
 		else if(id == EVT_POINTERUP || id == EVT_POINTERLONG) {
-			for(std::map<unsigned, Widget*>::iterator it = m_all_widgets.begin();
-			    it != m_all_widgets.end();
-			    it++) {
-				Widget* w = (*it).second;
-				if(param1 >= w->m_x && param2 >= w->m_y &&
-				   param1 < (w->m_x + w->m_w) &&
-				   param2 < (w->m_y + w->m_h) && w->getVisibility()) {
-					if(id != EVT_POINTERLONG)
-						w->onTouchDown(param1, param2);
-					else
-						w->onTouchLong(param1, param2);
-					break;
-				}
+			Widget* w = findAt(param1, param2);
+			if(w) {
+				if(id != EVT_POINTERLONG)
+					w->onTouchDown(param1, param2);
+				else
+					w->onTouchLong(param1, param2);
 			}
 		}
 	}
 
+	/* Rebuilds the index used to find the widget under a point. Moving,
+	   resizing, creating or deleting a widget makes the index stale, and
+	   it is rebuilt at the next lookup if this isn't called before. */
+	static void updateIndex() {
+		unsigned cols = 0, rows = 0;
+		for(std::map<unsigned, Widget*>::iterator it = m_all_widgets.begin(); it != m_all_widgets.end(); it++) {
+			const Widget* w = (*it).second;
+			if(w->m_w && w->m_h) {
+				cols = std::max(cols, (w->m_x + w->m_w - 1) / c_indexCell + 1);
+				rows = std::max(rows, (w->m_y + w->m_h - 1) / c_indexCell + 1);
+			}
+		}
+
+		for(unsigned i = 0; i < m_index.size(); i++)
+			m_index[i].clear();
+		m_index.resize(rows * cols);
+		m_indexCols = cols;
+
+		/* cells list the widgets in the order of m_all_widgets, so the
+		   first visible one wins where widgets overlap, as it always did */
+		for(std::map<unsigned, Widget*>::iterator it = m_all_widgets.begin(); it != m_all_widgets.end(); it++) {
+			Widget* w = (*it).second;
+			if(!w->m_w || !w->m_h)
+				continue;
+			const unsigned col1 = (w->m_x + w->m_w - 1) / c_indexCell;
+			const unsigned row1 = (w->m_y + w->m_h - 1) / c_indexCell;
+			for(unsigned row = w->m_y / c_indexCell; row <= row1; row++)
+				for(unsigned col = w->m_x / c_indexCell; col <= col1; col++)
+					m_index[row * cols + col].push_back(w);
+		}
+		m_indexValid = true;
+	}
+
+	/* the visible widget at the point, NULL if there is none */
+	static Widget* findAt(unsigned x, unsigned y) {
+		if(!m_indexValid)
+			updateIndex();
+
+		const unsigned col = x / c_indexCell;
+		const unsigned row = y / c_indexCell;
+		if(col >= m_indexCols || row * m_indexCols + col >= m_index.size())
+			return NULL;
+
+		const vector<Widget*>& cell = m_index[row * m_indexCols + col];
+		for(unsigned i = 0; i < cell.size(); i++) {
+			Widget* w = cell[i];
+			if(x >= w->m_x && y >= w->m_y &&
+			   x < (w->m_x + w->m_w) &&
+			   y < (w->m_y + w->m_h) && w->getVisibility())
+				return w;
+		}
+		return NULL;
+	}
+
 	static void drawAll() {
 		for(std::map<unsigned, Widget*>::iterator it = m_all_widgets.begin();
 		    it != m_all_widgets.end();
@@ -217,6 +599,12 @@ public:
 		return ((m_font) ? m_font : m_global_font);
 	}
 
+	FontMetrics& getMetrics() const {
+		return FontMetrics::of(getFont());
+	}
+
+	static const unsigned c_noCell = UINT_MAX;
+
 	static Widget* getByID(unsigned id) {
 		return (m_all_widgets.find(id) != m_all_widgets.end()) ? m_all_widgets[id] : NULL;
 	}
@@ -254,13 +642,25 @@ private:
 	unsigned m_id;
 	static unsigned m_last_id;
 
+	unsigned m_gridRow;
+	unsigned m_gridCol;
+
 	static std::map<unsigned, Widget*> m_all_widgets;
+
+	/* uniform grid over the screen: each cell lists the widgets overlapping it */
+	static const unsigned c_indexCell = 32;
+	static vector<vector<Widget*> > m_index;
+	static unsigned m_indexCols;
+	static bool m_indexValid;
 };
 
 ifont* Widget::m_global_font = NULL;
 unsigned Widget::m_last_id = 0;
 std::map<unsigned, Widget*> Widget::m_all_widgets;
 Widget* Widget::m_focus = NULL;
+vector<vector<Widget*> > Widget::m_index;
+unsigned Widget::m_indexCols = 0;
+bool Widget::m_indexValid = false;
 
 /* **************** Simple grid layout class for widgets ******************** */
 
@@ -305,50 +705,104 @@ public:
 		return m_height;
 	}
 
+	/* sizes rows and columns to fit their widgets, at least evenly
+	   dividing the layout among the rows and columns that aren't empty */
 	void update() {
-		unsigned x_paddings = (m_widgets[0].size()) ? m_widgets[0].size() - 1 : 0;
-		unsigned y_paddings = (m_widgets.size()) ? m_widgets.size() - 1 : 0;
+		const unsigned rows = m_widgets.size();
+		const unsigned cols = rows ? m_widgets[0].size() : 0;
+		m_rowHeights.assign(rows, 0);
+		m_colWidths.assign(cols, 0);
+
+		unsigned emptyRows = 0;
+		vector<bool> usedCols(cols, false);
+		for(unsigned row = 0; row < rows; row++) {
+			bool used = false;
+			for(unsigned col = 0; col < cols; col++) {
+				const Widget* w = m_widgets[row][col];
+				if(w) {
+					used = true;
+					usedCols[col] = true;
+					m_rowHeights[row] = std::max(m_rowHeights[row], w->getMinHeight());
+					m_colWidths[col] = std::max(m_colWidths[col], w->getMinWidth());
+				}
+			}
+			if(!used)
+				emptyRows++;
+		}
+		const unsigned emptyCols = std::count(usedCols.begin(), usedCols.end(), false);
 
-		unsigned emptyCols = getEmptyCols();
-		unsigned emptyRows = getEmptyRows();
+		unsigned x_paddings = cols ? cols - 1 : 0;
+		unsigned y_paddings = rows ? rows - 1 : 0;
 
-		unsigned opt_width = (m_width - m_spacing * x_paddings) / (m_widgets[0].size() - emptyRows);
-		unsigned opt_height = (m_height - m_spacing * y_paddings) / (m_widgets.size() - emptyCols);
+		unsigned opt_width = (m_width - m_spacing * x_paddings) / (cols - emptyCols);
+		unsigned opt_height = (m_height - m_spacing * y_paddings) / (rows - emptyRows);
 
-		unsigned row_height = 0;
-		unsigned col_width = 0;
+		for(unsigned row = 0; row < rows; row++)
+			if(m_rowHeights[row] && m_rowHeights[row] < opt_height)
+				m_rowHeights[row] = opt_height;
+		for(unsigned col = 0; col < cols; col++)
+			if(m_colWidths[col] && m_colWidths[col] < opt_width)
+				m_colWidths[col] = opt_width;
 
-		unsigned x, y;
+		place();
+	}
 
-		//FIXME: assuming that global font is used for all widgets
-		SetFont(const_cast<ifont*>(Widget::getGlobalFont()), BLACK);
+	/* Sets the layout from a file written by save() with the same key,
+	   without measuring any widget; returns false if there is no such
+	   file, or it is for another key or layout geometry. */
+	bool load(const char* path, unsigned key) {
+		FILE* file = fopen(path, "r");
+		if(!file)
+			return false;
 
-		y = 0;
-		for(unsigned row = 0; row < m_widgets.size(); row++) {
-			x = 0;
-			row_height = getMinRowHeight(row);
-			if(row_height && row_height < opt_height)
-				row_height = opt_height;
+		unsigned fileKey = 0, x = 0, y = 0, width = 0, height = 0, spacing = 0, rows = 0, cols = 0;
+		bool valid = fscanf(file, "%x %u %u %u %u %u %u %u", &fileKey, &x, &y, &width, &height,
+		                    &spacing, &rows, &cols) == 8 &&
+		             fileKey == key && x == m_x && y == m_y && width == m_width && height == m_height &&
+		             spacing == m_spacing && rows == m_widgets.size() && cols == m_widgets[0].size();
+		/* rows and cols are only trusted once the header matches */
+		if(!valid) {
+			fclose(file);
+			return false;
+		}
 
-			for(unsigned col = 0; col < m_widgets[0].size(); col++) {
-				col_width = getMinColWidth(col);
-				if(col_width && col_width < opt_width)
-					col_width = opt_width;
+		vector<unsigned> rowHeights(rows), colWidths(cols);
+		for(unsigned i = 0; valid && i < rows; i++)
+			valid = fscanf(file, "%u", &rowHeights[i]) == 1;
+		for(unsigned i = 0; valid && i < cols; i++)
+			valid = fscanf(file, "%u", &colWidths[i]) == 1;
+		fclose(file);
 
-				if(m_widgets[row][col]) {
-					m_widgets[row][col]->setPos(
-					    m_x + x + (col ? m_spacing : 0),
-					    m_y + y + (row ? m_spacing : 0)
-					);
-
-					m_widgets[row][col]->setSize(col_width, row_height);
-				}
+		if(!valid)
+			return false;
+		m_rowHeights.swap(rowHeights);
+		m_colWidths.swap(colWidths);
+		place();
+		return true;
+	}
 
-				x += (col ? m_spacing : 0) + col_width;
-			}
+	/* writes the layout computed by update(); it goes to a temporary file
+	   first, so an interrupted write never leaves a truncated layout */
+	void save(const char* path, unsigned key) const {
+		const string tmpPath = string(path) + ".tmp";
+		FILE* file = fopen(tmpPath.c_str(), "w");
+		if(!file)
+			return;
 
-			y += (row ? m_spacing : 0) + row_height;
-		}
+		fprintf(file, "%x %u %u %u %u %u %u %u\n", key, m_x, m_y, m_width, m_height,
+		        m_spacing, (unsigned) m_rowHeights.size(), (unsigned) m_colWidths.size());
+		for(unsigned i = 0; i < m_rowHeights.size(); i++)
+			fprintf(file, "%u ", m_rowHeights[i]);
+		fprintf(file, "\n");
+		for(unsigned i = 0; i < m_colWidths.size(); i++)
+			fprintf(file, "%u ", m_colWidths[i]);
+		fprintf(file, "\n");
+
+		const bool written = !ferror(file);
+		if(fclose(file) == 0 && written)
+			rename(tmpPath.c_str(), path);
+		else
+			remove(tmpPath.c_str());
 	}
 
 	void __debug_draw() {
@@ -356,57 +810,31 @@ public:
 	}
 
 private:
-	static bool cmpMinHeight(const Widget* x1, const Widget* x2) {
-		unsigned h1 = ((x1) ? (x1->getMinHeight()) : 0);
-		unsigned h2 = ((x2) ? (x2->getMinHeight()) : 0);
-		return h1 < h2;
-	}
-	static struct cmpWidth_t {
-		unsigned col;
-		bool operator()(const vector<Widget*>& x1, const vector<Widget*>& x2) {
-			unsigned w1 = ((x1[col]) ? (x1[col]->getMinWidth()) : 0);
-			unsigned w2 = ((x2[col]) ? (x2[col]->getMinWidth()) : 0);
-			return w1 < w2;
-		}
-	} cmpMinWidth;
-
-	unsigned getMinRowHeight(unsigned row) {
-		Widget* w = (*std::max_element(m_widgets[row].begin(), m_widgets[row].end(), cmpMinHeight));
-		return ((w) ? w->getMinHeight() : 0);
-	}
-
-	unsigned getMinColWidth(unsigned col) {
-		cmpMinWidth.col = col;
-		Widget* w = (*std::max_element(m_widgets.begin(), m_widgets.end(), cmpMinWidth)) [col];
-		return ((w) ? w->getMinWidth() : 0);
-	}
+	void place() {
+		unsigned x, y;
 
-	unsigned getEmptyRows() {
-		unsigned rows = 0;
+		y = 0;
 		for(unsigned row = 0; row < m_widgets.size(); row++) {
-			if((unsigned) std::count(m_widgets[row].begin(), m_widgets[row].end(), (Widget*) NULL) ==
-			   m_widgets[row].size())
-				rows++;
-		}
-		return rows;
-	}
+			x = 0;
+			for(unsigned col = 0; col < m_widgets[0].size(); col++) {
+				if(m_widgets[row][col]) {
+					m_widgets[row][col]->setPos(
+					    m_x + x + (col ? m_spacing : 0),
+					    m_y + y + (row ? m_spacing : 0)
+					);
 
-	unsigned getEmptyCols() {
-		unsigned cols = 0;
-		for(unsigned col = 0; col < m_widgets[0].size(); col++) {
-			bool empty_col = true;
-			for(unsigned row = 0; row < m_widgets.size(); row++) {
-				if(m_widgets[row][col] != NULL) {
-					empty_col = false;
-					break;
+					m_widgets[row][col]->setSize(m_colWidths[col], m_rowHeights[row]);
+					m_widgets[row][col]->setGridCell(row, col);
 				}
+
+				x += (col ? m_spacing : 0) + m_colWidths[col];
 			}
-			if(empty_col)
-				cols++;
+
+			y += (row ? m_spacing : 0) + m_rowHeights[row];
 		}
-		return cols;
-	}
 
+		Widget::updateIndex();
+	}
 
 	vector<vector<Widget*> > m_widgets;
 	unsigned m_x;
@@ -414,9 +842,10 @@ private:
 	unsigned m_width;
 	unsigned m_height;
 	unsigned m_spacing;
-};
 
-GridLayout::cmpWidth_t GridLayout::cmpMinWidth = { 0 };
+	vector<unsigned> m_rowHeights;
+	vector<unsigned> m_colWidths;
+};
 
 /* ************************ Button widget *********************************** */
 
@@ -425,14 +854,47 @@ public:
 	Button(const string& label) :
 		Widget(label, 0, 0, 0, 0) {
 		c_activate_event = EVT_BUTTON_ACTIVATE;
+		m_images[0] = m_images[1] = NULL;
 	}
 
 	Button(const string& label, unsigned x, unsigned y, unsigned w, unsigned h) :
 		Widget(label, x, y, w, h) {
 		c_activate_event = EVT_BUTTON_ACTIVATE;
+		m_images[0] = m_images[1] = NULL;
+	}
+
+	~Button() {
+		forgetImages();
 	}
 
+	/* Each look of the button (normal and focused) is rendered once and
+	   copied from the screen; later draws blit that copy. */
 	void draw() const {
+		const unsigned focused = m_focus == this;
+		const ibitmap* image = m_images[focused];
+		if(image && image->width == (int) m_w && image->height == (int) m_h) {
+			DrawBitmap(m_x, m_y, image);
+			return;
+		}
+		if(image)
+			forgetImages();
+
+		render();
+		if(m_w && m_h)
+			m_images[focused] = BitmapFromScreen(m_x, m_y, m_w, m_h);
+	}
+
+	unsigned getMinWidth() const {
+		return getMetrics().stringWidth(m_label) + 2 * m_padding;
+	}
+
+	unsigned getMinHeight() const {
+		return getMetrics().lineHeight() + 2 * m_padding;
+	}
+protected:
+	unsigned c_activate_event;
+private:
+	void render() const {
 		if(m_focus == this)
 			SetFont(const_cast<ifont*>(getFont()), WHITE);
 		else
@@ -452,18 +914,14 @@ public:
 		);
 	}
 
-	unsigned getMinWidth() const {
-		SetFont(const_cast<ifont*>(getFont()), BLACK);
-		return StringWidth(m_label.c_str()) + 2 * m_padding;
+	/* after a resize both looks are rendered again */
+	void forgetImages() const {
+		for(unsigned i = 0; i < 2; i++) {
+			free(m_images[i]);
+			m_images[i] = NULL;
+		}
 	}
 
-	unsigned getMinHeight() const {
-		SetFont(const_cast<ifont*>(getFont()), BLACK);
-		return TextRectHeight(40, "#", ALIGN_LEFT) + 2 * m_padding;
-	}
-protected:
-	unsigned c_activate_event;
-private:
 	void onTouchDown(unsigned, unsigned) {
 		if(getFocus() != this) {
 			setFocus(this, true);
@@ -493,6 +951,8 @@ private:
 	}
 
 	static const ushort m_padding = 4;
+
+	mutable ibitmap* m_images[2]; /* normal, focused */
 };
 
 /* ********************** Calculator button class *************************** */
@@ -518,23 +978,49 @@ public:
 	TextBox() : Widget() {
 		m_drawCursor = false;
 		m_pos = 0;
+		m_validWords = 0;
+		m_placedWords = 0;
+		m_charWidth = 0;
+		m_lineHeight = 0;
+		m_layoutWidth = 0;
+		m_layoutHeight = 0;
+		m_changedWord = 0;
+		m_drawnLines = 0;
+		m_drawnCursorLine = c_none;
+		m_drawnCursorColumn = c_none;
+		m_updateY = 0;
+		m_updateH = 0;
 	}
 
 	void insert(const string& str, unsigned pos) {
 		m_words.insert(m_words.begin() + pos, str);
+		invalidate(pos);
+	}
+
+	void erase(unsigned pos) {
+		m_words.erase(m_words.begin() + pos);
+		invalidate(pos);
 	}
 
 	void append(const string& str) {
 		m_words.push_back(str);
+		invalidate(m_words.size() - 1);
 	}
 
 	void clear() {
 		m_words.clear();
 		m_pos = 0;
+		invalidate(0);
 		draw();
 	}
 
+	/* the words may be changed through this, so the layout is redone */
 	vector<string>& words() {
+		invalidate(0);
+		return m_words;
+	}
+
+	const vector<string>& getWords() const {
 		return m_words;
 	}
 
@@ -552,41 +1038,76 @@ public:
 			DrawRect(m_x, m_y, m_w, m_h, BLACK);
 		//DrawTextRect(e->x+4, e->y+4, e->width-4, e->height-4, e->text.c_str(), ALIGN_LEFT);
 
-		string tmp;
-		unsigned i = 0, yi = 0;
-		unsigned dy = TextRectHeight(20, "#", 0);
-		unsigned pos_x = m_x + 4, pos_y = m_y + 4;
-		//TODO: break line only on operators, if possible + tune perf
-		while(i < m_words.size() && yi < (m_h - 8) / dy) {
-			while(i < m_words.size() && CharWidth('#') * (tmp.size() + m_words[i].size()) < m_w - 8) {
-				if(i == m_pos) {
-					pos_x = m_x + 4 + tmp.size() * CharWidth('#');
-					pos_y = m_y + 4 + yi * dy;
-				}
+		//TODO: break line only on operators, if possible
+		layout();
+		const unsigned lines = std::max((unsigned) m_lineStart.size(), 1u);
+		for(unsigned line = 0; line < lines; line++)
+			drawLine(line);
 
-				if(i == m_words.size() - 1 && m_pos > i) {
-					pos_x = m_x + 4 + (tmp.size() + m_words[i].size()) * CharWidth('#');
-					pos_y = m_y + 4 + yi * dy;
-				}
+		m_drawnLines = m_lineStart.size();
+		getDrawnCursor(m_drawnCursorLine, m_drawnCursorColumn);
+		m_changedWord = c_none;
+		m_updateY = m_y;
+		m_updateH = m_h;
+	}
 
-				tmp.append(m_words[i++]);
-			}
+	/* Draws only what changed since the last draw() or redraw(): the lines
+	   from the one holding the first edited word on, and the lines the
+	   cursor moved from and to. update() and asyncUpdate() then refresh
+	   just those lines. */
+	void redraw() {
+		SetFont(const_cast<ifont*>(getFont()), BLACK);
+		if(!layout()) {
+			draw();
+			return;
+		}
 
-			DrawString(m_x + 4, m_y + 4 + yi * dy, tmp.c_str());
+		unsigned top = c_none, bottom = 0;
+		if(m_changedWord != c_none && (m_changedWord == 0 || m_changedWord - 1 < m_placedWords)) {
+			/* the word before the edit may now be followed on its line */
+			top = m_changedWord == 0 ? 0 : m_placement[m_changedWord - 1].line;
+			bottom = std::max(m_drawnLines, (unsigned) m_lineStart.size());
+			if(top == 0 && bottom == 0)
+				bottom = 1;
+			for(unsigned line = top; line < bottom; line++)
+				redrawLine(line);
+		}
 
-			yi++;
-			tmp.clear();
+		unsigned line, column;
+		getDrawnCursor(line, column);
+		if(line != m_drawnCursorLine || column != m_drawnCursorColumn) {
+			const unsigned moved[2] = { m_drawnCursorLine, line };
+			for(unsigned i = 0; i < 2; i++) {
+				if(moved[i] == c_none || (moved[i] >= top && moved[i] < bottom))
+					continue;
+				redrawLine(moved[i]);
+				top = std::min(top, moved[i]);
+				bottom = std::max(bottom, moved[i] + 1);
+			}
 		}
 
-		if(m_drawCursor)
-			DrawLine(pos_x, pos_y, pos_x, pos_y + dy, BLACK);
+		m_drawnLines = m_lineStart.size();
+		m_drawnCursorLine = line;
+		m_drawnCursorColumn = column;
+		m_changedWord = c_none;
+		m_updateY = m_y + 4 + (top == c_none ? 0 : top) * m_lineHeight;
+		m_updateH = top == c_none ? 0 : (bottom - top) * m_lineHeight;
+	}
+
+	/* refresh what the last draw() or redraw() changed */
+	void update() {
+		Compositor::add(m_x, m_updateY, m_w, m_updateH, false);
+	}
+
+	void asyncUpdate() {
+		Compositor::add(m_x, m_updateY, m_w, m_updateH, true);
 	}
 
 	unsigned getMinWidth() const {
 		unsigned textlen = 0;
 		for(size_t i = 0; i < m_words.size(); i++)
 			textlen += m_words[i].size();
-		return CharWidth('#') * sqrt(textlen) + 8 + 10;
+		return getMetrics().charWidth('#') * sqrt(textlen) + 8 + 10;
 	}
 	unsigned getMinHeight() const {
 		return getMinWidth();
@@ -610,36 +1131,37 @@ public:
 private:
 	void onTouchDown(unsigned x, unsigned y) {
 		Widget::setFocus(this, true);
-		//TODO: improve performance (cache word coords or smth)
-		unsigned width = 0;
-		unsigned pos = 0;
-		unsigned i = 0, yi = 0;
-		unsigned dy = TextRectHeight(20, "#", 0);
-		while(i < m_words.size() && yi < (m_h - 8) / dy) {
-			while(i < m_words.size() && CharWidth('#') * (width + m_words.size()) < m_w - 8) {
-				unsigned word_x = m_x + 4 + width * CharWidth('#');
-				unsigned word_y = m_y + 4 + yi * dy;
-
-				if(x >= word_x && x <= (word_x + CharWidth('#') * ((int) m_words[i].size())) &&
-				   y >= word_y && y <= (word_y + (int) dy)) {
-					//SendEvent(&app_main, EVT_TEXTBOX_POS, e->id, pos);
-					m_pos = pos;
-					draw();
-					update();
-					return;
+		layout();
+
+		/* lines have the same height and characters the same width, so the
+		   line and column under the point are computed directly; the word
+		   at that column is found by binary search within the line */
+		if(x >= m_x + 4 && y >= m_y + 4) {
+			const unsigned line = (y - m_y - 4) / m_lineHeight;
+			if(line < m_lineStart.size()) {
+				const unsigned first = m_lineStart[line];
+				const unsigned end = line + 1 < m_lineStart.size() ? m_lineStart[line + 1] : m_placedWords;
+				Placement point;
+				point.line = line;
+				point.column = (x - m_x - 4) / m_charWidth;
+				const vector<Placement>::const_iterator it = std::upper_bound(
+					m_placement.begin() + first, m_placement.begin() + end, point, compareColumns);
+				if(it != m_placement.begin() + first) {
+					const unsigned i = it - m_placement.begin() - 1;
+					if(x <= m_x + 4 + m_charWidth * (m_placement[i].column + m_words[i].size())) {
+						m_pos = i;
+						redraw();
+						update();
+						return;
+					}
 				}
-
-				pos += 1;
-				width += m_words[i++].size();
 			}
-			yi++;
-			width = 0;
 		}
 
 		if(x >= m_x + 4 && x <= m_x + m_w - 8 && y >= m_y + 4 && y <= m_y + m_h - 8) {
-			SendEvent(&global_event_handler, EVT_TEXTBOX_POSITION, getID(), pos);
-			m_pos = pos;
-			draw();
+			SendEvent(&global_event_handler, EVT_TEXTBOX_POSITION, getID(), m_placedWords);
+			m_pos = m_placedWords;
+			redraw();
 			update();
 		}
 	}
@@ -650,7 +1172,7 @@ private:
 				m_pos = m_words.size();
 			else
 				m_pos--;
-			draw();
+			redraw();
 			update();
 		}
 		else if(key == KEY_RIGHT) {
@@ -658,14 +1180,150 @@ private:
 				m_pos = 0;
 			else
 				m_pos++;
-			draw();
+			redraw();
 			update();
 		}
 	}
 
+	/* where a word is drawn, in lines and characters */
+	struct Placement {
+		unsigned line;
+		unsigned column;
+	};
+
+	static bool compareColumns(const Placement& a, const Placement& b) {
+		return a.column < b.column;
+	}
+
+	void invalidate(unsigned word) {
+		m_validWords = std::min(m_validWords, word);
+		m_changedWord = std::min(m_changedWord, word);
+	}
+
+	/* Brings the layout up to date from the first word edited since it
+	   was computed; the place of a word only depends on the words before
+	   it. Returns false if it was redone from scratch because the font or
+	   the size of the box changed. */
+	bool layout() const {
+		const FontMetrics& metrics = getMetrics();
+		const unsigned charWidth = metrics.charWidth('#');
+		const unsigned lineHeight = metrics.lineHeight();
+		bool kept = true;
+		if(charWidth != m_charWidth || lineHeight != m_lineHeight ||
+		   m_w != m_layoutWidth || m_h != m_layoutHeight) {
+			m_charWidth = charWidth;
+			m_lineHeight = lineHeight;
+			m_layoutWidth = m_w;
+			m_layoutHeight = m_h;
+			m_validWords = 0;
+			kept = false;
+		}
+		if(m_validWords > m_placedWords)
+			return kept;
+
+		const unsigned lines = (m_h - 8) / lineHeight;
+		unsigned i = m_validWords, line = 0, column = 0;
+		if(i > 0) {
+			line = m_placement[i - 1].line;
+			column = m_placement[i - 1].column + m_words[i - 1].size();
+		}
+		m_lineStart.resize(i > 0 ? line + 1 : 0);
+		m_placement.resize(m_words.size());
+
+		for(; i < m_words.size(); i++) {
+			const unsigned size = m_words[i].size();
+			if(charWidth * (column + size) >= m_w - 8) {
+				/* a word too wide for a line ends the text shown */
+				if(column == 0 || charWidth * size >= m_w - 8)
+					break;
+				line++;
+				column = 0;
+			}
+			if(column == 0) {
+				if(line >= lines)
+					break;
+				m_lineStart.push_back(i);
+			}
+			m_placement[i].line = line;
+			m_placement[i].column = column;
+			column += size;
+		}
+
+		m_placedWords = i;
+		m_validWords = c_none;
+		return kept;
+	}
+
+	/* line and column of the cursor, or c_none if it isn't shown */
+	void getDrawnCursor(unsigned& line, unsigned& column) const {
+		line = column = c_none;
+		if(!m_drawCursor)
+			return;
+		if(m_words.empty()) {
+			line = column = 0;
+			return;
+		}
+
+		const unsigned i = std::min(m_pos, (unsigned) m_words.size() - 1);
+		if(i >= m_placedWords)
+			return;
+		line = m_placement[i].line;
+		column = m_placement[i].column;
+		if(m_pos > i)
+			column += m_words[i].size();
+	}
+
+	/* draws the text of a line, and the cursor if it is on that line */
+	void drawLine(unsigned line) const {
+		const unsigned y = m_y + 4 + line * m_lineHeight;
+		if(line < m_lineStart.size()) {
+			const unsigned end = line + 1 < m_lineStart.size() ? m_lineStart[line + 1] : m_placedWords;
+			m_lineText.clear();
+			for(unsigned i = m_lineStart[line]; i < end; i++)
+				m_lineText.append(m_words[i]);
+			DrawString(m_x + 4, y, m_lineText.c_str());
+		}
+
+		unsigned cursorLine, cursorColumn;
+		getDrawnCursor(cursorLine, cursorColumn);
+		if(cursorLine == line) {
+			const unsigned x = m_x + 4 + cursorColumn * m_charWidth;
+			DrawLine(x, y, x, y + m_lineHeight - 1, BLACK);
+		}
+	}
+
+	void redrawLine(unsigned line) const {
+		FillArea(m_x + 4, m_y + 4 + line * m_lineHeight, m_w - 8, m_lineHeight, WHITE);
+		drawLine(line);
+	}
+
+	static const unsigned c_none = UINT_MAX;
+
 	unsigned m_pos;
 	vector<string> m_words;
 	bool m_drawCursor;
+
+	/* The layout, kept between draws. Words before m_validWords have
+	   their place in m_placement; words from m_placedWords on aren't
+	   shown, being below the last line or after a word too wide for a
+	   line. */
+	mutable vector<Placement> m_placement;
+	mutable vector<unsigned> m_lineStart; /* first word of each line */
+	mutable unsigned m_validWords;
+	mutable unsigned m_placedWords;
+	mutable unsigned m_charWidth;
+	mutable unsigned m_lineHeight;
+	mutable unsigned m_layoutWidth;
+	mutable unsigned m_layoutHeight;
+	mutable string m_lineText;
+
+	/* what is on the screen, for redraw() and update() */
+	mutable unsigned m_changedWord; /* first word edited since drawn */
+	mutable unsigned m_drawnLines;
+	mutable unsigned m_drawnCursorLine;
+	mutable unsigned m_drawnCursorColumn;
+	mutable unsigned m_updateY;
+	mutable unsigned m_updateH;
 };
 
 /* ************************ Text view *************************************** */
@@ -684,7 +1342,7 @@ public:
 	}
 	
 	unsigned getMinWidth() const {
-		return CharWidth('#') * sqrt(m_text.length()) + 8 + 10;
+		return getMetrics().charWidth('#') * sqrt(m_text.length()) + 8 + 10;
 	}
 	
 	unsigned getMinHeight() const {
@@ -752,6 +1410,7 @@ public:
 		if(m_menu_size == 0)
 			return;
 
+		Compositor::dialogOpened();
 		OpenMenu(m_menu, 0, x, y, &menuCallback);
 	}
 
@@ -813,8 +1472,14 @@ public:
 		return (uint) m_selected;
 	}
 
+	/* system dialogs opened from a list return to it */
+	static bool isOpen() {
+		return m_visible_list != NULL;
+	}
+
 	void show() {
 		m_visible_list = this;
+		Compositor::dialogOpened();
 		OpenList(m_title.c_str(), NULL,
 		         ScreenWidth() - 2 * c_wpad,
 		         GetThemeFont("menu.font.normal", "")->height + c_hpad,
@@ -824,101 +1489,830 @@ public:
 		         0, &listCallback
 		        );
 	}
-	
-	void hide() {
-		m_visible_list = NULL;
-		SetEventHandler(&global_event_handler);
+	
+	void hide() {
+		m_visible_list = NULL;
+		SetEventHandler(&global_event_handler);
+	}
+
+	~FullscreenList() {
+		delete m_items;
+	}
+
+private:
+	static int listCallback(int action, int x, int y, int idx, int state) {
+		static ifont* menu_font = NULL;
+		if(menu_font == NULL) {
+			menu_font = GetThemeFont("menu.font.normal", "");
+		}
+
+		if(action == LIST_PAINT && m_visible_list->m_items->size() != 0) {
+			SetFont(menu_font, menu_font->size);
+			
+			DrawTextRect(
+				x + 2 * c_wpad,
+				y,
+				ScreenWidth() - 4 * c_wpad,
+				menu_font->height + c_hpad / 2,
+				m_visible_list->m_items->at(idx).c_str(),
+				0
+			);
+			
+			if(state == 1) {
+				DrawSelection(x, y, ScreenWidth() - 2 * c_wpad, menu_font->height + c_hpad, BLACK);
+			}
+		}
+		else if(action == LIST_EXIT) {
+			m_visible_list = NULL;
+			/* TODO: Am i doing it right? */
+			SetEventHandler(&global_event_handler);
+			return 1;
+		}
+
+		if(idx != -1 && state == 1 && m_visible_list->m_items->size() != 0)
+			m_visible_list->m_selected = idx;
+
+		if(m_visible_list->m_items->size() == 0 && action == LIST_MENU) {
+			SendEvent(&global_event_handler, EVT_LIST_ACTION, m_visible_list->m_id*1000 + 999, LIST_MENU);
+			return 1;
+		}
+
+		if(idx != -1 && m_visible_list->m_items->size() != 0) {
+			//SendEvent(&global_event_handler, EVT_LIST_ACTION, (m_visible_list->m_id << 16) | idx, action);
+			SendEvent(&global_event_handler, EVT_LIST_ACTION, m_visible_list->m_id*1000 + idx, action);
+		}
+		return 0;
+	}
+
+	string m_title;
+	uint m_id;
+	int m_selected;
+	static const uint c_wpad = 16;
+	static const uint c_hpad = 4;
+	vector<string>* m_items;
+	static FullscreenList* m_visible_list; //FIXME: this looks like a hack (or doesnt?)
+	static uint m_last_id; //TODO: create an interface for classes that need IDs or derive them from Widget
+};
+
+FullscreenList* FullscreenList::m_visible_list = NULL;
+uint FullscreenList::m_last_id = 0;
+
+/* ********************** Keyboard input class ****************************** */
+
+class Keyboard {
+public:
+	static void show(const string& title, const string& initText, uint id) {
+		m_callerID = id;
+		strncpy(m_kbdBuffer, initText.c_str(), c_buffer_size - 1);
+		m_kbdBuffer[c_buffer_size - 1] = '\0';
+		Compositor::dialogOpened();
+		OpenKeyboard(const_cast<char*>(title.c_str()), m_kbdBuffer, c_buffer_size - 1, 0, &callback);
+	}
+
+	static string getText() {
+		return string(m_kbdBuffer);
+	}
+private:
+	static void callback(char* b) {
+		if(b == NULL)
+			SendEvent(&global_event_handler, EVT_KEYBOARD, m_callerID, -1);
+		else
+			SendEvent(&global_event_handler, EVT_KEYBOARD, m_callerID, 0);
+	}
+	/* large enough to paste lists of tens of thousands of numbers */
+	static const uint c_buffer_size = 256 * 1024;
+	static char m_kbdBuffer[c_buffer_size];
+	static uint m_callerID;
+};
+
+uint Keyboard::m_callerID;
+char Keyboard::m_kbdBuffer[Keyboard::c_buffer_size];
+
+/* ****************** Table of values (model) ******************************* */
+
+/* Evaluates f(x) for x = start, start + step, ..., end. Rows are computed
+   lazily in fixed-size chunks and only a few chunks are kept, so memory
+   doesn't depend on the number of rows. */
+class ValueTable {
+public:
+	ValueTable() {
+		m_start = 0.0;
+		m_step = 1.0;
+		m_rows = 0;
+	}
+
+	/* variables: values of ans, a, b, c, d (see Application::m_variables) */
+	void setup(const FunctionParser& proto, const string& expression,
+	           double start, double end, double step, const double* variables) {
+		if(step == 0.0 || (end - start) / step < 0.0)
+			throw string("Invalid table range");
+
+		double rows = std::floor((end - start) / step + 1e-9) + 1;
+		if(rows > c_max_rows)
+			throw string("Too many table rows");
+
+		m_parser = proto;
+		if(m_parser.Parse(expression, "x,ans,a,b,c,d") != -1)
+			throw string(m_parser.ErrorMsg());
+
+		std::copy(variables, variables + 5, m_vars + 1);
+		m_start = start;
+		m_step = step;
+		m_rows = (unsigned) rows;
+		m_chunks.clear();
+	}
+
+	unsigned size() const {
+		return m_rows;
+	}
+
+	double argument(unsigned row) const {
+		return m_start + row * m_step;
+	}
+
+	/* returns false if f(x) cannot be evaluated at this row */
+	bool value(unsigned row, double& result) {
+		const Chunk& chunk = getChunk(row - row % c_chunk_size);
+		unsigned i = row - chunk.first;
+		if(i >= chunk.valid || chunk.failed[i])
+			return false;
+
+		result = chunk.values[i];
+		return true;
+	}
+
+private:
+	static const unsigned c_chunk_size = 64;
+	static const unsigned c_max_chunks = 4;
+	static const unsigned c_max_rows = 10000000;
+
+	struct Chunk {
+		unsigned first;
+		unsigned valid; /* rows [first, first + valid) are computed */
+		double values[c_chunk_size];
+		bool failed[c_chunk_size];
+	};
+
+	const Chunk& getChunk(unsigned first) {
+		for(deque<Chunk>::iterator it = m_chunks.begin(); it != m_chunks.end(); it++)
+			if((*it).first == first)
+				return *it;
+
+		if(m_chunks.size() == c_max_chunks)
+			m_chunks.pop_back();
+		m_chunks.push_front(Chunk());
+
+		Chunk& chunk = m_chunks.front();
+		chunk.first = first;
+		unsigned amount = m_rows - first;
+		if(amount > c_chunk_size)
+			amount = c_chunk_size;
+
+		double points[c_chunk_size];
+		for(unsigned i = 0; i < amount; i++)
+			points[i] = argument(first + i);
+
+		/* the batch stops at the first failing point, so resume after it */
+		unsigned done = 0;
+		while(done < amount) {
+			unsigned n = m_parser.EvalBatch(m_vars, 0, points + done,
+			                                chunk.values + done, amount - done);
+			std::fill(chunk.failed + done, chunk.failed + done + n, false);
+			done += n;
+			if(done < amount)
+				chunk.failed[done++] = true;
+		}
+
+		chunk.valid = amount;
+		return chunk;
+	}
+
+	FunctionParser m_parser;
+	double m_vars[6]; //x, ans, a, b, c, d
+	double m_start;
+	double m_step;
+	unsigned m_rows;
+	deque<Chunk> m_chunks;
+};
+
+/* ************ Table of values screen ************************************** */
+
+/* inkview's list only asks to paint visible items, so rows are
+   pulled from the ValueTable page by page */
+class TableList {
+public:
+	TableList(const char* title) {
+		m_title = title;
+	}
+
+	ValueTable& table() {
+		return m_table;
+	}
+
+	NumberFormat& format() {
+		return m_format;
+	}
+
+	static bool isOpen() {
+		return m_visible_table != NULL;
+	}
+
+	void show() {
+		m_visible_table = this;
+		Compositor::dialogOpened();
+		OpenList(m_title.c_str(), NULL,
+		         ScreenWidth() - 2 * c_wpad,
+		         GetThemeFont("menu.font.normal", "")->height + c_hpad,
+		         ((m_table.size() == 0) ? 1 : m_table.size()),
+		         0, &listCallback
+		        );
+	}
+
+private:
+	static int listCallback(int action, int x, int y, int idx, int /* state */) {
+		static ifont* menu_font = NULL;
+		if(menu_font == NULL) {
+			menu_font = GetThemeFont("menu.font.normal", "");
+		}
+
+		if(action == LIST_PAINT && idx >= 0 && (uint) idx < m_visible_table->m_table.size()) {
+			ValueTable& table = m_visible_table->m_table;
+			const NumberFormat& format = m_visible_table->m_format;
+			unsigned col_width = (ScreenWidth() - 4 * c_wpad) / 2;
+			double value = 0.0;
+
+			char arg[4 + NumberFormat::c_bufferSize] = "x = ";
+			char res[NumberFormat::c_bufferSize];
+			format.format(table.argument(idx), arg + 4);
+			if(table.value(idx, value))
+				format.format(value, res);
+			else
+				strcpy(res, "error");
+
+			SetFont(menu_font, BLACK);
+			DrawTextRect(x + 2 * c_wpad, y, col_width, menu_font->height + c_hpad / 2,
+			             arg, ALIGN_LEFT);
+			DrawTextRect(x + 2 * c_wpad + col_width, y, col_width, menu_font->height + c_hpad / 2,
+			             res, ALIGN_LEFT);
+		}
+		else if(action == LIST_EXIT) {
+			m_visible_table = NULL;
+			SetEventHandler(&global_event_handler);
+			return 1;
+		}
+
+		return 0;
+	}
+
+	string m_title;
+	ValueTable m_table;
+	NumberFormat m_format;
+	static const uint c_wpad = 16;
+	static const uint c_hpad = 4;
+	static TableList* m_visible_table;
+};
+
+TableList* TableList::m_visible_table = NULL;
+
+/* ****************** Matrix calculator ************************************* */
+
+static const char* evalErrorMessage(int error) {
+	switch(error) {
+		case 1: return "Division by zero";
+		case 2: return "Square root of a negative number";
+		case 3: return "Logarithm of a non-positive number";
+		case 4: return "Argument is out of function's domain";
+		case 6: return "No convergence (integrate/solve)";
+		case 7: return "Too many terms (sum/prod)";
+		case 8: return "Integer overflow";
+		case 9: return "Cancelled";
+		default: return "Evaluation error";
+	}
+}
+
+/* Evaluates expressions such as "inv([1,2;3,4]) * [5;6]": matrix literals
+   (',' separates elements and ';' rows), + - * /, unary minus, postfix '
+   (transpose), det(), inv(), transpose() and solve(A, B). Anything else is
+   a scalar expression for fparser; scalars are 1x1 matrices and scale
+   matrices they are multiplied with. */
+class MatrixExpression {
+public:
+	/* variables: values of ans, a, b, c, d (see Application::m_variables) */
+	MatrixExpression(FunctionParser& parser, const double* variables) {
+		m_parser = &parser;
+		m_variables = variables;
+		m_pos = NULL;
+	}
+
+	void evaluate(const string& expression, Matrix& result) {
+		m_pos = expression.c_str();
+		parseSum(result);
+		skipSpace();
+		if(*m_pos != '\0')
+			throw string("Unexpected '") + *m_pos + "'";
+	}
+
+	/* one word per row, e.g. "[1, 2;" and "3, 4]"; scalars as they are */
+	static void format(const Matrix& m, const NumberFormat& format, vector<string>& words) {
+		char buffer[NumberFormat::c_bufferSize];
+		if(m.isScalar()) {
+			words.push_back(string());
+			format.format(m(0, 0), words.back());
+			return;
+		}
+		for(uint r = 0; r < m.rows(); r++) {
+			words.push_back(string(r == 0 ? "[" : ""));
+			string& word = words.back();
+			for(uint c = 0; c < m.cols(); c++) {
+				if(c)
+					word += ", ";
+				word.append(buffer, format.format(m(r, c), buffer));
+			}
+			word += (r + 1 == m.rows()) ? ']' : ';';
+		}
+	}
+
+private:
+	void skipSpace() {
+		while(isspace(*m_pos))
+			m_pos++;
+	}
+
+	void expect(char c) {
+		skipSpace();
+		if(*m_pos != c)
+			throw string("Expected '") + c + "'";
+		m_pos++;
+	}
+
+	void parseSum(Matrix& result) {
+		parseProduct(result);
+		for(;;) {
+			skipSpace();
+			char op = *m_pos;
+			if(op != '+' && op != '-')
+				return;
+			m_pos++;
+
+			Matrix rhs, sum;
+			parseProduct(rhs);
+			Matrix::add(result, rhs, op == '+' ? 1.0 : -1.0, sum);
+			result = sum;
+		}
+	}
+
+	void parseProduct(Matrix& result) {
+		parseUnary(result);
+		for(;;) {
+			skipSpace();
+			char op = *m_pos;
+			if(op != '*' && op != '/')
+				return;
+			m_pos++;
+
+			Matrix rhs, product;
+			parseUnary(rhs);
+			if(op == '/') {
+				if(!rhs.isScalar())
+					throw string("Cannot divide by a matrix, use inv()");
+				if(rhs(0, 0) == 0.0)
+					throw string(evalErrorMessage(1));
+				Matrix::scale(result, 1.0 / rhs(0, 0), product);
+			}
+			else if(result.isScalar())
+				Matrix::scale(rhs, result(0, 0), product);
+			else if(rhs.isScalar())
+				Matrix::scale(result, rhs(0, 0), product);
+			else
+				Matrix::multiply(result, rhs, product);
+			result = product;
+		}
+	}
+
+	void parseUnary(Matrix& result) {
+		skipSpace();
+		if(*m_pos == '-') {
+			m_pos++;
+			Matrix operand;
+			parseUnary(operand);
+			Matrix::scale(operand, -1.0, result);
+			return;
+		}
+
+		parsePrimary(result);
+		for(;;) {
+			skipSpace();
+			if(*m_pos != '\'')
+				return;
+			m_pos++;
+
+			Matrix transposed;
+			Matrix::transpose(result, transposed);
+			result = transposed;
+		}
+	}
+
+	void parsePrimary(Matrix& result) {
+		skipSpace();
+		if(*m_pos == '[') {
+			parseLiteral(result);
+			return;
+		}
+		if(*m_pos == '(') {
+			m_pos++;
+			parseSum(result);
+			expect(')');
+			return;
+		}
+
+		const char* begin = m_pos;
+		while(isalnum(*m_pos) || *m_pos == '_')
+			m_pos++;
+		string name(begin, m_pos);
+		skipSpace();
+
+		/* solve() with other than two arguments is fparser's root finder */
+		if(*m_pos == '(' && (name == "det" || name == "inv" || name == "transpose" ||
+		                     (name == "solve" && countArguments(m_pos + 1) == 2))) {
+			m_pos++;
+			Matrix arg;
+			parseSum(arg);
+			if(name == "solve") {
+				Matrix rhs;
+				expect(',');
+				parseSum(rhs);
+				Matrix::solve(arg, rhs, result);
+			}
+			else if(name == "det") {
+				result.assign(1, 1);
+				result(0, 0) = Matrix::det(arg);
+			}
+			else if(name == "inv")
+				Matrix::inverse(arg, result);
+			else
+				Matrix::transpose(arg, result);
+			expect(')');
+			return;
+		}
+
+		m_pos = begin;
+		parseScalar(result);
+	}
+
+	void parseLiteral(Matrix& result) {
+		m_pos++; // '['
+		vector<double> elements;
+		uint rows = 0, cols = 0, col = 0;
+		for(;;) {
+			Matrix element;
+			parseSum(element);
+			if(!element.isScalar())
+				throw string("Matrix elements must be numbers");
+			elements.push_back(element(0, 0));
+			col++;
+
+			skipSpace();
+			char c = *m_pos;
+			if(c != ',' && c != ';' && c != ']')
+				throw string("Expected ',', ';' or ']'");
+			m_pos++;
+			if(c == ',')
+				continue;
+
+			if(rows == 0)
+				cols = col;
+			else if(col != cols)
+				throw string("Matrix rows must have the same length");
+			rows++;
+			col = 0;
+			if(c == ']')
+				break;
+		}
+
+		result.assign(rows, cols);
+		std::copy(elements.begin(), elements.end(), result.row(0));
+	}
+
+	/* A scalar ends at the first operator of the matrix expression outside
+	   of parentheses, except for signs of exponents ("1e-5", "2^-1"). */
+	void parseScalar(Matrix& result) {
+		const char* begin = m_pos;
+		int depth = 0;
+		for(; *m_pos; m_pos++) {
+			char c = *m_pos;
+			if(c == '(' || c == '[')
+				depth++;
+			else if(depth > 0) {
+				if(c == ')' || c == ']')
+					depth--;
+			}
+			else if(c == '+' || c == '-') {
+				const char* prev = m_pos - 1;
+				while(prev > begin && isspace(*prev))
+					prev--;
+				bool exponent = prev > begin && (*prev == 'e' || *prev == 'E') &&
+				                (isdigit(prev[-1]) || prev[-1] == '.');
+				if(prev < begin || !(exponent || *prev == '^'))
+					break;
+			}
+			else if(strchr("*/)],;'", c))
+				break;
+		}
+
+		string expression(begin, m_pos);
+		if(expression.find_first_not_of(" \t") == string::npos)
+			throw string("Syntax error");
+
+		if(m_parser->Parse(expression, "ans,a,b,c,d") != -1)
+			throw string(m_parser->ErrorMsg());
+		double value = m_parser->Eval(m_variables);
+		if(m_parser->EvalError() != 0)
+			throw string(evalErrorMessage(m_parser->EvalError()));
+
+		result.assign(1, 1);
+		result(0, 0) = value;
+	}
+
+	/* number of top-level arguments of the call whose '(' precedes ptr */
+	static uint countArguments(const char* ptr) {
+		uint count = 1;
+		int depth = 0;
+		for(; *ptr; ptr++) {
+			if(*ptr == '(' || *ptr == '[')
+				depth++;
+			else if(*ptr == ')' || *ptr == ']') {
+				if(depth-- == 0)
+					break;
+			}
+			else if(*ptr == ',' && depth == 0)
+				count++;
+		}
+		return count;
+	}
+
+	FunctionParser* m_parser;
+	const double* m_variables;
+	const char* m_pos;
+};
+
+/* ********************** Background evaluation ***************************** */
+
+/* Parses and evaluates an expression on a worker thread, with a deep copy
+   of the parser, so that long integrals or sums don't block the UI. The UI
+   thread polls done(); cancel() stops the worker within one evaluation of
+   a sub-expression. */
+class Evaluation {
+public:
+	Evaluation() {
+		m_running = false;
+		m_threaded = false;
+		m_cancel = 0;
+		m_done = 0;
+		m_result = 0.0;
+	}
+
+	~Evaluation() {
+		cancel();
+	}
+
+	/* variables: values of ans, a, b, c, d; a running evaluation is
+	   cancelled first */
+	void start(const FunctionParser& parser, const string& expression, const double* variables) {
+		cancel();
+		m_parser = parser;
+		m_parser.ForceDeepCopy();
+		m_expression = expression;
+		std::copy(variables, variables + 5, m_variables);
+		m_cancel = 0;
+		m_done = 0;
+		m_error.clear();
+
+		m_running = true;
+		m_threaded = pthread_create(&m_thread, NULL, &run, this) == 0;
+		if(!m_threaded)
+			run(this);
+	}
+
+	/* started and not finished yet */
+	bool running() const {
+		return m_running;
+	}
+
+	bool done() const {
+		return !m_threaded || __atomic_load_n(&m_done, __ATOMIC_ACQUIRE);
+	}
+
+	/* waits for the worker; result() and error() are valid afterwards */
+	void finish() {
+		if(m_threaded)
+			pthread_join(m_thread, NULL);
+		m_threaded = false;
+		m_running = false;
 	}
 
-	~FullscreenList() {
-		delete m_items;
+	/* asks the worker to stop; it is still running until finish() */
+	void requestCancel() {
+		if(m_running)
+			__atomic_store_n(&m_cancel, 1, __ATOMIC_RELAXED);
 	}
 
-private:
-	static int listCallback(int action, int x, int y, int idx, int state) {
-		static ifont* menu_font = NULL;
-		if(menu_font == NULL) {
-			menu_font = GetThemeFont("menu.font.normal", "");
+	void cancel() {
+		if(m_running) {
+			requestCancel();
+			finish();
 		}
+	}
 
-		if(action == LIST_PAINT && m_visible_list->m_items->size() != 0) {
-			SetFont(menu_font, menu_font->size);
-			
-			DrawTextRect(
-				x + 2 * c_wpad,
-				y,
-				ScreenWidth() - 4 * c_wpad,
-				menu_font->height + c_hpad / 2,
-				m_visible_list->m_items->at(idx).c_str(),
-				0
-			);
-			
-			if(state == 1) {
-				DrawSelection(x, y, ScreenWidth() - 2 * c_wpad, menu_font->height + c_hpad, BLACK);
-			}
-		}
-		else if(action == LIST_EXIT) {
-			m_visible_list = NULL;
-			/* TODO: Am i doing it right? */
-			SetEventHandler(&global_event_handler);
-			return 1;
+	double result() const {
+		return m_result;
+	}
+
+	/* empty if the evaluation succeeded */
+	const string& error() const {
+		return m_error;
+	}
+
+private:
+	static void* run(void* arg) {
+		Evaluation& e = *static_cast<Evaluation*>(arg);
+		FunctionParser::SetCancelFlag(&e.m_cancel);
+		if(e.m_parser.Parse(e.m_expression, "ans,a,b,c,d") != -1)
+			e.m_error = e.m_parser.ErrorMsg();
+		else {
+			e.m_result = e.m_parser.Eval(e.m_variables);
+			if(e.m_parser.EvalError() != 0)
+				e.m_error = evalErrorMessage(e.m_parser.EvalError());
 		}
+		FunctionParser::SetCancelFlag(NULL);
+		__atomic_store_n(&e.m_done, 1, __ATOMIC_RELEASE);
+		return NULL;
+	}
 
-		if(idx != -1 && state == 1 && m_visible_list->m_items->size() != 0)
-			m_visible_list->m_selected = idx;
+	FunctionParser m_parser;
+	string m_expression;
+	double m_variables[5];
+	double m_result;
+	string m_error;
 
-		if(m_visible_list->m_items->size() == 0 && action == LIST_MENU) {
-			SendEvent(&global_event_handler, EVT_LIST_ACTION, m_visible_list->m_id*1000 + 999, LIST_MENU);
-			return 1;
+	pthread_t m_thread;
+	bool m_running;
+	bool m_threaded;
+	int m_cancel;
+	int m_done;
+};
+
+/* ****************** Integer calculator *********************************** */
+
+/* Evaluates an expression exactly in integers: + - * / % ^ (/ truncates),
+   abs, min, max, if, sum and prod. It is run with machine longs first and
+   only if that overflows again with GMP big integers, so the usual small
+   results cost no more than with doubles. ans, a, b, c, d are truncated
+   to integers; those that aren't finite numbers are left undefined. */
+class IntegerExpression {
+public:
+	/* variables: values of ans, a, b, c, d (see Application::m_variables) */
+	IntegerExpression(const double* variables) {
+		m_variables = variables;
+	}
+
+	/* result is the value in decimal or, if that is longer than maxLength
+	   characters, its leading digits and an exponent as in "1.2345e+678";
+	   maxLength must be at least 20, the length of any long */
+	void evaluate(const string& expression, uint maxLength, string& result) {
+		string names;
+		vector<double> values;
+		bool fitLong = true;
+		for(uint i = 0; i < c_variables; i++) {
+			const double value = m_variables[i];
+			if(!(std::fabs(value) <= DBL_MAX))
+				continue;
+			const double whole = value < 0 ? std::ceil(value) : std::floor(value);
+			if(!(std::fabs(whole) < -double(LONG_MIN)))
+				fitLong = false;
+			if(!names.empty())
+				names += ',';
+			names += c_names[i];
+			values.push_back(whole);
 		}
 
-		if(idx != -1 && m_visible_list->m_items->size() != 0) {
-			//SendEvent(&global_event_handler, EVT_LIST_ACTION, (m_visible_list->m_id << 16) | idx, action);
-			SendEvent(&global_event_handler, EVT_LIST_ACTION, m_visible_list->m_id*1000 + idx, action);
+		FunctionParser_li longParser;
+		if(fitLong && longParser.Parse(expression, names) == -1) {
+			vector<long> longValues(values.begin(), values.end());
+			const long value = longParser.Eval(longValues.empty() ? NULL : &longValues[0]);
+			const int error = longParser.EvalError();
+			if(error == 0) {
+				char buffer[32];
+				result.assign(buffer, std::sprintf(buffer, "%ld", value));
+				return;
+			}
+			if(error != c_overflow)
+				throw string(evalErrorMessage(error));
 		}
-		return 0;
+
+#ifdef FP_SUPPORT_GMP_INT_TYPE
+		/* a literal too long for a long is a parse error there, so parse
+		   errors are reported from here */
+		FunctionParser_gmpint gmpParser;
+		if(gmpParser.Parse(expression, names) != -1)
+			throw string(gmpParser.ErrorMsg());
+		vector<GmpInt> gmpValues(values.begin(), values.end());
+		const GmpInt value = gmpParser.Eval(gmpValues.empty() ? NULL : &gmpValues[0]);
+		if(gmpParser.EvalError() != 0)
+			throw string(evalErrorMessage(gmpParser.EvalError()));
+
+		/* the buffer size bounds the length closely enough */
+		const uint length = value.getAsStringBufferSize() - 1;
+		if(length <= maxLength) {
+			value.getAsString(result);
+			return;
+		}
+		char exponent[32];
+		const uint exponentLength = std::sprintf(exponent, "%u", length);
+		const uint digits = maxLength > exponentLength + 5 ? maxLength - exponentLength - 4 : 1;
+		vector<char> buffer(GmpInt::getLeadingDigitsBufferSize(digits));
+		result.assign(&buffer[0], value.getLeadingDigits(digits, &buffer[0], buffer.size()));
+#else
+		(void) maxLength;
+		if(fitLong && longParser.GetParseErrorType() != FunctionParser_li::FP_NO_ERROR)
+			throw string(longParser.ErrorMsg());
+		throw string(evalErrorMessage(c_overflow));
+#endif
 	}
 
-	string m_title;
-	uint m_id;
-	int m_selected;
-	static const uint c_wpad = 16;
-	static const uint c_hpad = 4;
-	vector<string>* m_items;
-	static FullscreenList* m_visible_list; //FIXME: this looks like a hack (or doesnt?)
-	static uint m_last_id; //TODO: create an interface for classes that need IDs or derive them from Widget
-};
+private:
+	static const uint c_variables = 5;
+	static const char* const c_names[c_variables];
+	static const int c_overflow = 8;
 
-FullscreenList* FullscreenList::m_visible_list = NULL;
-uint FullscreenList::m_last_id = 0;
+	const double* m_variables;
+};
 
-/* ********************** Keyboard input class ****************************** */
+const char* const IntegerExpression::c_names[IntegerExpression::c_variables] = {
+	"ans", "a", "b", "c", "d"
+};
 
-class Keyboard {
+/* ****************** Fraction calculator ********************************** */
+
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+/* Evaluates an expression in exact fractions, e.g. 1/3+1/6 = 1/2, with the
+   built-in functions of the parser and pi. User-defined functions and
+   constants are doubles and aren't available. Functions whose result isn't
+   a fraction (sin, log, sqrt(2), pi, ...) are computed with MPFR and make
+   the result approximate. Of ans, a, b, c, d integers are taken as exact and
+   other values as approximate; those that aren't finite numbers are left
+   undefined. */
+class RationalExpression {
 public:
-	static void show(const string& title, const string& initText, uint id) {
-		m_callerID = id;
-		strcpy(m_kbdBuffer, initText.c_str());
-		OpenKeyboard(const_cast<char*>(title.c_str()), m_kbdBuffer, sizeof(m_kbdBuffer) - 1, 0, &callback);
-	}
+	/* variables: values of ans, a, b, c, d (see Application::m_variables) */
+	RationalExpression(const double* variables, const NumberFormat& format) :
+		m_variables(variables),
+		m_format(format)
+	{}
+
+	/* result is the exact fraction or, if the value is approximate or the
+	   fraction is longer than maxLength characters, the value in decimal;
+	   value is set to the value rounded to a double */
+	void evaluate(const string& expression, uint maxLength, string& result, double& value) {
+		string names;
+		vector<GmpRational> values;
+		for(uint i = 0; i < c_variables; i++) {
+			if(!(std::fabs(m_variables[i]) <= DBL_MAX))
+				continue;
+			if(!names.empty())
+				names += ',';
+			names += c_names[i];
+			values.push_back(GmpRational(m_variables[i]));
+		}
 
-	static string getText() {
-		return string(m_kbdBuffer);
+		FunctionParser_rational parser;
+		parser.AddConstant("pi", GmpRational(MpfrFloat::const_pi()));
+		if(parser.Parse(expression, names) != -1)
+			throw string(parser.ErrorMsg());
+		const GmpRational fraction = parser.Eval(values.empty() ? NULL : &values[0]);
+		if(parser.EvalError() != 0)
+			throw string(evalErrorMessage(parser.EvalError()));
+
+		value = fraction.toDouble();
+		if(fraction.isExact()) {
+			fraction.getAsString(result);
+			if(result.size() <= maxLength)
+				return;
+		}
+		m_format.format(value, result);
 	}
+
 private:
-	static void callback(char* b) {
-		if(b == NULL)
-			SendEvent(&global_event_handler, EVT_KEYBOARD, m_callerID, -1);
-		else
-			SendEvent(&global_event_handler, EVT_KEYBOARD, m_callerID, 0);
-	}
-	//TODO: allow to change buffer size
-	static char m_kbdBuffer[512];
-	static uint m_callerID;
+	static const uint c_variables = 5;
+	static const char* const c_names[c_variables];
+
+	const double* m_variables;
+	NumberFormat m_format;
 };
 
-uint Keyboard::m_callerID;
-char Keyboard::m_kbdBuffer[512];
+const char* const RationalExpression::c_names[RationalExpression::c_variables] = {
+	"ans", "a", "b", "c", "d"
+};
+#endif
 
 /* *************** Main application class *********************************** */
 
@@ -953,6 +2347,8 @@ public:
 			Widget::setGlobalFont(OpenFont(CFG_FONT_NAME, CFG_BUTTON_FONT_SIZE - 4, 0));
 		else
 			Widget::setGlobalFont(OpenFont(CFG_FONT_NAME, CFG_BUTTON_FONT_SIZE, 0));
+		FontMetrics::of(m_textboxFont);
+		FontMetrics::of(Widget::getGlobalFont());
 
 		m_inputBox = new TextBox();
 		m_inputBox->setPos(c_padding, c_padding);
@@ -983,6 +2379,13 @@ public:
 		m_menu->append(ITEM_ACTIVE, c_menu_eval, "Keyboard");
 		m_menu->append(ITEM_ACTIVE, c_menu_custom, "Expressions");
 		m_menu->append(ITEM_ACTIVE, c_menu_history, "History");
+		m_menu->append(ITEM_ACTIVE, c_menu_table, "Table");
+		m_menu->append(ITEM_ACTIVE, c_menu_matrix, "Matrix");
+		m_menu->append(ITEM_ACTIVE, c_menu_integer, "Integer");
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+		m_menu->append(ITEM_ACTIVE, c_menu_fraction, "Fraction");
+#endif
+		m_menu->append(ITEM_ACTIVE, c_menu_format, "Format");
 		m_menu->append(ITEM_ACTIVE, c_menu_help, "Help");
 		m_menu->append(ITEM_SEPARATOR, 0, NULL);
 		m_menu->append(ITEM_ACTIVE, c_menu_exit, "Exit");
@@ -997,6 +2400,12 @@ public:
 		for(uint i = 0; i < m_customExpr.size(); i++)
 			m_exprList->append(m_customExpr[i].first.c_str());
 
+		m_tableList = new TableList("Table of values");
+		m_tableList->format() = m_numberFormat;
+		m_matrixExpr = "[1, 2; 3, 4]";
+		m_integerExpr = "prod(i, i, 1, 30)";
+		m_fractionExpr = "1/3 + 1/6";
+
 		m_historyList = new FullscreenList("History");
 		for(uint i = 0; i < m_history.size(); i++) {
 			string hist_ent;
@@ -1037,12 +2446,21 @@ public:
 		
 		m_buttonExpr = static_cast<Button*>(Widget::findByName("expr"));
 		
-		m_buttonsLayout->update();
+		/* measuring every button takes a while, so the result is kept */
+		const unsigned key = layoutKey();
+		if(!m_buttonsLayout->load(c_layout, key)) {
+			m_buttonsLayout->update();
+			m_buttonsLayout->save(c_layout, key);
+		}
 
 		ClearScreen();
 	}
 
 	~Application() {
+		ClearTimer(&evaluation_timer);
+		m_evaluation.cancel();
+		cancelPreview();
+
 		delete m_inputBox;
 		delete m_answerBox;
 		delete m_buttonCalculate;
@@ -1061,8 +2479,11 @@ public:
 		delete m_listMenu;
 		delete m_exprList;
 		delete m_historyList;
+		delete m_tableList;
 		delete m_buttonsLayout;
 		delete m_helpView;
+		FontMetrics::forget(Widget::getGlobalFont());
+		FontMetrics::forget(m_textboxFont);
 		CloseFont(const_cast<ifont*>(Widget::getGlobalFont()));
 		CloseFont(m_textboxFont);
 		delete m_fparser;
@@ -1073,9 +2494,16 @@ public:
 		ClearScreen();
 		Widget::drawAll();
 		FullUpdate();
+		Compositor::discard();
 	}
 
+	friend void evaluation_timer();
+	friend void preview_timer();
+
 	int event(int event, int param1, int param2) {
+		Compositor::begin();
+		if(Compositor::dialogOpen() && closesDialog(event) && !FullscreenList::isOpen() && !TableList::isOpen())
+			Compositor::dialogClosed();
 		switch(event) {
 			case EVT_SHOW:
 				redraw();
@@ -1097,6 +2525,9 @@ public:
 			case EVT_KEYBOARD:
 				onKeyboard(param1, param2);
 				break;
+			case EVT_EVALUATION:
+				onEvaluationDone();
+				break;
 			case EVT_KEYPRESS:
 				if(m_helpView->getVisibility() == true) {
 					Widget::showAll();
@@ -1122,6 +2553,7 @@ public:
 						break;
 				}
 				else if(param1 == KEY_MENU) {
+					cancelPreview();
 					m_menu->show();
 					break;
 				}
@@ -1134,24 +2566,25 @@ public:
 			default:
 				break;
 		}
+		Compositor::end();
 
 		return 0;
 	}
 
 private:
+	/* Dialogs take the input while they are open, so input reaching us means
+	   they are closed; a Message that timed out goes unnoticed until then. */
+	static bool closesDialog(int event) {
+		return event == EVT_SHOW || event == EVT_MENU_SELECT || event == EVT_KEYBOARD ||
+		       event == EVT_KEYPRESS || event == EVT_POINTERDOWN;
+	}
+
 	void onCalcButtonPressed(int id) {
 		CalcButton* btn = static_cast<CalcButton*>(Widget::getByID(id));
 		__DBG("found btn" << btn);
-		unsigned r, c;
-		for(r = 0; r < CFG_GRID_ROWS; r++)
-			for(c = 0; c < CFG_GRID_COLS; c++) {
-				if((*m_buttonsLayout) [r][c] == btn)
-					goto found_widget;
-			}
-		found_widget:
-		m_focusedBtnRow = r;
-		m_focusedBtnCol = c;
-		__DBG("got row and col" << r << " " << c)
+		m_focusedBtnRow = btn->getGridRow();
+		m_focusedBtnCol = btn->getGridCol();
+		__DBG("got row and col" << m_focusedBtnRow << " " << m_focusedBtnCol)
 		__DBG("btn func: " << btn->getFunc()->str[0])
 		unsigned i = 0;
 		while(btn->getFunc()->str[i][0] != '\0') {
@@ -1163,8 +2596,9 @@ private:
 		}
 		__DBG("input box pos set")
 		m_inputBox->setTextPos(m_inputBox->getTextPos() - btn->getFunc()->pos);
-		m_inputBox->draw();
+		m_inputBox->redraw();
 		m_inputBox->update();
+		schedulePreview();
 		__DBG("done")
 	}
 	
@@ -1172,25 +2606,31 @@ private:
 		if((unsigned) id == m_buttonClear->getID() && long_press) {
 			m_inputBox->clear();
 			m_inputBox->update();
+			cancelPreview();
 		}
 		else if((unsigned) id == m_buttonClear->getID() && !long_press) {
 			if(m_inputBox->getTextPos() != 0) {
-				m_inputBox->words().erase(m_inputBox->words().begin() + m_inputBox->getTextPos() - 1);
+				m_inputBox->erase(m_inputBox->getTextPos() - 1);
 				m_inputBox->setTextPos(m_inputBox->getTextPos() - 1);
-				m_inputBox->draw();
+				m_inputBox->redraw();
 				m_inputBox->update();
+				schedulePreview();
 			}
 		}
 		else if((unsigned) id == m_buttonCalculate->getID()) {
-			bool result = evalAndDisplay(m_inputBox->getString());
-			if(result)
-				historyAppend(m_inputBox->words());
+			if(m_evaluation.running()) {
+				cancelEvaluation();
+				return;
+			}
+
+			evalAndDisplay(m_inputBox->getString(), m_inputBox->getWords(), false);
 			
 			m_inputBox->clear();
 			m_inputBox->draw();
 			m_inputBox->asyncUpdate();
 		}
 		else if((unsigned) id == m_buttonExpr->getID()) {
+			cancelPreview();
 			m_exprList->show();
 		}
 	}
@@ -1226,8 +2666,9 @@ private:
 				
 				m_inputBox->insert(name1, m_inputBox->getTextPos());
 				m_inputBox->insert(")", m_inputBox->getTextPos() + 1);
-				m_inputBox->asyncUpdate();
 				m_inputBox->setTextPos(m_inputBox->getTextPos() + 1);
+				m_inputBox->redraw();
+				m_inputBox->asyncUpdate();
 				
 				m_exprList->hide();
 			}
@@ -1239,7 +2680,8 @@ private:
 				for(vector<string>::iterator it = m_history[index].begin(); it != m_history[index].end(); it++)
 					m_inputBox->append(*it);
 				
-				m_inputBox->setTextPos(m_inputBox->words().size() - 1);
+				m_inputBox->setTextPos(m_inputBox->getWords().size() - 1);
+				m_inputBox->redraw();
 				m_inputBox->asyncUpdate();
 				
 				m_historyList->hide();
@@ -1276,6 +2718,23 @@ private:
 					m_historyList->show();
 				}
 				break;
+				case c_menu_table:
+					Keyboard::show("Table: f(x); start; end; step", "x^2; 0; 10; 1", c_menu_table);
+				break;
+				case c_menu_matrix:
+					Keyboard::show("Matrix expression", m_matrixExpr, c_menu_matrix);
+				break;
+				case c_menu_integer:
+					Keyboard::show("Integer expression", m_integerExpr, c_menu_integer);
+				break;
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+				case c_menu_fraction:
+					Keyboard::show("Fraction expression", m_fractionExpr, c_menu_fraction);
+				break;
+#endif
+				case c_menu_format:
+					Keyboard::show("Number format: auto, fix N, sci N or eng N", m_numberFormat.toString(), c_menu_format);
+				break;
 				case c_menu_help:
 					Widget::hideAll();
 					m_helpView->setVisibility(true);
@@ -1313,6 +2772,8 @@ private:
 		if(action == -1)    //input canceled
 			return;
 		
+		cancelEvaluation();
+
 		if((uint) caller == c_menu_list_add) {
 			try {
 				string name, body, var;
@@ -1321,6 +2782,7 @@ private:
 				m_customExpr.push_back(std::pair<string, string> (name, body));
 			}
 			catch(const string& s) {
+				Compositor::dialogOpened();
 				Message(ICON_ERROR, "Invalid expression", s.c_str(), 10);
 			}
 		}
@@ -1334,23 +2796,58 @@ private:
 				initParser();
 			}
 			catch(const string& s) {
+				Compositor::dialogOpened();
 				Message(ICON_ERROR, "Invalid expression", s.c_str(), 10);
 			}
 		}
+		else if((uint) caller == c_menu_table) {
+			try {
+				vector<string> parts = splitStr(Keyboard::getText(), ";");
+				if(parts.size() != 4)
+					throw string("Expected: f(x); start; end; step");
+
+				double start = evalExpression(parts[1]);
+				double end = evalExpression(parts[2]);
+				double step = evalExpression(parts[3]);
+				m_tableList->table().setup(*m_fparser, parts[0], start, end, step, m_variables);
+				m_tableList->show();
+			}
+			catch(const string& s) {
+				Compositor::dialogOpened();
+				Message(ICON_ERROR, "Invalid table", s.c_str(), 10);
+			}
+		}
+		else if((uint) caller == c_menu_matrix) {
+			m_matrixExpr = Keyboard::getText();
+			evalMatrixAndDisplay(m_matrixExpr);
+		}
+		else if((uint) caller == c_menu_integer) {
+			m_integerExpr = Keyboard::getText();
+			evalIntegerAndDisplay(m_integerExpr);
+		}
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+		else if((uint) caller == c_menu_fraction) {
+			m_fractionExpr = Keyboard::getText();
+			evalFractionAndDisplay(m_fractionExpr);
+		}
+#endif
+		else if((uint) caller == c_menu_format) {
+			if(!NumberFormat::parse(Keyboard::getText(), m_numberFormat)) {
+				Compositor::dialogOpened();
+				Message(ICON_ERROR, "Invalid format", "Expected: auto, fix N, sci N or eng N", 10);
+			}
+			m_tableList->format() = m_numberFormat;
+		}
 		else if((uint) caller == c_menu_eval) {
 			string kbd_str = Keyboard::getText();
-			bool res = evalAndDisplay(kbd_str);
-			if(!res)
-				return;
-			
+
+			/* pasted data (e.g. long lists) is not worth keeping in history */
 			vector<string> hist_ent;
-			for(string::iterator it = kbd_str.begin(); it != kbd_str.end(); it++)
-				hist_ent.push_back(string(1, *it));
-			historyAppend(hist_ent);
-			
-			m_inputBox->clear();
-			m_inputBox->draw();
-			m_inputBox->update();
+			if(kbd_str.size() <= c_history_max_length)
+				for(string::iterator it = kbd_str.begin(); it != kbd_str.end(); it++)
+					hist_ent.push_back(string(1, *it));
+
+			evalAndDisplay(kbd_str, hist_ent, true);
 		}
 	}
 	
@@ -1380,6 +2877,11 @@ private:
 		char* history = NULL;
 		vector<string> expr_vec, hist_vec;
 
+		char* format = ReadString(cfg, "format", NULL);
+		if(format != NULL)
+			NumberFormat::parse(format, m_numberFormat);
+		Compositor::setDiffing(ReadInt(cfg, "diffing", 1) != 0);
+
 		char* expressions = ReadString(cfg, "expressions", NULL);
 		if(expressions == NULL)
 			goto create_config;
@@ -1457,6 +2959,9 @@ private:
 		WriteString(cfg, "history", history);
 		delete [] history;
 
+		WriteString(cfg, "format", m_numberFormat.toString().c_str());
+		WriteInt(cfg, "diffing", Compositor::diffing() ? 1 : 0);
+
 		CloseConfig(cfg);
 	}
 
@@ -1514,11 +3019,11 @@ private:
 		return name;
 	}
 
-	bool processAssignment(const string& expression) {
-		std::istringstream iss(expression);
-		
+	/* For "v := body" returns the index of v in m_variables and sets body;
+	   for other expressions returns 0 (for 'ans') and sets body to all of
+	   expression. */
+	unsigned splitAssignment(const string& expression, string& body) {
 		string name = "";
-		string body = "";
 		const string assign_op = ":=";
 		
 		std::size_t pos = expression.find(assign_op);
@@ -1526,7 +3031,8 @@ private:
 			name = expression.substr(0, pos);
 			body = expression.substr(pos + assign_op.length());
 		} else {
-			return false;
+			body = expression;
+			return 0;
 		}
 		
 		name.erase(
@@ -1541,17 +3047,10 @@ private:
 		__DBG("assign var idx is " << var_index);
 		__DBG("assign var is " << name[0]);
 		__DBG("assign body is " << body);
-		if(variables.find(name) != std::string::npos) {
-			double value = evalExpression(body);
-			__DBG("assign prev value is " << m_variables[var_index]);
-			m_variables[var_index] = value;
-			__DBG("assign value is " << m_variables[var_index]);
-		}
-		else {
+		if(name.empty() || variables.find(name) == std::string::npos)
 			throw string("Assigned variable error");
-		}
 		
-		return true;
+		return var_index;
 	}
 	
 	double evalExpression(const string& expression) {
@@ -1563,7 +3062,7 @@ private:
 			throw string(m_fparser->ErrorMsg());
 
 		if(m_fparser->EvalError() != 0)
-			throw string("Evaluation error");
+			throw string(evalErrorMessage(m_fparser->EvalError()));
 
 		return result;
 	}
@@ -1574,35 +3073,251 @@ private:
 		m_history.push_front(item);
 	}
 
-	bool evalAndDisplay(const string& expression) {
+	/* Starts evaluating expression in the background; the result is shown
+	   (or assigned) by onEvaluationDone(). history is added to the history
+	   if the evaluation succeeds, and the input box is cleared then if
+	   clearInput is set. */
+	void evalAndDisplay(const string& expression, const vector<string>& history, bool clearInput) {
+		cancelPreview();
 		m_answerBox->words().clear();
-
-		double result = 0.0;
 		try {
-			bool has_assign = processAssignment(expression);
-			if(has_assign)
-				return true;
-			
-			result = evalExpression(expression);
+			string body;
+			m_evalTarget = splitAssignment(expression, body);
+			m_evaluation.start(*m_fparser, body, m_variables);
 		}
 		catch(const string& errMsg) {
 			m_answerBox->words().push_back(errMsg);
 			m_answerBox->draw();
 			m_answerBox->asyncUpdate();
+			return;
+		}
+		m_evalHistory = history;
+		m_evalClearsInput = clearInput;
+		m_evalTicks = 0;
+
+		m_answerBox->words().push_back("Evaluating...");
+		m_answerBox->draw();
+		m_answerBox->asyncUpdate();
+		SetHardTimer("evaluation", &evaluation_timer, c_eval_poll);
+	}
+
+	/* A system dialog or the help screen covers the answer box. TextBox
+	   draws regardless of visibility, so timers must check this first. */
+	bool answerCovered() const {
+		return Compositor::dialogOpen() || !m_answerBox->getVisibility();
+	}
+
+	/* called by a timer while an evaluation runs; while the answer box is
+	   covered the result waits for it to show again */
+	void onEvaluationTimer() {
+		if(!m_evaluation.running())
+			return;
+		if(answerCovered()) {
+			SetHardTimer("evaluation", &evaluation_timer, c_eval_poll);
+			return;
+		}
+		if(m_evaluation.done()) {
+			SendEvent(&global_event_handler, EVT_EVALUATION, 0, 0);
+			return;
+		}
+
+		/* show that something is going on, once a second */
+		if(++m_evalTicks % (1000 / c_eval_poll) == 0) {
+			std::ostringstream oss;
+			oss << "Evaluating... " << m_evalTicks * c_eval_poll / 1000 << " s (= to cancel)";
+			m_answerBox->words().clear();
+			m_answerBox->words().push_back(oss.str());
+			m_answerBox->draw();
+			m_answerBox->asyncUpdate();
+		}
+		SetHardTimer("evaluation", &evaluation_timer, c_eval_poll);
+	}
+
+	void onEvaluationDone() {
+		if(!m_evaluation.running())
+			return;
+		ClearTimer(&evaluation_timer);
+		m_evaluation.finish();
+
+		m_answerBox->words().clear();
+		const bool clearInput = m_evaluation.error().empty() && m_evalClearsInput;
+		if(!m_evaluation.error().empty())
+			m_answerBox->words().push_back(m_evaluation.error());
+		else {
+			m_variables[m_evalTarget] = m_evaluation.result();
+			m_previewCache.clear();
+			if(m_evalTarget == 0) {
+				m_answerBox->words().push_back(string());
+				m_numberFormat.format(m_evaluation.result(), m_answerBox->words().back());
+			}
+			if(!m_evalHistory.empty())
+				historyAppend(m_evalHistory);
+			if(clearInput) {
+				m_inputBox->words().clear();
+				m_inputBox->setTextPos(0);
+			}
+		}
+
+		/* cancelled from a keyboard opened over a list: the list's closing
+		   redraws everything */
+		if(answerCovered())
+			return;
+		if(clearInput) {
+			m_inputBox->draw();
+			m_inputBox->update();
+		}
+		m_answerBox->draw();
+		m_answerBox->asyncUpdate();
+	}
+
+	/* the parser may be changed or used on this thread afterwards */
+	void cancelEvaluation() {
+		cancelPreview();
+		m_previewCache.clear();
+		if(m_evaluation.running()) {
+			/* onEvaluationDone() joins the worker and shows "Cancelled" */
+			m_evaluation.requestCancel();
+			onEvaluationDone();
+		}
+	}
+
+	/* The input is evaluated in the background once no key has been pressed
+	   for c_preview_delay, and its value is shown in the answer box. Input
+	   that can't be complete yet isn't evaluated, and values are kept by
+	   expression until the variables or the parser change. */
+	void schedulePreview() {
+		m_preview.cancel();
+		SetHardTimer("preview", &preview_timer, c_preview_delay);
+	}
+
+	void cancelPreview() {
+		ClearTimer(&preview_timer);
+		m_preview.cancel();
+	}
+
+	void onPreviewTimer() {
+		if(m_preview.running()) {
+			if(!m_preview.done()) {
+				SetHardTimer("preview", &preview_timer, c_eval_poll);
+				return;
+			}
+			m_preview.finish();
+			string text;
+			if(m_preview.error().empty())
+				m_numberFormat.format(m_preview.result(), text);
+			if(m_previewCache.size() >= c_preview_cache_size)
+				m_previewCache.clear();
+			m_previewCache[m_previewExpr] = text;
+			showPreview(text);
+			return;
+		}
+
+		/* "=" evaluates with the same sub-parsers, so don't run beside it */
+		if(m_evaluation.running() || !isComplete(m_inputBox->getWords()))
+			return;
+
+		m_previewExpr = m_inputBox->getString();
+		std::map<string, string>::const_iterator it = m_previewCache.find(m_previewExpr);
+		if(it != m_previewCache.end()) {
+			showPreview((*it).second);
+			return;
+		}
+		m_preview.start(*m_fparser, m_previewExpr, m_variables);
+		SetHardTimer("preview", &preview_timer, c_eval_poll);
+	}
+
+	/* errors are not shown while typing; neither is a value already shown,
+	   or anything while the answer box is covered */
+	void showPreview(const string& text) {
+		if(text.empty() || answerCovered())
+			return;
+		const vector<string>& shown = m_answerBox->getWords();
+		if(shown.size() == 1 && shown[0] == text)
+			return;
+
+		m_answerBox->words().clear();
+		m_answerBox->words().push_back(text);
+		m_answerBox->draw();
+		m_answerBox->asyncUpdate();
+	}
+
+	/* false if the input surely doesn't parse yet: empty, unbalanced
+	   parentheses, ending in an operator, or an assignment */
+	static bool isComplete(const vector<string>& words) {
+		if(words.empty())
 			return false;
+
+		int depth = 0;
+		for(unsigned i = 0; i < words.size(); i++) {
+			if(words[i].find(":=") != string::npos)
+				return false;
+			depth += std::count(words[i].begin(), words[i].end(), '(');
+			depth -= std::count(words[i].begin(), words[i].end(), ')');
+			if(depth < 0)
+				return false;
 		}
 
-		static std::ostringstream ost;
-		ost.clear();
-		ost.str("");
-		ost << result;
-		m_answerBox->words().push_back(ost.str());
-		m_variables[0] = result; //save result to 'ans' variable
+		const string& last = words.back();
+		return depth == 0 && !last.empty() &&
+		       string("+-*/^%,(=<>&|!").find(last[last.size() - 1]) == string::npos;
+	}
 
+	/* a scalar result is stored to 'ans' as with ordinary expressions */
+	void evalMatrixAndDisplay(const string& expression) {
+		m_answerBox->words().clear();
+		try {
+			Matrix result;
+			MatrixExpression(*m_fparser, m_variables).evaluate(expression, result);
+			MatrixExpression::format(result, m_numberFormat, m_answerBox->words());
+			if(result.isScalar())
+				m_variables[0] = result(0, 0);
+		}
+		catch(const string& errMsg) {
+			m_answerBox->words().push_back(errMsg);
+		}
+		m_answerBox->draw();
+		m_answerBox->asyncUpdate();
+	}
+
+	/* the result is stored to 'ans' rounded to a double; results too long
+	   for the answer box are shown by their leading digits */
+	void evalIntegerAndDisplay(const string& expression) {
+		const uint columns = (m_answerBox->getWidth() - 8) / FontMetrics::of(m_textboxFont).charWidth('#') - 1;
+
+		m_answerBox->words().clear();
+		m_answerBox->words().push_back(string());
+		string& word = m_answerBox->words().back();
+		try {
+			IntegerExpression(m_variables).evaluate(expression, std::max(columns, 20u), word);
+			m_variables[0] = std::strtod(word.c_str(), NULL);
+		}
+		catch(const string& errMsg) {
+			word = errMsg;
+		}
+		m_answerBox->draw();
+		m_answerBox->asyncUpdate();
+	}
+
+#ifdef FP_SUPPORT_GMP_RATIONAL_TYPE
+	/* fractions too long for the answer box are shown in decimal */
+	void evalFractionAndDisplay(const string& expression) {
+		const uint columns = (m_answerBox->getWidth() - 8) / FontMetrics::of(m_textboxFont).charWidth('#') - 1;
+
+		m_answerBox->words().clear();
+		m_answerBox->words().push_back(string());
+		string& word = m_answerBox->words().back();
+		try {
+			double value;
+			RationalExpression(m_variables, m_numberFormat).evaluate(expression, columns, word, value);
+			m_variables[0] = value;
+		}
+		catch(const string& errMsg) {
+			word = errMsg;
+		}
 		m_answerBox->draw();
 		m_answerBox->asyncUpdate();
-		return true;
 	}
+#endif
 
 	bool moveFocus(char dir) {
 		switch(dir) {
@@ -1711,6 +3426,28 @@ private:
 		return result;
 	}
 
+	/* FNV-1a hash of all the button layout depends on, besides its geometry */
+	static unsigned layoutKey() {
+		const ifont* font = Widget::getGlobalFont();
+		string data(font->name ? font->name : "");
+		std::ostringstream oss;
+		oss << ' ' << font->size << ' ' << ScreenWidth() << ' ' << ScreenHeight();
+		data += oss.str();
+		for(unsigned row = 0; row < CFG_GRID_ROWS; row++)
+			for(unsigned col = 0; col < CFG_GRID_COLS; col++) {
+				const button_func& f = functions[row][col];
+				data += f.name;
+				data += f.is_regular_button ? '\1' : '\2';
+			}
+
+		unsigned hash = 2166136261u;
+		for(unsigned i = 0; i < data.size(); i++) {
+			hash ^= (unsigned char) data[i];
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
 	void focusAndUpdate(Widget* w) {
 		if(w->getVisibility()) {
 			Widget::setFocus(w, true);
@@ -1751,25 +3488,51 @@ private:
 	static const uint c_menu_custom = 3;
 	static const uint c_menu_history = 4;
 	static const uint c_menu_help = 5;
+	static const uint c_menu_table = 8;
+	static const uint c_menu_matrix = 9;
+	static const uint c_menu_format = 10;
+	static const uint c_menu_integer = 11;
+	static const uint c_menu_fraction = 12;
 
 	static const uint c_menu_list_add = 5;
 	static const uint c_menu_list_remove = 6;
 	static const uint c_menu_list_edit = 7;
 
 	static const uint c_history_size = 20;
+	static const uint c_history_max_length = 1024;
+
+	static const int c_eval_poll = 50; /* ms between checks for the result */
+	static const int c_preview_delay = 500; /* ms, about one e-ink refresh */
+	static const unsigned c_preview_cache_size = 64;
 
 	static const char c_config[];
+	static const char c_layout[];
 	static const char c_help_msg[];
 	
 	unsigned m_focusedBtnRow;
 	unsigned m_focusedBtnCol;
 	double* m_variables;
 
+	Evaluation m_evaluation;
+	unsigned m_evalTarget; /* index in m_variables */
+	vector<string> m_evalHistory;
+	bool m_evalClearsInput;
+	unsigned m_evalTicks;
+
+	Evaluation m_preview;
+	string m_previewExpr;
+	std::map<string, string> m_previewCache; /* "" for errors */
+
 	TextView* m_helpView;
 	Menu* m_menu;
 	Menu* m_listMenu;
 	FullscreenList* m_exprList;
 	FullscreenList* m_historyList;
+	TableList* m_tableList;
+	string m_matrixExpr;
+	string m_integerExpr;
+	string m_fractionExpr;
+	NumberFormat m_numberFormat;
 	ifont* m_textboxFont;
 	GridLayout* m_buttonsLayout;
 	TextBox* m_inputBox;
@@ -1783,6 +3546,7 @@ private:
 };
 
 const char Application::c_config[] = CONFIGPATH "/ecalc.cfg";
+const char Application::c_layout[] = CONFIGPATH "/ecalc.layout";
 const char Application::c_help_msg[] =
 	"HELP (Press any key to exit)\n\n"
 	"MAIN SCREEN BUTTONS\n"
@@ -1801,6 +3565,20 @@ const char Application::c_help_msg[] =
 	"    * \" abs \" is absolute value function\n"
 	"    * \" ans \" inserts variable that holds previous answer\n"
 	"    * \" , \" is used as function parameters separator\n"
+	"    * \" integ \" integrates an expression of x:\n"
+	"                integrate(<EXPRESSION>,x,<FROM>,<TO>)\n"
+	"    * \" solve \" finds a root of an expression of x\n"
+	"                near the initial guess:\n"
+	"                solve(<EXPRESSION>,x,<GUESS>)\n"
+	"    * \" sum \", \" prod \" sum or multiply an expression\n"
+	"                of i for i = <FROM>, <FROM>+1, ..., <TO>:\n"
+	"                sum(<EXPRESSION>,i,<FROM>,<TO>)\n"
+	"    * \" [ \", \" ] \" enclose a list of numbers, e.g. [1,2,3].\n"
+	"                Lists can be used in arguments of \" mean \",\n"
+	"                \" var \" (sample variance), \" stdev \",\n"
+	"                \" median \", min and max, and are\n"
+	"                processed element by element:\n"
+	"                mean([1,2,3]^2), max([1,2]*[3,4])\n"
 	"    * \"a\",\"b\",\"c\",\"d\" preset variable names to use\n"
 	"                              with \":=\" operator\n"
 	"MENU ITEMS\n"
@@ -1810,6 +3588,27 @@ const char Application::c_help_msg[] =
 	"                        you can add, edit, and delete\n"
 	"                        them using popup menu\n"
 	"    * \"History\" - history of entered expressions\n"
+	"    * \"Table\" - table of values of f(x), enter it as\n"
+	"                  f(x); start; end; step\n"
+	"    * \"Matrix\" - evaluate a matrix expression, e.g.\n"
+	"                   inv([1,2;3,4]) * [5;6] or det([1,2;3,4]),\n"
+	"                   with +, -, *, ' (transpose), det, inv,\n"
+	"                   transpose and solve(A,B)\n"
+	"    * \"Integer\" - evaluate exactly in integers, with\n"
+	"                    + - * / % ^ (/ drops the fraction), abs,\n"
+	"                    min, max, if, sum and prod, e.g. 2^100,\n"
+	"                    prod(i,i,1,50) (50!) or\n"
+	"                    prod(i,i,41,50)/prod(i,i,1,10) (50 over 10)\n"
+	"    * \"Fraction\" - evaluate exactly in fractions, e.g.\n"
+	"                     1/3+1/6 gives 1/2 and sqrt(4/9) 2/3;\n"
+	"                     with pi, sin, log etc. the result is\n"
+	"                     approximate and shown in decimal;\n"
+	"                     user functions, deg and rad can't be\n"
+	"                     used there\n"
+	"    * \"Format\" - how answers are shown: auto (all digits\n"
+	"                   needed to identify the value), fix N\n"
+	"                   (N decimals), sci N or eng N (N significant\n"
+	"                   digits, exponent a multiple of 3 for eng)\n"
 	"    * \"Help\" - this help\n"
 	"    * \"Exit\" - guess what?\n";
 	
@@ -1817,6 +3616,14 @@ const char Application::c_help_msg[] =
 
 Application* app = NULL;
 
+void evaluation_timer() {
+	app->onEvaluationTimer();
+}
+
+void preview_timer() {
+	app->onPreviewTimer();
+}
+
 int global_event_handler(int type, int param1, int param2) {
 	switch(type) {
 		case EVT_INIT:
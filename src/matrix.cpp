@@ -0,0 +1,261 @@
+#include <cmath>
+#include <algorithm>
+#include "matrix.h"
+
+using std::string;
+using std::vector;
+
+Matrix::Matrix() {
+	m_rows = 0;
+	m_cols = 0;
+}
+
+Matrix::Matrix(unsigned rows, unsigned cols) {
+	assign(rows, cols);
+}
+
+void Matrix::assign(unsigned rows, unsigned cols) {
+	m_rows = rows;
+	m_cols = cols;
+	m_data.assign(rows * cols, 0.0);
+}
+
+/* C += A * B for one tile, in 4x4 blocks held in registers. Each block
+   loads 4 elements of A and 4 of B per step of k for 16 multiply-adds. */
+static void multiplyTile(const Matrix& a, const Matrix& b, Matrix& c,
+                         unsigned i0, unsigned i1, unsigned j0, unsigned j1,
+                         unsigned k0, unsigned k1) {
+	unsigned i = i0;
+	for(; i + 4 <= i1; i += 4) {
+		const double* a0 = a.row(i);
+		const double* a1 = a.row(i + 1);
+		const double* a2 = a.row(i + 2);
+		const double* a3 = a.row(i + 3);
+
+		unsigned j = j0;
+		for(; j + 4 <= j1; j += 4) {
+			double c00 = 0, c01 = 0, c02 = 0, c03 = 0;
+			double c10 = 0, c11 = 0, c12 = 0, c13 = 0;
+			double c20 = 0, c21 = 0, c22 = 0, c23 = 0;
+			double c30 = 0, c31 = 0, c32 = 0, c33 = 0;
+
+			for(unsigned k = k0; k < k1; k++) {
+				const double* bk = b.row(k) + j;
+				const double b0 = bk[0], b1 = bk[1], b2 = bk[2], b3 = bk[3];
+				const double x0 = a0[k], x1 = a1[k], x2 = a2[k], x3 = a3[k];
+
+				c00 += x0 * b0; c01 += x0 * b1; c02 += x0 * b2; c03 += x0 * b3;
+				c10 += x1 * b0; c11 += x1 * b1; c12 += x1 * b2; c13 += x1 * b3;
+				c20 += x2 * b0; c21 += x2 * b1; c22 += x2 * b2; c23 += x2 * b3;
+				c30 += x3 * b0; c31 += x3 * b1; c32 += x3 * b2; c33 += x3 * b3;
+			}
+
+			double* r = c.row(i) + j;
+			r[0] += c00; r[1] += c01; r[2] += c02; r[3] += c03;
+			r = c.row(i + 1) + j;
+			r[0] += c10; r[1] += c11; r[2] += c12; r[3] += c13;
+			r = c.row(i + 2) + j;
+			r[0] += c20; r[1] += c21; r[2] += c22; r[3] += c23;
+			r = c.row(i + 3) + j;
+			r[0] += c30; r[1] += c31; r[2] += c32; r[3] += c33;
+		}
+
+		/* remaining columns */
+		for(; j < j1; j++)
+			for(unsigned k = k0; k < k1; k++) {
+				const double bkj = b(k, j);
+				c(i, j) += a0[k] * bkj;
+				c(i + 1, j) += a1[k] * bkj;
+				c(i + 2, j) += a2[k] * bkj;
+				c(i + 3, j) += a3[k] * bkj;
+			}
+	}
+
+	/* remaining rows */
+	for(; i < i1; i++) {
+		double* ci = c.row(i);
+		const double* ai = a.row(i);
+		for(unsigned k = k0; k < k1; k++) {
+			const double aik = ai[k];
+			const double* bk = b.row(k);
+			for(unsigned j = j0; j < j1; j++)
+				ci[j] += aik * bk[j];
+		}
+	}
+}
+
+void Matrix::multiply(const Matrix& a, const Matrix& b, Matrix& result) {
+	if(a.m_cols != b.m_rows)
+		throw string("Matrix dimensions don't match");
+
+	result.assign(a.m_rows, b.m_cols);
+	for(unsigned k0 = 0; k0 < a.m_cols; k0 += c_block) {
+		const unsigned k1 = std::min(k0 + c_block, a.m_cols);
+		for(unsigned i0 = 0; i0 < a.m_rows; i0 += c_block) {
+			const unsigned i1 = std::min(i0 + c_block, a.m_rows);
+			for(unsigned j0 = 0; j0 < b.m_cols; j0 += c_block)
+				multiplyTile(a, b, result, i0, i1, j0, std::min(j0 + c_block, b.m_cols), k0, k1);
+		}
+	}
+}
+
+void Matrix::add(const Matrix& a, const Matrix& b, double factor, Matrix& result) {
+	if(a.m_rows != b.m_rows || a.m_cols != b.m_cols)
+		throw string("Matrix dimensions don't match");
+
+	result.m_rows = a.m_rows;
+	result.m_cols = a.m_cols;
+	result.m_data.resize(a.m_data.size());
+	const double* x = a.m_data.empty() ? 0 : &a.m_data[0];
+	const double* y = b.m_data.empty() ? 0 : &b.m_data[0];
+	double* r = result.m_data.empty() ? 0 : &result.m_data[0];
+	for(unsigned i = 0; i < a.m_data.size(); i++)
+		r[i] = x[i] + factor * y[i];
+}
+
+void Matrix::scale(const Matrix& a, double factor, Matrix& result) {
+	result.m_rows = a.m_rows;
+	result.m_cols = a.m_cols;
+	result.m_data.resize(a.m_data.size());
+	for(unsigned i = 0; i < a.m_data.size(); i++)
+		result.m_data[i] = factor * a.m_data[i];
+}
+
+void Matrix::transpose(const Matrix& a, Matrix& result) {
+	result.assign(a.m_cols, a.m_rows);
+	/* tiles keep both the rows read and the rows written in cache */
+	for(unsigned i0 = 0; i0 < a.m_rows; i0 += c_block) {
+		const unsigned i1 = std::min(i0 + c_block, a.m_rows);
+		for(unsigned j0 = 0; j0 < a.m_cols; j0 += c_block) {
+			const unsigned j1 = std::min(j0 + c_block, a.m_cols);
+			for(unsigned i = i0; i < i1; i++) {
+				const double* ai = a.row(i);
+				for(unsigned j = j0; j < j1; j++)
+					result(j, i) = ai[j];
+			}
+		}
+	}
+}
+
+void Matrix::requireSquare(const Matrix& a, const char* operation) {
+	if(a.m_rows != a.m_cols || a.m_rows == 0)
+		throw string(operation) + " requires a square matrix";
+}
+
+bool Matrix::decompose(Matrix& lu, vector<unsigned>& pivots, int& sign) {
+	const unsigned n = lu.m_rows;
+	pivots.resize(n);
+	sign = 1;
+
+	for(unsigned k = 0; k < n; k++) {
+		unsigned p = k;
+		double max = std::fabs(lu(k, k));
+		for(unsigned i = k + 1; i < n; i++)
+			if(std::fabs(lu(i, k)) > max) {
+				max = std::fabs(lu(i, k));
+				p = i;
+			}
+
+		pivots[k] = p;
+		if(max == 0.0)
+			return false;
+
+		if(p != k) {
+			std::swap_ranges(lu.row(k), lu.row(k) + n, lu.row(p));
+			sign = -sign;
+		}
+
+		/* rank-1 update of the trailing submatrix, one contiguous row at a time */
+		const double* uk = lu.row(k);
+		const double inv = 1.0 / uk[k];
+		for(unsigned i = k + 1; i < n; i++) {
+			double* ui = lu.row(i);
+			const double l = ui[k] * inv;
+			ui[k] = l;
+			for(unsigned j = k + 1; j < n; j++)
+				ui[j] -= l * uk[j];
+		}
+	}
+	return true;
+}
+
+void Matrix::substitute(const Matrix& lu, const vector<unsigned>& pivots, Matrix& b) {
+	const unsigned n = lu.m_rows;
+	const unsigned m = b.m_cols;
+
+	for(unsigned k = 0; k < n; k++)
+		if(pivots[k] != k)
+			std::swap_ranges(b.row(k), b.row(k) + m, b.row(pivots[k]));
+
+	/* forward substitution with unit lower triangle, whole rows of b at once */
+	for(unsigned i = 1; i < n; i++) {
+		double* bi = b.row(i);
+		const double* li = lu.row(i);
+		for(unsigned k = 0; k < i; k++) {
+			const double l = li[k];
+			const double* bk = b.row(k);
+			for(unsigned j = 0; j < m; j++)
+				bi[j] -= l * bk[j];
+		}
+	}
+
+	/* back substitution */
+	for(unsigned i = n; i-- > 0; ) {
+		double* bi = b.row(i);
+		const double* ui = lu.row(i);
+		for(unsigned k = i + 1; k < n; k++) {
+			const double u = ui[k];
+			const double* bk = b.row(k);
+			for(unsigned j = 0; j < m; j++)
+				bi[j] -= u * bk[j];
+		}
+		const double inv = 1.0 / ui[i];
+		for(unsigned j = 0; j < m; j++)
+			bi[j] *= inv;
+	}
+}
+
+double Matrix::det(const Matrix& a) {
+	requireSquare(a, "det");
+
+	Matrix lu = a;
+	vector<unsigned> pivots;
+	int sign;
+	if(!decompose(lu, pivots, sign))
+		return 0.0;
+
+	double result = sign;
+	for(unsigned i = 0; i < lu.m_rows; i++)
+		result *= lu(i, i);
+	return result;
+}
+
+void Matrix::inverse(const Matrix& a, Matrix& result) {
+	requireSquare(a, "inv");
+
+	Matrix lu = a;
+	vector<unsigned> pivots;
+	int sign;
+	if(!decompose(lu, pivots, sign))
+		throw string("Matrix is singular");
+
+	result.assign(a.m_rows, a.m_rows);
+	for(unsigned i = 0; i < a.m_rows; i++)
+		result(i, i) = 1.0;
+	substitute(lu, pivots, result);
+}
+
+void Matrix::solve(const Matrix& a, const Matrix& b, Matrix& result) {
+	requireSquare(a, "solve");
+	if(b.m_rows != a.m_rows)
+		throw string("Matrix dimensions don't match");
+
+	Matrix lu = a;
+	vector<unsigned> pivots;
+	int sign;
+	if(!decompose(lu, pivots, sign))
+		throw string("Matrix is singular");
+
+	result = b;
+	substitute(lu, pivots, result);
+}
@@ -0,0 +1,83 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+#include <vector>
+#include <string>
+
+/* Dense matrix of doubles stored row by row in one contiguous buffer.
+   Operations that produce a matrix write into a caller-supplied one, so
+   the kernels themselves don't allocate; errors are thrown as strings. */
+class Matrix {
+public:
+	Matrix();
+	Matrix(unsigned rows, unsigned cols);
+
+	/* resizes the matrix and sets all elements to zero */
+	void assign(unsigned rows, unsigned cols);
+
+	unsigned rows() const {
+		return m_rows;
+	}
+
+	unsigned cols() const {
+		return m_cols;
+	}
+
+	bool isScalar() const {
+		return m_rows == 1 && m_cols == 1;
+	}
+
+	double* row(unsigned r) {
+		return &m_data[r * m_cols];
+	}
+
+	const double* row(unsigned r) const {
+		return &m_data[r * m_cols];
+	}
+
+	double& operator()(unsigned r, unsigned c) {
+		return m_data[r * m_cols + c];
+	}
+
+	double operator()(unsigned r, unsigned c) const {
+		return m_data[r * m_cols + c];
+	}
+
+	/* result = a * b (result must not be a or b) */
+	static void multiply(const Matrix& a, const Matrix& b, Matrix& result);
+
+	/* result = a + factor * b */
+	static void add(const Matrix& a, const Matrix& b, double factor, Matrix& result);
+
+	/* result = factor * a */
+	static void scale(const Matrix& a, double factor, Matrix& result);
+
+	/* result = a^T (result must not be a) */
+	static void transpose(const Matrix& a, Matrix& result);
+
+	static double det(const Matrix& a);
+
+	/* result = a^-1 */
+	static void inverse(const Matrix& a, Matrix& result);
+
+	/* solves a * result = b */
+	static void solve(const Matrix& a, const Matrix& b, Matrix& result);
+
+private:
+	/* tile size of the blocked kernels (three tiles fit in L1 cache) */
+	static const unsigned c_block = 48;
+
+	/* In-place LU decomposition with partial pivoting: PA = LU, where L has
+	   an implicit unit diagonal. Returns false if the matrix is singular. */
+	static bool decompose(Matrix& lu, std::vector<unsigned>& pivots, int& sign);
+
+	/* solves LU x = Pb for all columns of b, in place */
+	static void substitute(const Matrix& lu, const std::vector<unsigned>& pivots, Matrix& b);
+
+	static void requireSquare(const Matrix& a, const char* operation);
+
+	unsigned m_rows;
+	unsigned m_cols;
+	std::vector<double> m_data;
+};
+
+#endif
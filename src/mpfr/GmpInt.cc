@@ -1,9 +1,13 @@
 #include "GmpInt.hh"
 #include <gmp.h>
+#include <pthread.h>
 #include <deque>
 #include <vector>
 #include <cstring>
+#include <cstdio>
 #include <cctype>
+#include <climits>
+#include <cmath>
 
 //===========================================================================
 // Shared data
@@ -12,11 +16,12 @@ namespace
 {
     unsigned long gIntDefaultNumberOfBits = 256;
 
-    std::vector<char>& intString()
-    {
-        static std::vector<char> str;
-        return str;
-    }
+    // Doubles strictly inside (-kLongRange, kLongRange) convert to a long.
+    const double kLongRange = -double(LONG_MIN);
+
+    pthread_mutex_t gContainerMutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_once_t gContainerKeyOnce = PTHREAD_ONCE_INIT;
+    pthread_key_t gContainerKey;
 }
 
 //===========================================================================
@@ -26,39 +31,108 @@ struct GmpInt::GmpIntData
 {
     unsigned mRefCount;
     GmpIntData* nextFreeNode;
+    GmpIntDataContainer* mOwner;
     mpz_t mInteger;
 
-    GmpIntData(): mRefCount(1), nextFreeNode(0) {}
+    GmpIntData(GmpIntDataContainer* owner):
+        mRefCount(1), nextFreeNode(0), mOwner(owner) {}
+
+    // Copies of a value may live in different threads, so the reference
+    // count is the one field of a node that is updated atomically.
+    void addReference()
+    { __atomic_add_fetch(&mRefCount, 1, __ATOMIC_RELAXED); }
+    bool removeReference()
+    { return __atomic_sub_fetch(&mRefCount, 1, __ATOMIC_ACQ_REL) == 0; }
+    bool isShared() const
+    { return __atomic_load_n(&mRefCount, __ATOMIC_ACQUIRE) > 1; }
 };
 
+/* One container per thread, with the same scheme as the MpfrFloat ones:
+   nodes released by other threads go onto a lock-free remote free list
+   that the owner takes over when its own free list is empty, and the
+   containers of exited threads are parked for reuse rather than destroyed.
+*/
 class GmpInt::GmpIntDataContainer
 {
     std::deque<GmpInt::GmpIntData> mData;
     GmpInt::GmpIntData* mFirstFreeNode;
-    GmpInt::GmpIntData* mConst_0;
+    GmpInt::GmpIntData* mRemoteFreeNodes;
+    GmpIntDataContainer* mNextIdleContainer;
+    std::vector<char> mStringBuffer;
+
+    static __thread GmpIntDataContainer* sThreadContainer;
+    static GmpIntDataContainer* sIdleContainers;
+
+    void pushRemoteFreeNode(GmpIntData* data)
+    {
+        GmpIntData* head = __atomic_load_n(&mRemoteFreeNodes, __ATOMIC_RELAXED);
+        do data->nextFreeNode = head;
+        while(!__atomic_compare_exchange_n(&mRemoteFreeNodes, &head, data, true,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    static void createContainerKey()
+    {
+        pthread_key_create(&gContainerKey, &GmpIntDataContainer::park);
+    }
+
+    // Called on thread exit with the container of that thread.
+    static void park(void* data)
+    {
+        GmpIntDataContainer* container = static_cast<GmpIntDataContainer*>(data);
+        sThreadContainer = 0;
+
+        pthread_mutex_lock(&gContainerMutex);
+        container->mNextIdleContainer = sIdleContainers;
+        sIdleContainers = container;
+        pthread_mutex_unlock(&gContainerMutex);
+    }
 
  public:
-    GmpIntDataContainer(): mFirstFreeNode(0), mConst_0(0) {}
+    GmpIntDataContainer():
+        mFirstFreeNode(0), mRemoteFreeNodes(0), mNextIdleContainer(0)
+    {}
+
+    static GmpIntDataContainer& current()
+    {
+        GmpIntDataContainer* container = sThreadContainer;
+        return container ? *container : acquire();
+    }
 
-    ~GmpIntDataContainer()
+    static GmpIntDataContainer& acquire()
     {
-        for(size_t i = 0; i < mData.size(); ++i)
-            mpz_clear(mData[i].mInteger);
+        pthread_once(&gContainerKeyOnce, &GmpIntDataContainer::createContainerKey);
+
+        pthread_mutex_lock(&gContainerMutex);
+        GmpIntDataContainer* container = sIdleContainers;
+        if(container) sIdleContainers = container->mNextIdleContainer;
+        pthread_mutex_unlock(&gContainerMutex);
+
+        if(!container) container = new GmpIntDataContainer;
+        container->mNextIdleContainer = 0;
+        sThreadContainer = container;
+        pthread_setspecific(gContainerKey, container);
+        return *container;
     }
 
     GmpInt::GmpIntData* allocateGmpIntData(unsigned long numberOfBits,
                                            bool initToZero)
     {
+        if(!mFirstFreeNode
+        && __atomic_load_n(&mRemoteFreeNodes, __ATOMIC_RELAXED))
+            mFirstFreeNode = __atomic_exchange_n(&mRemoteFreeNodes, (GmpIntData*)0,
+                                                 __ATOMIC_ACQUIRE);
+
         if(mFirstFreeNode)
         {
             GmpInt::GmpIntData* node = mFirstFreeNode;
             mFirstFreeNode = node->nextFreeNode;
             if(initToZero) mpz_set_si(node->mInteger, 0);
-            ++(node->mRefCount);
+            node->mRefCount = 1;
             return node;
         }
 
-        mData.push_back(GmpInt::GmpIntData());
+        mData.push_back(GmpInt::GmpIntData(this));
         if(numberOfBits > 0)
             mpz_init2(mData.back().mInteger, numberOfBits);
         else
@@ -68,26 +142,35 @@ class GmpInt::GmpIntDataContainer
 
     void releaseGmpIntData(GmpIntData* data)
     {
-        if(--(data->mRefCount) == 0)
+        if(data->removeReference())
         {
-            data->nextFreeNode = mFirstFreeNode;
-            mFirstFreeNode = data;
+            if(data->mOwner == this)
+            {
+                data->nextFreeNode = mFirstFreeNode;
+                mFirstFreeNode = data;
+            }
+            else
+                data->mOwner->pushRemoteFreeNode(data);
         }
     }
 
-    GmpInt::GmpIntData* const_0()
+    std::vector<char>& stringBuffer()
     {
-        if(!mConst_0)
-            mConst_0 = allocateGmpIntData(gIntDefaultNumberOfBits, true);
-        return mConst_0;
+        return mStringBuffer;
     }
 };
 
+__thread GmpInt::GmpIntDataContainer*
+GmpInt::GmpIntDataContainer::sThreadContainer = 0;
+
+GmpInt::GmpIntDataContainer* GmpInt::GmpIntDataContainer::sIdleContainers = 0;
 
+
+// The containers are never destroyed, so GmpInt instances can be created and
+// destroyed at any time, also after the thread that created them has exited.
 GmpInt::GmpIntDataContainer& GmpInt::gmpIntDataContainer()
 {
-    static GmpIntDataContainer container;
-    return container;
+    return GmpIntDataContainer::current();
 }
 
 //===========================================================================
@@ -103,15 +186,65 @@ unsigned long GmpInt::getDefaultNumberOfBits()
     return gIntDefaultNumberOfBits;
 }
 
+/* Read-only mpz view of a GmpInt. An inline value is viewed through a
+   local limb, so mixing small and big operands doesn't allocate. */
+struct GmpInt::MpzView
+{
+    mp_limb_t mLimb;
+    mpz_t mValue;
+    mpz_srcptr mPtr;
+
+    MpzView(const GmpInt& value)
+    {
+        if(value.mData)
+            mPtr = value.mData->mInteger;
+        else
+        {
+            const long small = value.mSmall;
+            mLimb = small < 0 ? 0UL - (unsigned long)(small)
+                              : (unsigned long)(small);
+            mPtr = mpz_roinit_n(mValue, &mLimb,
+                                small < 0 ? -1 : small > 0 ? 1 : 0);
+        }
+    }
+
+    operator mpz_srcptr() const { return mPtr; }
+};
+
+/* Makes mData a node of this object's own that holds the current value,
+   moving an inline value to mpz if needed. */
 inline void GmpInt::copyIfShared()
 {
-    if(mData->mRefCount > 1)
+    if(!mData)
+    {
+        mData = gmpIntDataContainer().allocateGmpIntData
+            (gIntDefaultNumberOfBits, false);
+        mpz_set_si(mData->mInteger, mSmall);
+    }
+    else if(mData->isShared())
     {
-        --(mData->mRefCount);
         GmpIntData* oldData = mData;
         mData = gmpIntDataContainer().allocateGmpIntData(0, false);
         mpz_set(mData->mInteger, oldData->mInteger);
+        gmpIntDataContainer().releaseGmpIntData(oldData);
+    }
+}
+
+/* Moves the value back inline if it fits in a long. */
+inline void GmpInt::normalize()
+{
+    if(mData && mpz_fits_slong_p(mData->mInteger))
+        setSmall(mpz_get_si(mData->mInteger));
+}
+
+inline void GmpInt::setSmall(long value)
+{
+    if(mData)
+    {
+        gmpIntDataContainer().releaseGmpIntData(mData);
+        mData = 0;
     }
+    mSmall = value;
 }
 
 
@@ -119,68 +252,31 @@ inline void GmpInt::copyIfShared()
 // Constructors, destructor, assignment
 //===========================================================================
 GmpInt::GmpInt(DummyType):
-    mData(gmpIntDataContainer().allocateGmpIntData(0, false))
+    mData(gmpIntDataContainer().allocateGmpIntData(0, false)), mSmall(0)
 {}
 
-GmpInt::GmpInt()
-{
-    mData = gmpIntDataContainer().const_0();
-    ++(mData->mRefCount);
-}
+GmpInt::GmpInt(): mData(0), mSmall(0) {}
 
-GmpInt::GmpInt(long value)
-{
-    if(value == 0)
-    {
-        mData = gmpIntDataContainer().const_0();
-        ++(mData->mRefCount);
-    }
-    else
-    {
-        mData = gmpIntDataContainer().allocateGmpIntData
-            (gIntDefaultNumberOfBits, false);
-        mpz_set_si(mData->mInteger, value);
-    }
-}
+GmpInt::GmpInt(long value): mData(0), mSmall(value) {}
 
-GmpInt::GmpInt(unsigned long value)
-{
-    if(value == 0)
-    {
-        mData = gmpIntDataContainer().const_0();
-        ++(mData->mRefCount);
-    }
-    else
-    {
-        mData = gmpIntDataContainer().allocateGmpIntData
-            (gIntDefaultNumberOfBits, false);
-        mpz_set_ui(mData->mInteger, value);
-    }
-}
+GmpInt::GmpInt(int value): mData(0), mSmall(value) {}
 
-GmpInt::GmpInt(int value)
+GmpInt::GmpInt(unsigned long value): mData(0), mSmall(0)
 {
-    if(value == 0)
-    {
-        mData = gmpIntDataContainer().const_0();
-        ++(mData->mRefCount);
-    }
+    if(value <= (unsigned long)(LONG_MAX))
+        mSmall = long(value);
     else
     {
         mData = gmpIntDataContainer().allocateGmpIntData
             (gIntDefaultNumberOfBits, false);
-        mpz_set_si(mData->mInteger, value);
+        mpz_set_ui(mData->mInteger, value);
     }
 }
 
-GmpInt::GmpInt(double value)
+GmpInt::GmpInt(double value): mData(0), mSmall(0)
 {
-    const double absValue = value >= 0.0 ? value : -value;
-    if(absValue < 1.0)
-    {
-        mData = gmpIntDataContainer().const_0();
-        ++(mData->mRefCount);
-    }
+    if(value > -kLongRange && value < kLongRange)
+        mSmall = long(value);
     else
     {
         mData = gmpIntDataContainer().allocateGmpIntData
@@ -189,14 +285,10 @@ GmpInt::GmpInt(double value)
     }
 }
 
-GmpInt::GmpInt(long double value)
+GmpInt::GmpInt(long double value): mData(0), mSmall(0)
 {
-    const long double absValue = value >= 0.0L ? value : -value;
-    if(absValue < 1.0L)
-    {
-        mData = gmpIntDataContainer().const_0();
-        ++(mData->mRefCount);
-    }
+    if(value > -kLongRange && value < kLongRange)
+        mSmall = long(value);
     else
     {
         mData = gmpIntDataContainer().allocateGmpIntData
@@ -206,46 +298,32 @@ GmpInt::GmpInt(long double value)
 }
 
 GmpInt::GmpInt(const GmpInt& rhs):
-    mData(rhs.mData)
+    mData(rhs.mData), mSmall(rhs.mSmall)
 {
-    ++(mData->mRefCount);
+    if(mData) mData->addReference();
 }
 
 GmpInt& GmpInt::operator=(const GmpInt& rhs)
 {
     if(mData != rhs.mData)
     {
-        gmpIntDataContainer().releaseGmpIntData(mData);
+        if(mData) gmpIntDataContainer().releaseGmpIntData(mData);
         mData = rhs.mData;
-        ++(mData->mRefCount);
+        if(mData) mData->addReference();
     }
+    mSmall = rhs.mSmall;
     return *this;
 }
 
 GmpInt& GmpInt::operator=(signed long value)
 {
-    if(value == 0)
-    {
-        gmpIntDataContainer().releaseGmpIntData(mData);
-        mData = gmpIntDataContainer().const_0();
-        ++(mData->mRefCount);
-    }
-    else
-    {
-        if(mData->mRefCount > 1)
-        {
-            --(mData->mRefCount);
-            mData = gmpIntDataContainer().allocateGmpIntData
-                (gIntDefaultNumberOfBits, false);
-        }
-        mpz_set_si(mData->mInteger, value);
-    }
+    setSmall(value);
     return *this;
 }
 
 GmpInt::~GmpInt()
 {
-    gmpIntDataContainer().releaseGmpIntData(mData);
+    if(mData) gmpIntDataContainer().releaseGmpIntData(mData);
 }
 
 
@@ -255,18 +333,166 @@ GmpInt::~GmpInt()
 template<>
 void GmpInt::get_raw_mpfr_data<mpz_t>(mpz_t& dest_mpz_t)
 {
+    if(!mData) copyIfShared();
     std::memcpy(&dest_mpz_t, mData->mInteger, sizeof(mpz_t));
 }
 
+template<>
+void GmpInt::set_raw_mpz_data<mpz_t>(const mpz_t& src_mpz_t)
+{
+    if(mpz_fits_slong_p(src_mpz_t))
+        setSmall(mpz_get_si(src_mpz_t));
+    else
+    {
+        if(mData && mData->isShared())
+        {
+            gmpIntDataContainer().releaseGmpIntData(mData);
+            mData = 0;
+        }
+        if(!mData)
+            mData = gmpIntDataContainer().allocateGmpIntData(0, false);
+        mpz_set(mData->mInteger, src_mpz_t);
+    }
+}
+
 const char* GmpInt::getAsString(int base) const
 {
-    intString().resize(mpz_sizeinbase(mData->mInteger, base) + 2);
-    return mpz_get_str(&intString()[0], base, mData->mInteger);
+    std::vector<char>& str = gmpIntDataContainer().stringBuffer();
+    str.resize(getAsStringBufferSize(base));
+    getAsString(&str[0], str.size(), base);
+    return &str[0];
+}
+
+namespace
+{
+    unsigned long magnitudeOf(long value)
+    {
+        return value < 0 ? 0UL - (unsigned long)(value) : (unsigned long)(value);
+    }
+
+    std::size_t numberOfDigits(unsigned long magnitude, int base)
+    {
+        std::size_t digits = 1;
+        while(magnitude >= (unsigned long)(base))
+        {
+            magnitude /= base;
+            ++digits;
+        }
+        return digits;
+    }
+}
+
+std::size_t GmpInt::getAsStringBufferSize(int base) const
+{
+    if(mData) return mpz_sizeinbase(mData->mInteger, base) + 2;
+    return numberOfDigits(magnitudeOf(mSmall), base) + 2;
+}
+
+std::size_t GmpInt::getAsString(char* buffer, std::size_t bufferSize,
+                                int base) const
+{
+    if(bufferSize < getAsStringBufferSize(base)) return 0;
+
+    if(mData)
+    {
+        mpz_get_str(buffer, base, mData->mInteger);
+        return std::strlen(buffer);
+    }
+
+    // Digits of an inline value, written backwards from their last position.
+    unsigned long magnitude = magnitudeOf(mSmall);
+    const std::size_t length =
+        numberOfDigits(magnitude, base) + (mSmall < 0 ? 1 : 0);
+    char* ptr = buffer + length;
+    *ptr = 0;
+    do
+    {
+        *--ptr = "0123456789abcdefghijklmnopqrstuvwxyz"[magnitude % base];
+        magnitude /= base;
+    } while(magnitude);
+    if(mSmall < 0) *--ptr = '-';
+    return length;
+}
+
+void GmpInt::getAsString(std::string& dest, int base) const
+{
+    dest.resize(getAsStringBufferSize(base));
+    dest.resize(getAsString(&dest[0], dest.size(), base));
+}
+
+std::size_t GmpInt::getLeadingDigitsBufferSize(unsigned digits)
+{
+    // Sign, decimal point, exponent and terminating null fit in 30 chars.
+    return std::size_t(digits) + 30;
+}
+
+std::size_t GmpInt::getLeadingDigits(unsigned digits, char* buffer,
+                                     std::size_t bufferSize) const
+{
+    if(digits == 0) digits = 1;
+    if(bufferSize < getLeadingDigitsBufferSize(digits)) return 0;
+
+    // The digit count given by mpz_sizeinbase() is exact or one too large.
+    const std::size_t maxDigits = getAsStringBufferSize(10) - 2;
+    if(maxDigits <= digits) return getAsString(buffer, bufferSize);
+
+    // Get the leading digits by dividing away the others, which is much
+    // cheaper than converting the whole value.
+    std::size_t droppedDigits = maxDigits - digits;
+    GmpInt leading(kNoInitialization);
+    {
+        GmpInt divisor(kNoInitialization);
+        mpz_ui_pow_ui(divisor.mData->mInteger, 10, droppedDigits);
+        mpz_tdiv_q(leading.mData->mInteger, MpzView(*this),
+                   divisor.mData->mInteger);
+    }
+    if(mpz_sizeinbase(leading.mData->mInteger, 10) < digits)
+    {
+        // One digit short because maxDigits was one too large.
+        GmpInt divisor(kNoInitialization);
+        mpz_ui_pow_ui(divisor.mData->mInteger, 10, --droppedDigits);
+        mpz_tdiv_q(leading.mData->mInteger, MpzView(*this),
+                   divisor.mData->mInteger);
+    }
+    leading.normalize();
+
+    std::size_t length = 0;
+    if(leading < 0)
+    {
+        buffer[length++] = '-';
+        leading.negate();
+    }
+
+    // Write the digits as d.ddd with trailing zeros removed, like printf's
+    // %g does.
+    char* const mantissa = buffer + length;
+    std::size_t mantissaLength = leading.getAsString(mantissa, digits + 2);
+    const long exponent = long(droppedDigits + mantissaLength) - 1;
+    while(mantissaLength > 1 && mantissa[mantissaLength-1] == '0')
+        --mantissaLength;
+    if(mantissaLength > 1)
+    {
+        std::memmove(mantissa + 2, mantissa + 1, mantissaLength - 1);
+        mantissa[1] = '.';
+        ++mantissaLength;
+    }
+    length += mantissaLength;
+    length += std::sprintf(buffer + length, "e+%ld", exponent);
+    return length;
 }
 
 long GmpInt::toInt() const
 {
-    return mpz_get_si(mData->mInteger);
+    return mData ? mpz_get_si(mData->mInteger) : mSmall;
+}
+
+unsigned long GmpInt::numberOfBits() const
+{
+    if(mData) return mpz_sizeinbase(mData->mInteger, 2);
+
+    const unsigned long magnitude =
+        mSmall < 0 ? 0UL - (unsigned long)(mSmall) : (unsigned long)(mSmall);
+    return magnitude ? sizeof(long) * 8 - __builtin_clzl(magnitude) : 0;
 }
 
 
@@ -275,116 +501,138 @@ long GmpInt::toInt() const
 //===========================================================================
 GmpInt& GmpInt::operator+=(const GmpInt& rhs)
 {
+    long sum;
+    if(!mData && !rhs.mData
+    && !__builtin_add_overflow(mSmall, rhs.mSmall, &sum))
+    {
+        mSmall = sum;
+        return *this;
+    }
+
+    const MpzView value(rhs);
     copyIfShared();
-    mpz_add(mData->mInteger, mData->mInteger, rhs.mData->mInteger);
+    mpz_add(mData->mInteger, mData->mInteger, value);
+    normalize();
     return *this;
 }
 
 GmpInt& GmpInt::operator+=(long value)
 {
-    copyIfShared();
-    if(value >= 0)
-        mpz_add_ui(mData->mInteger, mData->mInteger, value);
-    else
-        mpz_sub_ui(mData->mInteger, mData->mInteger, -value);
-    return *this;
+    return operator+=(GmpInt(value));
 }
 
 GmpInt& GmpInt::operator-=(const GmpInt& rhs)
 {
+    long difference;
+    if(!mData && !rhs.mData
+    && !__builtin_sub_overflow(mSmall, rhs.mSmall, &difference))
+    {
+        mSmall = difference;
+        return *this;
+    }
+
+    const MpzView value(rhs);
     copyIfShared();
-    mpz_sub(mData->mInteger, mData->mInteger, rhs.mData->mInteger);
+    mpz_sub(mData->mInteger, mData->mInteger, value);
+    normalize();
     return *this;
 }
 
 GmpInt& GmpInt::operator-=(long value)
 {
-    copyIfShared();
-    if(value >= 0)
-        mpz_sub_ui(mData->mInteger, mData->mInteger, value);
-    else
-        mpz_add_ui(mData->mInteger, mData->mInteger, -value);
-    return *this;
+    return operator-=(GmpInt(value));
 }
 
 GmpInt& GmpInt::operator*=(const GmpInt& rhs)
 {
+    long product;
+    if(!mData && !rhs.mData
+    && !__builtin_mul_overflow(mSmall, rhs.mSmall, &product))
+    {
+        mSmall = product;
+        return *this;
+    }
+
+    const MpzView value(rhs);
     copyIfShared();
-    mpz_mul(mData->mInteger, mData->mInteger, rhs.mData->mInteger);
+    mpz_mul(mData->mInteger, mData->mInteger, value);
+    normalize();
     return *this;
 }
 
 GmpInt& GmpInt::operator*=(long value)
 {
-    copyIfShared();
-    mpz_mul_si(mData->mInteger, mData->mInteger, value);
-    return *this;
+    return operator*=(GmpInt(value));
 }
 
 GmpInt& GmpInt::operator/=(const GmpInt& rhs)
 {
+    if(!mData && !rhs.mData && !(mSmall == LONG_MIN && rhs.mSmall == -1))
+    {
+        mSmall /= rhs.mSmall;
+        return *this;
+    }
+
+    const MpzView value(rhs);
     copyIfShared();
-    mpz_tdiv_q(mData->mInteger, mData->mInteger, rhs.mData->mInteger);
+    mpz_tdiv_q(mData->mInteger, mData->mInteger, value);
+    normalize();
     return *this;
 }
 
 GmpInt& GmpInt::operator/=(long value)
 {
-    copyIfShared();
-    if(value >= 0)
-        mpz_tdiv_q_ui(mData->mInteger, mData->mInteger, value);
-    else
-    {
-        mpz_neg(mData->mInteger, mData->mInteger);
-        mpz_tdiv_q_ui(mData->mInteger, mData->mInteger, -value);
-    }
-    return *this;
+    return operator/=(GmpInt(value));
 }
 
+// The remainder takes the sign of the dividend, as with the C++ operator.
 GmpInt& GmpInt::operator%=(const GmpInt& rhs)
 {
-    copyIfShared();
-    if(operator<(0))
+    if(!mData && !rhs.mData)
     {
-        negate();
-        mpz_mod(mData->mInteger, mData->mInteger, rhs.mData->mInteger);
-        negate();
-    }
-    else
-    {
-        mpz_mod(mData->mInteger, mData->mInteger, rhs.mData->mInteger);
+        mSmall = rhs.mSmall == -1 ? 0 : mSmall % rhs.mSmall;
+        return *this;
     }
+
+    const MpzView value(rhs);
+    copyIfShared();
+    mpz_tdiv_r(mData->mInteger, mData->mInteger, value);
+    normalize();
     return *this;
 }
 
 GmpInt& GmpInt::operator%=(long value)
 {
-    copyIfShared();
-    if(value < 0) value = -value;
-    if(operator<(0))
-    {
-        negate();
-        mpz_mod_ui(mData->mInteger, mData->mInteger, value);
-        negate();
-    }
-    else
-    {
-        mpz_mod_ui(mData->mInteger, mData->mInteger, value);
-    }
-    return *this;
+    return operator%=(GmpInt(value));
 }
 
 GmpInt& GmpInt::operator<<=(unsigned long bits)
 {
+    long product;
+    if(!mData && bits < sizeof(long) * 8 - 1
+    && !__builtin_mul_overflow(mSmall, 1L << bits, &product))
+    {
+        mSmall = product;
+        return *this;
+    }
+
     copyIfShared();
     mpz_mul_2exp(mData->mInteger, mData->mInteger, bits);
+    normalize();
     return *this;
 }
 
 GmpInt& GmpInt::operator>>=(unsigned long bits)
 {
+    if(!mData && bits < sizeof(long) * 8 - 1)
+    {
+        mSmall /= 1L << bits;
+        return *this;
+    }
+
     copyIfShared();
     mpz_tdiv_q_2exp(mData->mInteger, mData->mInteger, bits);
+    normalize();
     return *this;
 }
 
@@ -394,171 +642,240 @@ GmpInt& GmpInt::operator>>=(unsigned long bits)
 //===========================================================================
 void GmpInt::addProduct(const GmpInt& value1, const GmpInt& value2)
 {
+    long product;
+    if(!mData && !value1.mData && !value2.mData
+    && !__builtin_mul_overflow(value1.mSmall, value2.mSmall, &product)
+    && !__builtin_add_overflow(mSmall, product, &product))
+    {
+        mSmall = product;
+        return;
+    }
+
+    const MpzView factor1(value1), factor2(value2);
     copyIfShared();
-    mpz_addmul(mData->mInteger, value1.mData->mInteger, value2.mData->mInteger);
+    mpz_addmul(mData->mInteger, factor1, factor2);
+    normalize();
 }
 
 void GmpInt::addProduct(const GmpInt& value1, unsigned long value2)
 {
-    copyIfShared();
-    mpz_addmul_ui(mData->mInteger, value1.mData->mInteger, value2);
+    addProduct(value1, GmpInt(value2));
 }
 
 void GmpInt::subProduct(const GmpInt& value1, const GmpInt& value2)
 {
+    long product;
+    if(!mData && !value1.mData && !value2.mData
+    && !__builtin_mul_overflow(value1.mSmall, value2.mSmall, &product)
+    && !__builtin_sub_overflow(mSmall, product, &product))
+    {
+        mSmall = product;
+        return;
+    }
+
+    const MpzView factor1(value1), factor2(value2);
     copyIfShared();
-    mpz_submul(mData->mInteger, value1.mData->mInteger, value2.mData->mInteger);
+    mpz_submul(mData->mInteger, factor1, factor2);
+    normalize();
 }
 
 void GmpInt::subProduct(const GmpInt& value1, unsigned long value2)
 {
-    copyIfShared();
-    mpz_submul_ui(mData->mInteger, value1.mData->mInteger, value2);
+    subProduct(value1, GmpInt(value2));
 }
 
 void GmpInt::negate()
 {
+    if(!mData && mSmall != LONG_MIN)
+    {
+        mSmall = -mSmall;
+        return;
+    }
+
     copyIfShared();
     mpz_neg(mData->mInteger, mData->mInteger);
+    normalize();
 }
 
 void GmpInt::abs()
 {
-    copyIfShared();
-    mpz_abs(mData->mInteger, mData->mInteger);
+    if(operator<(0)) negate();
 }
 
 GmpInt GmpInt::abs(const GmpInt& value)
+{
+    GmpInt retval(value);
+    retval.abs();
+    return retval;
+}
+
+GmpInt GmpInt::pow(const GmpInt& base, unsigned long exponent)
 {
     GmpInt retval(kNoInitialization);
-    mpz_abs(retval.mData->mInteger, value.mData->mInteger);
+    mpz_pow_ui(retval.mData->mInteger, MpzView(base), exponent);
+    retval.normalize();
     return retval;
 }
 
+GmpInt GmpInt::gcd(const GmpInt& value1, const GmpInt& value2)
+{
+    if(!value1.mData && !value2.mData)
+    {
+        // Binary gcd of the magnitudes; only LONG_MIN has a magnitude
+        // that doesn't fit back in a long.
+        unsigned long a = value1.mSmall < 0 ?
+            0UL - (unsigned long)(value1.mSmall) : (unsigned long)(value1.mSmall);
+        unsigned long b = value2.mSmall < 0 ?
+            0UL - (unsigned long)(value2.mSmall) : (unsigned long)(value2.mSmall);
+        if(a == 0) return GmpInt(b);
+        if(b == 0) return GmpInt(a);
+
+        const int shift = __builtin_ctzl(a | b);
+        a >>= __builtin_ctzl(a);
+        do
+        {
+            b >>= __builtin_ctzl(b);
+            if(a > b) { const unsigned long t = a; a = b; b = t; }
+            b -= a;
+        } while(b);
+        return GmpInt(a << shift);
+    }
+
+    GmpInt retval(kNoInitialization);
+    mpz_gcd(retval.mData->mInteger, MpzView(value1), MpzView(value2));
+    retval.normalize();
+    return retval;
+}
+
+bool GmpInt::root(const GmpInt& value, unsigned long n, GmpInt& result)
+{
+    if(!value.mData && n == 2)
+    {
+        // The double estimate is off by at most one either way.
+        const unsigned long square = (unsigned long)(value.mSmall);
+        unsigned long root = (unsigned long)(std::sqrt(double(square)));
+        while(root * root > square) --root;
+        while((root + 1) * (root + 1) <= square) ++root;
+        result = GmpInt(root);
+        return root * root == square;
+    }
+
+    GmpInt retval(kNoInitialization);
+    const bool exact =
+        mpz_root(retval.mData->mInteger, MpzView(value), n) != 0;
+    retval.normalize();
+    result = retval;
+    return exact;
+}
+
 
 //===========================================================================
 // Non-modifying operators
 //===========================================================================
 GmpInt GmpInt::operator+(const GmpInt& rhs) const
 {
+    long sum;
+    if(!mData && !rhs.mData
+    && !__builtin_add_overflow(mSmall, rhs.mSmall, &sum))
+        return GmpInt(sum);
+
     GmpInt retval(kNoInitialization);
-    mpz_add(retval.mData->mInteger, mData->mInteger, rhs.mData->mInteger);
+    mpz_add(retval.mData->mInteger, MpzView(*this), MpzView(rhs));
+    retval.normalize();
     return retval;
 }
 
 GmpInt GmpInt::operator+(long value) const
 {
-    GmpInt retval(kNoInitialization);
-    if(value >= 0)
-        mpz_add_ui(retval.mData->mInteger, mData->mInteger, value);
-    else
-        mpz_sub_ui(retval.mData->mInteger, mData->mInteger, -value);
-    return retval;
+    return operator+(GmpInt(value));
 }
 
 GmpInt GmpInt::operator-(const GmpInt& rhs) const
 {
+    long difference;
+    if(!mData && !rhs.mData
+    && !__builtin_sub_overflow(mSmall, rhs.mSmall, &difference))
+        return GmpInt(difference);
+
     GmpInt retval(kNoInitialization);
-    mpz_sub(retval.mData->mInteger, mData->mInteger, rhs.mData->mInteger);
+    mpz_sub(retval.mData->mInteger, MpzView(*this), MpzView(rhs));
+    retval.normalize();
     return retval;
 }
 
 GmpInt GmpInt::operator-(long value) const
 {
-    GmpInt retval(kNoInitialization);
-    if(value >= 0)
-        mpz_sub_ui(retval.mData->mInteger, mData->mInteger, value);
-    else
-        mpz_add_ui(retval.mData->mInteger, mData->mInteger, -value);
-    return retval;
+    return operator-(GmpInt(value));
 }
 
 GmpInt GmpInt::operator*(const GmpInt& rhs) const
 {
+    long product;
+    if(!mData && !rhs.mData
+    && !__builtin_mul_overflow(mSmall, rhs.mSmall, &product))
+        return GmpInt(product);
+
     GmpInt retval(kNoInitialization);
-    mpz_mul(retval.mData->mInteger, mData->mInteger, rhs.mData->mInteger);
+    mpz_mul(retval.mData->mInteger, MpzView(*this), MpzView(rhs));
+    retval.normalize();
     return retval;
 }
 
 GmpInt GmpInt::operator*(long value) const
 {
-    GmpInt retval(kNoInitialization);
-    mpz_mul_si(retval.mData->mInteger, mData->mInteger, value);
-    return retval;
+    return operator*(GmpInt(value));
 }
 
 GmpInt GmpInt::operator/(const GmpInt& rhs) const
 {
+    if(!mData && !rhs.mData && !(mSmall == LONG_MIN && rhs.mSmall == -1))
+        return GmpInt(mSmall / rhs.mSmall);
+
     GmpInt retval(kNoInitialization);
-    mpz_tdiv_q(retval.mData->mInteger, mData->mInteger, rhs.mData->mInteger);
+    mpz_tdiv_q(retval.mData->mInteger, MpzView(*this), MpzView(rhs));
+    retval.normalize();
     return retval;
 }
 
 GmpInt GmpInt::operator/(long value) const
 {
-    GmpInt retval(kNoInitialization);
-    if(value >= 0)
-        mpz_tdiv_q_ui(retval.mData->mInteger, mData->mInteger, value);
-    else
-    {
-        mpz_neg(retval.mData->mInteger, mData->mInteger);
-        mpz_tdiv_q_ui(retval.mData->mInteger, retval.mData->mInteger, -value);
-    }
-    return retval;
+    return operator/(GmpInt(value));
 }
 
 GmpInt GmpInt::operator%(const GmpInt& rhs) const
 {
+    if(!mData && !rhs.mData)
+        return GmpInt(rhs.mSmall == -1 ? 0 : mSmall % rhs.mSmall);
+
     GmpInt retval(kNoInitialization);
-    if(operator<(0))
-    {
-        mpz_neg(retval.mData->mInteger, mData->mInteger);
-        mpz_mod(retval.mData->mInteger,
-                retval.mData->mInteger, rhs.mData->mInteger);
-        retval.negate();
-    }
-    else
-    {
-        mpz_mod(retval.mData->mInteger, mData->mInteger, rhs.mData->mInteger);
-    }
+    mpz_tdiv_r(retval.mData->mInteger, MpzView(*this), MpzView(rhs));
+    retval.normalize();
     return retval;
 }
 
 GmpInt GmpInt::operator%(long value) const
 {
-    GmpInt retval(kNoInitialization);
-    if(value < 0) value = -value;
-    if(operator<(0))
-    {
-        mpz_neg(retval.mData->mInteger, mData->mInteger);
-        mpz_mod_ui(retval.mData->mInteger, retval.mData->mInteger, value);
-        retval.negate();
-    }
-    else
-    {
-        mpz_mod_ui(retval.mData->mInteger, mData->mInteger, value);
-    }
-    return retval;
+    return operator%(GmpInt(value));
 }
 
 GmpInt GmpInt::operator-() const
 {
-    GmpInt retval(kNoInitialization);
-    mpz_neg(retval.mData->mInteger, mData->mInteger);
+    GmpInt retval(*this);
+    retval.negate();
     return retval;
 }
 
 GmpInt GmpInt::operator<<(unsigned long bits) const
 {
-    GmpInt retval(kNoInitialization);
-    mpz_mul_2exp(retval.mData->mInteger, mData->mInteger, bits);
+    GmpInt retval(*this);
+    retval <<= bits;
     return retval;
 }
 
 GmpInt GmpInt::operator>>(unsigned long bits) const
 {
-    GmpInt retval(kNoInitialization);
-    mpz_tdiv_q_2exp(retval.mData->mInteger, mData->mInteger, bits);
+    GmpInt retval(*this);
+    retval >>= bits;
     return retval;
 }
 
@@ -566,74 +883,89 @@ GmpInt GmpInt::operator>>(unsigned long bits) const
 //===========================================================================
 // Comparison operators
 //===========================================================================
+int GmpInt::compare(const GmpInt& rhs) const
+{
+    if(!mData && !rhs.mData)
+        return (mSmall > rhs.mSmall) - (mSmall < rhs.mSmall);
+    return mpz_cmp(MpzView(*this), MpzView(rhs));
+}
+
+int GmpInt::compare(long value) const
+{
+    if(!mData) return (mSmall > value) - (mSmall < value);
+    return mpz_cmp_si(mData->mInteger, value);
+}
+
 bool GmpInt::operator<(const GmpInt& rhs) const
 {
-    return mpz_cmp(mData->mInteger, rhs.mData->mInteger) < 0;
+    return compare(rhs) < 0;
 }
 
 bool GmpInt::operator<(long value) const
 {
-    return mpz_cmp_si(mData->mInteger, value) < 0;
+    return compare(value) < 0;
 }
 
 bool GmpInt::operator<=(const GmpInt& rhs) const
 {
-    return mpz_cmp(mData->mInteger, rhs.mData->mInteger) <= 0;
+    return compare(rhs) <= 0;
 }
 
 bool GmpInt::operator<=(long value) const
 {
-    return mpz_cmp_si(mData->mInteger, value) <= 0;
+    return compare(value) <= 0;
 }
 
 bool GmpInt::operator>(const GmpInt& rhs) const
 {
-    return mpz_cmp(mData->mInteger, rhs.mData->mInteger) > 0;
+    return compare(rhs) > 0;
 }
 
 bool GmpInt::operator>(long value) const
 {
-    return mpz_cmp_si(mData->mInteger, value) > 0;
+    return compare(value) > 0;
 }
 
 bool GmpInt::operator>=(const GmpInt& rhs) const
 {
-    return mpz_cmp(mData->mInteger, rhs.mData->mInteger) >= 0;
+    return compare(rhs) >= 0;
 }
 
 bool GmpInt::operator>=(long value) const
 {
-    return mpz_cmp_si(mData->mInteger, value) >= 0;
+    return compare(value) >= 0;
 }
 
 bool GmpInt::operator==(const GmpInt& rhs) const
 {
-    return mpz_cmp(mData->mInteger, rhs.mData->mInteger) == 0;
+    return compare(rhs) == 0;
 }
 
 bool GmpInt::operator==(long value) const
 {
-    return mpz_cmp_si(mData->mInteger, value) == 0;
+    return compare(value) == 0;
 }
 
 bool GmpInt::operator!=(const GmpInt& rhs) const
 {
-    return mpz_cmp(mData->mInteger, rhs.mData->mInteger) != 0;
+    return compare(rhs) != 0;
 }
 
 bool GmpInt::operator!=(long value) const
 {
-    return mpz_cmp_si(mData->mInteger, value) != 0;
+    return compare(value) != 0;
 }
 
 void GmpInt::parseValue(const char* value)
 {
+    copyIfShared();
     mpz_set_str(mData->mInteger, value, 10);
+    normalize();
 }
 
 void GmpInt::parseValue(const char* value, char** endptr)
 {
-    static std::vector<char> str;
+    std::vector<char>& str = gmpIntDataContainer().stringBuffer();
 
     unsigned startIndex = 0;
     while(value[startIndex] && std::isspace(value[startIndex])) ++startIndex;
@@ -657,13 +989,15 @@ void GmpInt::parseValue(const char* value, char** endptr)
     str.assign(value + startIndex, value + endIndex);
     str.push_back(0);
 
+    copyIfShared();
     mpz_set_str(mData->mInteger, &str[0], 0);
+    normalize();
     *endptr = const_cast<char*>(value + endIndex);
 }
 
 GmpInt GmpInt::parseString(const char* str, char** endptr)
 {
-    GmpInt retval(kNoInitialization);
+    GmpInt retval;
     retval.parseValue(str, endptr);
     return retval;
 }
@@ -673,25 +1007,12 @@ GmpInt GmpInt::parseString(const char* str, char** endptr)
 //===========================================================================
 GmpInt operator+(long lhs, const GmpInt& rhs)
 {
-    GmpInt retval(GmpInt::kNoInitialization);
-    if(lhs >= 0)
-        mpz_add_ui(retval.mData->mInteger, rhs.mData->mInteger, lhs);
-    else
-        mpz_sub_ui(retval.mData->mInteger, rhs.mData->mInteger, -lhs);
-    return retval;
+    return rhs + lhs;
 }
 
 GmpInt operator-(long lhs, const GmpInt& rhs)
 {
-    GmpInt retval(GmpInt::kNoInitialization);
-    if(lhs >= 0)
-        mpz_ui_sub(retval.mData->mInteger, lhs, rhs.mData->mInteger);
-    else
-    {
-        mpz_add_ui(retval.mData->mInteger, rhs.mData->mInteger, -lhs);
-        mpz_neg(retval.mData->mInteger, retval.mData->mInteger);
-    }
-    return retval;
+    return GmpInt(lhs) - rhs;
 }
 
 GmpInt operator*(long lhs, const GmpInt& rhs)
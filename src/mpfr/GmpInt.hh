@@ -2,6 +2,8 @@
 #define ONCE_FP_GMP_INT_HH_
 
 #include <iostream>
+#include <string>
+#include <cstddef>
 
 class GmpInt
 {
@@ -38,18 +40,50 @@ class GmpInt
        not be modified from the outside because it may be shared among
        several objects. If the calling code needs to modify the data, it
        should copy it for itself first with the appropriate GMP library
-       functions.
+       functions. A value held inline (see below) is moved to an mpz_t by
+       this call.
      */
     template<typename Mpz_t>
     void get_raw_mpfr_data(Mpz_t& dest_mpz_t);
 
+    /* Sets the value of this object from a raw mpz_t. */
+    template<typename Mpz_t>
+    void set_raw_mpz_data(const Mpz_t& src_mpz_t);
+
 
     // Note that the returned char* points to an internal (shared) buffer
     // which will be valid until the next time this function is called
-    // (by any object).
+    // (by any object in the same thread).
     const char* getAsString(int base = 10) const;
+
+    // Same as above, but writes into a buffer supplied by the caller, so it
+    // is reentrant and doesn't allocate. Returns the length of the string,
+    // or 0 without writing anything if bufferSize is less than
+    // getAsStringBufferSize(base).
+    std::size_t getAsString(char* buffer, std::size_t bufferSize,
+                            int base = 10) const;
+    std::size_t getAsStringBufferSize(int base = 10) const;
+
+    // Replaces the contents of dest, reusing its capacity.
+    void getAsString(std::string& dest, int base = 10) const;
+
+    // Writes only the first 'digits' significant decimal digits (truncated)
+    // in the form "-1.2345e+678", or the whole value if it isn't longer
+    // than that. Only those digits are converted, so this is much cheaper
+    // than getAsString() for values with many digits. Returns the length,
+    // or 0 if bufferSize is less than getLeadingDigitsBufferSize(digits).
+    std::size_t getLeadingDigits(unsigned digits, char* buffer,
+                                 std::size_t bufferSize) const;
+    static std::size_t getLeadingDigitsBufferSize(unsigned digits);
     long toInt() const;
 
+    // Number of bits in the absolute value (0 for zero).
+    unsigned long numberOfBits() const;
+
+    // True if the value is held inline, which is the case exactly when it
+    // fits in a long; toInt() is then the value itself.
+    bool fitsInLong() const { return mData == 0; }
+
     GmpInt& operator+=(const GmpInt&);
     GmpInt& operator+=(long);
     GmpInt& operator-=(const GmpInt&);
@@ -75,6 +109,14 @@ class GmpInt
     void negate();
     void abs();
     static GmpInt abs(const GmpInt&);
+    static GmpInt pow(const GmpInt& base, unsigned long exponent);
+
+    // Greatest common divisor, always non-negative (0 only if both are 0).
+    static GmpInt gcd(const GmpInt&, const GmpInt&);
+
+    // Sets result to the truncated n-th root of value (n > 0, and value
+    // must not be negative if n is even). Returns true if it is exact.
+    static bool root(const GmpInt& value, unsigned long n, GmpInt& result);
 
     GmpInt operator+(const GmpInt&) const;
     GmpInt operator+(long) const;
@@ -113,13 +155,24 @@ class GmpInt
  private:
     struct GmpIntData;
     class GmpIntDataContainer;
+    struct MpzView;
 
+    /* Values that fit in a long are stored inline in mSmall with mData
+       null, and arithmetic on them uses overflow-checked machine
+       operations. A result that overflows is computed with GMP in an mpz
+       node instead, and goes back inline once it fits again.
+    */
     GmpIntData* mData;
+    long mSmall;
 
     enum DummyType { kNoInitialization };
     GmpInt(DummyType);
 
     void copyIfShared();
+    void normalize();
+    void setSmall(long value);
+    int compare(const GmpInt&) const;
+    int compare(long) const;
     static GmpIntDataContainer& gmpIntDataContainer();
 
     friend GmpInt operator+(long lhs, const GmpInt& rhs);
@@ -0,0 +1,722 @@
+#include "GmpRational.hh"
+#include <gmp.h>
+#include <mpfr.h>
+#include <cmath>
+#include <cctype>
+#include <climits>
+#include <algorithm>
+
+//===========================================================================
+// Small values
+//===========================================================================
+namespace
+{
+    // Doubles strictly inside (-kLongRange, kLongRange) convert to a long.
+    const double kLongRange = -double(LONG_MIN);
+
+    // Decimal literals with a larger exponent are read as MpfrFloat.
+    const long kMaxDecimalExponent = 10000;
+
+    inline unsigned long magnitude(long value)
+    {
+        return value < 0 ? 0UL - (unsigned long)(value) : (unsigned long)(value);
+    }
+
+    unsigned long gcd(unsigned long a, unsigned long b)
+    {
+        if(a == 0) return b;
+        if(b == 0) return a;
+
+        const int shift = __builtin_ctzl(a | b);
+        a >>= __builtin_ctzl(a);
+        do
+        {
+            b >>= __builtin_ctzl(b);
+            if(a > b) { const unsigned long t = a; a = b; b = t; }
+            b -= a;
+        } while(b);
+        return a << shift;
+    }
+
+    /* Gets the parts of a finite value if both fit in a long. */
+    inline bool getSmall(const GmpRational& value,
+                         long& numerator, long& denominator)
+    {
+        if(!value.numerator().fitsInLong() || !value.denominator().fitsInLong())
+            return false;
+        numerator = value.numerator().toInt();
+        denominator = value.denominator().toInt();
+        return denominator != 0;
+    }
+
+    /* The functions below compute with the parts of fractions in lowest
+       terms, and return false if anything overflows. */
+
+    // a/b + c/d, with the gcd of the denominators taken out first so that
+    // the intermediate values stay small (Knuth, TAOCP 4.5.1).
+    bool addSmall(long a, long b, long c, long d,
+                  long& numerator, long& denominator)
+    {
+        const long g = long(gcd(b, d));
+        long t1, t2, sum, product;
+        if(__builtin_mul_overflow(a, d / g, &t1)
+        || __builtin_mul_overflow(c, b / g, &t2)
+        || __builtin_add_overflow(t1, t2, &sum))
+            return false;
+        if(sum == 0)
+        {
+            numerator = 0;
+            denominator = 1;
+            return true;
+        }
+
+        const long g2 = long(gcd(magnitude(sum), g));
+        if(__builtin_mul_overflow(b / g, d / g2, &product))
+            return false;
+        numerator = sum / g2;
+        denominator = product;
+        return true;
+    }
+
+    // a/b * c/d, with the cross gcds taken out first.
+    bool mulSmall(long a, long b, long c, long d,
+                  long& numerator, long& denominator)
+    {
+        const long g1 = long(gcd(magnitude(a), d));
+        const long g2 = long(gcd(magnitude(c), b));
+        return !__builtin_mul_overflow(a / g1, c / g2, &numerator)
+            && !__builtin_mul_overflow(b / g2, d / g1, &denominator);
+    }
+
+    bool powSmall(long base, unsigned long exponent, long& result)
+    {
+        long value = 1;
+        while(true)
+        {
+            if((exponent & 1) && __builtin_mul_overflow(value, base, &value))
+                return false;
+            exponent >>= 1;
+            if(!exponent) break;
+            if(__builtin_mul_overflow(base, base, &base))
+                return false;
+        }
+        result = value;
+        return true;
+    }
+}
+
+
+//===========================================================================
+// Constructors
+//===========================================================================
+GmpRational::GmpRational(DummyType): mExact(true) {}
+
+GmpRational::GmpRational(): mNumerator(), mDenominator(1L), mExact(true) {}
+
+GmpRational::GmpRational(long value):
+    mNumerator(value), mDenominator(1L), mExact(true)
+{}
+
+GmpRational::GmpRational(int value):
+    mNumerator(value), mDenominator(1L), mExact(true)
+{}
+
+GmpRational::GmpRational(const GmpInt& value):
+    mNumerator(value), mDenominator(1L), mExact(true)
+{}
+
+GmpRational::GmpRational(const GmpInt& numerator, const GmpInt& denominator):
+    mNumerator(numerator), mDenominator(denominator), mExact(true)
+{
+    reduce();
+}
+
+GmpRational::GmpRational(double value):
+    mNumerator(), mDenominator(1L), mExact(true)
+{
+    if(value != value)
+    {
+        mDenominator = 0L;
+        mExact = false;
+        return;
+    }
+    if(value - value != 0)
+    {
+        mNumerator = value > 0 ? 1L : -1L;
+        mDenominator = 0L;
+        mExact = false;
+        return;
+    }
+    if(value > -kLongRange && value < kLongRange && value == double(long(value)))
+    {
+        mNumerator = long(value);
+        return;
+    }
+
+    // value = mantissa * 2^exponent with an integral 53-bit mantissa
+    int exponent;
+    long mantissa = long(std::ldexp(std::frexp(value, &exponent), 53));
+    exponent -= 53;
+    if(exponent >= 0)
+    {
+        mNumerator = GmpInt(mantissa) << (unsigned long)(exponent);
+        return;
+    }
+
+    int zeros = __builtin_ctzl(magnitude(mantissa));
+    if(zeros > -exponent) zeros = -exponent;
+    mantissa /= 1L << zeros;
+    exponent += zeros;
+
+    mNumerator = mantissa;
+    mDenominator = GmpInt(1L) << (unsigned long)(-exponent);
+    mExact = false;
+}
+
+GmpRational::GmpRational(const MpfrFloat& value):
+    mNumerator(), mDenominator(1L), mExact(false)
+{
+    mpfr_t raw;
+    value.get_raw_mpfr_data(raw);
+    if(mpfr_nan_p(raw))
+    {
+        mDenominator = 0L;
+        return;
+    }
+    if(mpfr_inf_p(raw))
+    {
+        mNumerator = long(mpfr_sgn(raw));
+        mDenominator = 0L;
+        return;
+    }
+    if(mpfr_zero_p(raw))
+        return;
+
+    mpz_t mantissa;
+    mpz_init(mantissa);
+    long exponent = mpfr_get_z_2exp(mantissa, raw);
+    const unsigned long zeros = mpz_scan1(mantissa, 0);
+    mpz_tdiv_q_2exp(mantissa, mantissa, zeros);
+    exponent += long(zeros);
+
+    if(exponent >= 0)
+    {
+        if(mpz_sizeinbase(mantissa, 2) + (unsigned long)(exponent) > kMaxBits)
+        {
+            mNumerator = long(mpz_sgn(mantissa));
+            mDenominator = 0L;
+        }
+        else
+        {
+            mpz_mul_2exp(mantissa, mantissa, (unsigned long)(exponent));
+            mNumerator.set_raw_mpz_data(mantissa);
+        }
+    }
+    else if(0UL - (unsigned long)(exponent) <= kMaxBits)
+    {
+        mNumerator.set_raw_mpz_data(mantissa);
+        mDenominator = GmpInt(1L) << (0UL - (unsigned long)(exponent));
+    }
+    mpz_clear(mantissa);
+}
+
+
+//===========================================================================
+// Internal functions
+//===========================================================================
+void GmpRational::reduce()
+{
+    if(mDenominator < 0)
+    {
+        mNumerator.negate();
+        mDenominator.negate();
+    }
+
+    const GmpInt divisor = GmpInt::gcd(mNumerator, mDenominator);
+    if(divisor > 1)
+    {
+        mNumerator /= divisor;
+        mDenominator /= divisor;
+    }
+}
+
+/* Keeps approximations at about twice the MpfrFloat precision. */
+inline void GmpRational::roundIfTooLong()
+{
+    if(!mExact && !mDenominator.fitsInLong()
+    && mDenominator.numberOfBits() >
+       2 * MpfrFloat::getCurrentDefaultMantissaBits())
+        *this = GmpRational(toMpfrFloat());
+}
+
+/* Returns -1, 0 or 1, or 2 if either value is NaN. */
+int GmpRational::compare(const GmpRational& rhs) const
+{
+    long a, b, c, d, lhsProduct, rhsProduct;
+    if(getSmall(*this, a, b) && getSmall(rhs, c, d)
+    && !__builtin_mul_overflow(a, d, &lhsProduct)
+    && !__builtin_mul_overflow(c, b, &rhsProduct))
+        return lhsProduct < rhsProduct ? -1 : lhsProduct > rhsProduct;
+
+    if(!isFinite() || !rhs.isFinite())
+    {
+        const MpfrFloat lhsValue = toMpfrFloat(), rhsValue = rhs.toMpfrFloat();
+        return lhsValue < rhsValue ? -1 : lhsValue > rhsValue ? 1 :
+            lhsValue == rhsValue ? 0 : 2;
+    }
+
+    if(mDenominator == rhs.mDenominator)
+        return mNumerator < rhs.mNumerator ? -1 : mNumerator > rhs.mNumerator;
+
+    const GmpInt lhsValue = mNumerator * rhs.mDenominator;
+    const GmpInt rhsValue = rhs.mNumerator * mDenominator;
+    return lhsValue < rhsValue ? -1 : lhsValue > rhsValue;
+}
+
+/* Used for the operations that involve an infinity or NaN. */
+GmpRational GmpRational::computeWithMpfr(const GmpRational& lhs,
+                                         char operation,
+                                         const GmpRational& rhs)
+{
+    const MpfrFloat x = lhs.toMpfrFloat(), y = rhs.toMpfrFloat();
+    switch(operation)
+    {
+      case '+': return GmpRational(x + y);
+      case '*': return GmpRational(x * y);
+      case '/': return GmpRational(x / y);
+      case '%': return GmpRational(x % y);
+      default:  return GmpRational(MpfrFloat::pow(x, y));
+    }
+}
+
+
+//===========================================================================
+// Data getters
+//===========================================================================
+bool GmpRational::isInteger() const
+{
+    return mDenominator == 1;
+}
+
+bool GmpRational::isFinite() const
+{
+    return mDenominator != 0;
+}
+
+long GmpRational::toInt() const
+{
+    if(!isFinite()) return 0;
+    return isInteger() ? mNumerator.toInt() : (mNumerator / mDenominator).toInt();
+}
+
+double GmpRational::toDouble() const
+{
+    // Both parts convert exactly, so there's only the one rounding.
+    const long kExactLimit = 1L << 53;
+    long numerator, denominator;
+    if(getSmall(*this, numerator, denominator)
+    && numerator <= kExactLimit && numerator >= -kExactLimit
+    && denominator <= kExactLimit)
+        return double(numerator) / double(denominator);
+    return toMpfrFloat().toDouble();
+}
+
+MpfrFloat GmpRational::toMpfrFloat() const
+{
+    const unsigned long precision = MpfrFloat::getCurrentDefaultMantissaBits();
+    mpfr_t value;
+    mpfr_init2(value, mpfr_prec_t(precision));
+
+    long numerator, denominator;
+    if(!isFinite())
+    {
+        if(mNumerator == 0)
+            mpfr_set_nan(value);
+        else
+            mpfr_set_inf(value, mNumerator < 0 ? -1 : 1);
+    }
+    else if(getSmall(*this, numerator, denominator)
+         && precision >= sizeof(long) * 8)
+    {
+        mpfr_set_si(value, numerator, GMP_RNDN);
+        mpfr_div_si(value, value, denominator, GMP_RNDN);
+    }
+    else
+    {
+        // Copies, because the raw data of inline values is moved to mpz.
+        GmpInt numeratorCopy = mNumerator, denominatorCopy = mDenominator;
+        mpz_t rawNumerator, rawDenominator;
+        numeratorCopy.get_raw_mpfr_data(rawNumerator);
+        denominatorCopy.get_raw_mpfr_data(rawDenominator);
+
+        mpq_t quotient;
+        *mpq_numref(quotient) = *rawNumerator;
+        *mpq_denref(quotient) = *rawDenominator;
+        mpfr_set_q(value, quotient, GMP_RNDN);
+    }
+
+    MpfrFloat retval;
+    retval.set_raw_mpfr_data(value);
+    mpfr_clear(value);
+    return retval;
+}
+
+void GmpRational::getAsString(std::string& dest) const
+{
+    mNumerator.getAsString(dest);
+    if(!isInteger())
+    {
+        std::string denominator;
+        mDenominator.getAsString(denominator);
+        dest += '/';
+        dest += denominator;
+    }
+}
+
+GmpRational GmpRational::parseString(const char* str, char** endptr)
+{
+    const char* ptr = str;
+    while(std::isspace(*ptr)) ++ptr;
+    const bool negative = *ptr == '-';
+    if(negative) ++ptr;
+    if(ptr[0] == '0' && ptr[1] == 'x')
+        return GmpRational(GmpInt::parseString(str, endptr));
+
+    std::string digits;
+    long fractionDigits = 0;
+    for(; std::isdigit(*ptr); ++ptr) digits += *ptr;
+    if(*ptr == '.')
+        for(++ptr; std::isdigit(*ptr); ++ptr)
+        {
+            digits += *ptr;
+            ++fractionDigits;
+        }
+    if(digits.empty())
+    {
+        *endptr = const_cast<char*>(str);
+        return GmpRational();
+    }
+
+    long exponent = 0;
+    if(*ptr == 'e' || *ptr == 'E')
+    {
+        const char* exponentPtr = ptr + 1;
+        const bool negativeExponent = *exponentPtr == '-';
+        if(*exponentPtr == '-' || *exponentPtr == '+') ++exponentPtr;
+        if(std::isdigit(*exponentPtr))
+        {
+            for(; std::isdigit(*exponentPtr); ++exponentPtr)
+                if(exponent <= kMaxDecimalExponent)
+                    exponent = exponent * 10 + (*exponentPtr - '0');
+            if(negativeExponent) exponent = -exponent;
+            ptr = exponentPtr;
+        }
+    }
+    *endptr = const_cast<char*>(ptr);
+
+    exponent -= fractionDigits;
+    if(exponent > kMaxDecimalExponent || exponent < -kMaxDecimalExponent)
+    {
+        char* mpfrEndptr;
+        return GmpRational(MpfrFloat::parseString(str, &mpfrEndptr));
+    }
+
+    char* digitsEndptr;
+    GmpInt numerator = GmpInt::parseString(digits.c_str(), &digitsEndptr);
+    if(negative) numerator.negate();
+    const GmpInt scale = GmpInt::pow(10L, (unsigned long)(exponent < 0 ? -exponent : exponent));
+    if(exponent >= 0)
+        return GmpRational(numerator * scale);
+    return GmpRational(numerator, scale);
+}
+
+
+//===========================================================================
+// Modifying operators
+//===========================================================================
+GmpRational& GmpRational::operator+=(const GmpRational& rhs)
+{
+    long a, b, c, d, numerator, denominator;
+    if(getSmall(*this, a, b) && getSmall(rhs, c, d)
+    && addSmall(a, b, c, d, numerator, denominator))
+    {
+        mNumerator = numerator;
+        mDenominator = denominator;
+        mExact = mExact && rhs.mExact;
+        return *this;
+    }
+
+    if(!isFinite() || !rhs.isFinite())
+        return *this = computeWithMpfr(*this, '+', rhs);
+
+    const bool exact = mExact && rhs.mExact;
+    if(mDenominator == rhs.mDenominator)
+        mNumerator += rhs.mNumerator;
+    else
+    {
+        GmpInt sum = mNumerator * rhs.mDenominator;
+        sum.addProduct(rhs.mNumerator, mDenominator);
+        mNumerator = sum;
+        mDenominator *= rhs.mDenominator;
+    }
+    reduce();
+    mExact = exact;
+    roundIfTooLong();
+    return *this;
+}
+
+GmpRational& GmpRational::operator-=(const GmpRational& rhs)
+{
+    return operator+=(-rhs);
+}
+
+GmpRational& GmpRational::operator*=(const GmpRational& rhs)
+{
+    long a, b, c, d, numerator, denominator;
+    if(getSmall(*this, a, b) && getSmall(rhs, c, d)
+    && mulSmall(a, b, c, d, numerator, denominator))
+    {
+        mNumerator = numerator;
+        mDenominator = denominator;
+        mExact = mExact && rhs.mExact;
+        return *this;
+    }
+
+    if(!isFinite() || !rhs.isFinite())
+        return *this = computeWithMpfr(*this, '*', rhs);
+
+    const GmpInt g1 = GmpInt::gcd(mNumerator, rhs.mDenominator);
+    const GmpInt g2 = GmpInt::gcd(rhs.mNumerator, mDenominator);
+    const GmpInt product =
+        (mNumerator / g1) * (rhs.mNumerator / g2);
+    mDenominator = (mDenominator / g2) * (rhs.mDenominator / g1);
+    mNumerator = product;
+    mExact = mExact && rhs.mExact;
+    roundIfTooLong();
+    return *this;
+}
+
+GmpRational& GmpRational::operator/=(const GmpRational& rhs)
+{
+    if(!isFinite() || !rhs.isFinite() || rhs.mNumerator == 0)
+        return *this = computeWithMpfr(*this, '/', rhs);
+
+    GmpRational reciprocal(kNoInitialization);
+    if(rhs.mNumerator < 0)
+    {
+        reciprocal.mNumerator = -rhs.mDenominator;
+        reciprocal.mDenominator = -rhs.mNumerator;
+    }
+    else
+    {
+        reciprocal.mNumerator = rhs.mDenominator;
+        reciprocal.mDenominator = rhs.mNumerator;
+    }
+    reciprocal.mExact = rhs.mExact;
+    return operator*=(reciprocal);
+}
+
+GmpRational& GmpRational::operator%=(const GmpRational& rhs)
+{
+    if(!isFinite() || !rhs.isFinite() || rhs.mNumerator == 0)
+        return *this = computeWithMpfr(*this, '%', rhs);
+
+    const GmpRational quotient = trunc(*this / rhs);
+    return operator-=(quotient * rhs);
+}
+
+
+//===========================================================================
+// Non-modifying operators
+//===========================================================================
+GmpRational GmpRational::operator+(const GmpRational& rhs) const
+{
+    GmpRational retval(*this);
+    return retval += rhs;
+}
+
+GmpRational GmpRational::operator-(const GmpRational& rhs) const
+{
+    GmpRational retval(*this);
+    return retval -= rhs;
+}
+
+GmpRational GmpRational::operator*(const GmpRational& rhs) const
+{
+    GmpRational retval(*this);
+    return retval *= rhs;
+}
+
+GmpRational GmpRational::operator/(const GmpRational& rhs) const
+{
+    GmpRational retval(*this);
+    return retval /= rhs;
+}
+
+GmpRational GmpRational::operator%(const GmpRational& rhs) const
+{
+    GmpRational retval(*this);
+    return retval %= rhs;
+}
+
+GmpRational GmpRational::operator-() const
+{
+    GmpRational retval(*this);
+    retval.mNumerator.negate();
+    return retval;
+}
+
+bool GmpRational::operator<(const GmpRational& rhs) const
+{
+    return compare(rhs) == -1;
+}
+
+bool GmpRational::operator<=(const GmpRational& rhs) const
+{
+    const int result = compare(rhs);
+    return result == -1 || result == 0;
+}
+
+bool GmpRational::operator>(const GmpRational& rhs) const
+{
+    return compare(rhs) == 1;
+}
+
+bool GmpRational::operator>=(const GmpRational& rhs) const
+{
+    const int result = compare(rhs);
+    return result == 1 || result == 0;
+}
+
+bool GmpRational::operator==(const GmpRational& rhs) const
+{
+    if(isFinite() && rhs.isFinite())
+        return mNumerator == rhs.mNumerator && mDenominator == rhs.mDenominator;
+    return compare(rhs) == 0;
+}
+
+bool GmpRational::operator!=(const GmpRational& rhs) const
+{
+    return !operator==(rhs);
+}
+
+
+//===========================================================================
+// Functions
+//===========================================================================
+GmpRational GmpRational::abs(const GmpRational& value)
+{
+    return value.mNumerator < 0 ? -value : value;
+}
+
+GmpRational GmpRational::trunc(const GmpRational& value)
+{
+    if(value.isInteger() || !value.isFinite()) return value;
+
+    GmpRational retval(value.mNumerator / value.mDenominator);
+    retval.mExact = value.mExact;
+    return retval;
+}
+
+GmpRational GmpRational::floor(const GmpRational& value)
+{
+    GmpRational retval = trunc(value);
+    if(!value.isInteger() && value.isFinite() && value.mNumerator < 0)
+        retval.mNumerator -= 1;
+    return retval;
+}
+
+GmpRational GmpRational::ceil(const GmpRational& value)
+{
+    GmpRational retval = trunc(value);
+    if(!value.isInteger() && value.isFinite() && value.mNumerator > 0)
+        retval.mNumerator += 1;
+    return retval;
+}
+
+GmpRational GmpRational::round(const GmpRational& value)
+{
+    if(value.isInteger() || !value.isFinite()) return value;
+
+    // (2p + q) / 2q, or (2p - q) / 2q for negative values, truncated
+    GmpInt twice = value.mNumerator * 2L;
+    if(value.mNumerator < 0)
+        twice -= value.mDenominator;
+    else
+        twice += value.mDenominator;
+
+    GmpRational retval(twice / (value.mDenominator * 2L));
+    retval.mExact = value.mExact;
+    return retval;
+}
+
+bool GmpRational::pow(const GmpRational& base, long exponent,
+                      GmpRational& result)
+{
+    if(!base.isFinite())
+    {
+        result = computeWithMpfr(base, '^', GmpRational(exponent));
+        return true;
+    }
+
+    GmpInt numerator = base.mNumerator, denominator = base.mDenominator;
+    if(exponent < 0)
+    {
+        if(numerator == 0) return false;
+        if(numerator < 0)
+        {
+            numerator.negate();
+            denominator.negate();
+        }
+        const GmpInt swapped = numerator;
+        numerator = denominator;
+        denominator = swapped;
+    }
+
+    const unsigned long n = magnitude(exponent);
+    const unsigned long bits =
+        std::max(numerator.numberOfBits(), denominator.numberOfBits());
+    if(bits > 1 && n > kMaxBits / (bits - 1))
+        return false;
+
+    long a, b;
+    if(!numerator.fitsInLong() || !denominator.fitsInLong()
+    || !powSmall(numerator.toInt(), n, a) || !powSmall(denominator.toInt(), n, b))
+    {
+        result.mNumerator = GmpInt::pow(numerator, n);
+        result.mDenominator = GmpInt::pow(denominator, n);
+    }
+    else
+    {
+        result.mNumerator = a;
+        result.mDenominator = b;
+    }
+    result.mExact = base.mExact;
+    result.roundIfTooLong();
+    return true;
+}
+
+bool GmpRational::root(const GmpRational& value, unsigned long n,
+                       GmpRational& result)
+{
+    if(!value.isFinite() || n == 0) return false;
+    if(n % 2 == 0 && value.mNumerator < 0) return false;
+
+    GmpInt numerator, denominator;
+    if(!GmpInt::root(value.mNumerator, n, numerator)
+    || !GmpInt::root(value.mDenominator, n, denominator))
+        return false;
+
+    result.mNumerator = numerator;
+    result.mDenominator = denominator;
+    result.mExact = value.mExact;
+    return true;
+}
+
+std::ostream& operator<<(std::ostream& os, const GmpRational& value)
+{
+    std::string str;
+    value.getAsString(str);
+    os << str;
+    return os;
+}
@@ -0,0 +1,128 @@
+#ifndef ONCE_FP_GMP_RATIONAL_HH_
+#define ONCE_FP_GMP_RATIONAL_HH_
+
+#include "GmpInt.hh"
+#include "MpfrFloat.hh"
+#include <string>
+
+/* A fraction of two GmpInts, always kept in lowest terms with a positive
+   denominator, so that each value has exactly one representation.
+
+   Arithmetic on fractions is exact. Functions that have no exact result in
+   general (sin, log, ...) are computed with MpfrFloat, and the binary
+   fraction that comes back is flagged as inexact; the flag propagates to
+   every value computed from it, and an inexact value whose denominator
+   gets much longer than the MpfrFloat precision is rounded again, so that
+   approximations don't grow without bound.
+
+   Both parts of a value are usually small, and GmpInt holds those inline.
+   Operations on such values are done with overflow-checked long
+   arithmetic and don't allocate anything; only results that don't fit are
+   computed with GMP.
+
+   Values that MpfrFloat can produce but a fraction can't hold are encoded
+   with a zero denominator: 1/0 and -1/0 for the infinities and 0/0 for
+   NaN. They are always inexact, and operations on them are done with
+   MpfrFloat.
+*/
+class GmpRational
+{
+ public:
+    GmpRational();
+    GmpRational(long value);
+    GmpRational(int value);
+    GmpRational(const GmpInt& value);
+
+    // The denominator must not be zero.
+    GmpRational(const GmpInt& numerator, const GmpInt& denominator);
+
+    /* An integral double is taken as exact, any other double as an
+       approximation of a decimal value (such as 0.1), which keeps its
+       exact binary value but is flagged as inexact. Use parseString() to
+       get the exact value of a decimal fraction.
+    */
+    GmpRational(double value);
+
+    // Always inexact.
+    explicit GmpRational(const MpfrFloat& value);
+
+    // Values whose numerator or denominator would need more bits than this
+    // are not held exactly: conversions from MpfrFloat turn them into an
+    // infinity or zero, and pow() refuses them.
+    static const unsigned long kMaxBits = 1UL << 20;
+
+    const GmpInt& numerator() const { return mNumerator; }
+    const GmpInt& denominator() const { return mDenominator; }
+
+    bool isExact() const { return mExact; }
+    bool isInteger() const;
+    bool isFinite() const;
+
+    long toInt() const; // truncated
+    double toDouble() const;
+    MpfrFloat toMpfrFloat() const; // at the current default precision
+
+    // Replaces the contents of dest with "p/q", or "p" for integers.
+    void getAsString(std::string& dest) const;
+
+    // Reads a decimal number such as "-1.25e-3" exactly, or an integer in
+    // hexadecimal ("0x1F"). Exponents too large to be worth holding
+    // exactly are read as an inexact MpfrFloat value.
+    static GmpRational parseString(const char* str, char** endptr);
+
+    GmpRational& operator+=(const GmpRational&);
+    GmpRational& operator-=(const GmpRational&);
+    GmpRational& operator*=(const GmpRational&);
+    GmpRational& operator/=(const GmpRational&);
+    GmpRational& operator%=(const GmpRational&);
+
+    GmpRational operator+(const GmpRational&) const;
+    GmpRational operator-(const GmpRational&) const;
+    GmpRational operator*(const GmpRational&) const;
+    GmpRational operator/(const GmpRational&) const;
+    GmpRational operator%(const GmpRational&) const; // sign of the dividend
+
+    GmpRational operator-() const;
+
+    bool operator<(const GmpRational&) const;
+    bool operator<=(const GmpRational&) const;
+    bool operator>(const GmpRational&) const;
+    bool operator>=(const GmpRational&) const;
+    bool operator==(const GmpRational&) const;
+    bool operator!=(const GmpRational&) const;
+
+    static GmpRational abs(const GmpRational&);
+    static GmpRational floor(const GmpRational&);
+    static GmpRational ceil(const GmpRational&);
+    static GmpRational trunc(const GmpRational&);
+    static GmpRational round(const GmpRational&); // halves away from zero
+
+    // Returns false, leaving result unchanged, if the numerator or the
+    // denominator of the result would exceed kMaxBits, or if base is zero
+    // and the exponent negative.
+    static bool pow(const GmpRational& base, long exponent,
+                    GmpRational& result);
+
+    // Sets result to the n-th root and returns true if the root exists and
+    // is a fraction (n = 0 and even roots of negative values don't).
+    static bool root(const GmpRational& value, unsigned long n,
+                     GmpRational& result);
+
+
+ private:
+    GmpInt mNumerator, mDenominator;
+    bool mExact;
+
+    enum DummyType { kNoInitialization };
+    GmpRational(DummyType);
+
+    void reduce();
+    void roundIfTooLong();
+    int compare(const GmpRational&) const;
+    static GmpRational computeWithMpfr(const GmpRational&, char operation,
+                                       const GmpRational&);
+};
+
+std::ostream& operator<<(std::ostream& os, const GmpRational& value);
+
+#endif
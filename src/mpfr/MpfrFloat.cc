@@ -1,6 +1,7 @@
 #include "MpfrFloat.hh"
 #include <stdio.h>
 #include <mpfr.h>
+#include <pthread.h>
 #include <deque>
 #include <vector>
 #include <cstring>
@@ -12,125 +13,364 @@
 struct MpfrFloat::MpfrFloatData
 {
     unsigned mRefCount;
+    unsigned mPoolIndex;
     MpfrFloatData* nextFreeNode;
+    MpfrFloatDataContainer* mOwner;
     mpfr_t mFloat;
 
-    MpfrFloatData(): mRefCount(1), nextFreeNode(0) {}
+    MpfrFloatData(MpfrFloatDataContainer* owner, unsigned poolIndex):
+        mRefCount(1), mPoolIndex(poolIndex), nextFreeNode(0), mOwner(owner) {}
+
+    // Copies of a value may live in different threads, so the reference
+    // count is the one field of a node that is updated atomically.
+    void addReference()
+    { __atomic_add_fetch(&mRefCount, 1, __ATOMIC_RELAXED); }
+    bool removeReference()
+    { return __atomic_sub_fetch(&mRefCount, 1, __ATOMIC_ACQ_REL) == 0; }
+    bool isShared() const
+    { return __atomic_load_n(&mRefCount, __ATOMIC_ACQUIRE) > 1; }
 };
 
+namespace
+{
+    pthread_mutex_t gContainerMutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_once_t gContainerKeyOnce = PTHREAD_ONCE_INIT;
+    pthread_key_t gContainerKey;
+    unsigned long gDefaultPrecision = 256;
+}
+
+/* Each thread has a container of its own, so allocating and releasing
+   values never needs a lock. A node that is released by a thread other
+   than its owner is pushed onto the owner's remote free list, which the
+   owner takes over in one atomic exchange the next time its own free list
+   runs dry. When a thread exits its container is parked, and a later
+   thread adopts it along with any nodes that are still in use elsewhere;
+   containers are therefore never destroyed.
+
+   Nodes are pooled by precision. A node keeps the precision it was
+   created with and always returns to the pool of that precision, and each
+   pool caches its own constants, so changing the default precision only
+   selects another pool.
+*/
 class MpfrFloat::MpfrFloatDataContainer
 {
-    unsigned long mDefaultPrecision;
+    struct Pool
+    {
+        unsigned long mPrecision;
+        MpfrFloatData* mFirstFreeNode;
+        MpfrFloatData
+        *mConst_0, *mConst_pi, *mConst_e, *mConst_log2,
+        *mConst_einv, *mConst_log10, *mConst_log2inv, *mConst_log10inv,
+        *mConst_deg_to_rad, *mConst_rad_to_deg;
+
+        Pool(unsigned long precision):
+            mPrecision(precision), mFirstFreeNode(0), mConst_0(0),
+            mConst_pi(0), mConst_e(0), mConst_log2(0),
+            mConst_einv(0), mConst_log10(0), mConst_log2inv(0),
+            mConst_log10inv(0), mConst_deg_to_rad(0), mConst_rad_to_deg(0)
+        {}
+    };
+
     std::deque<MpfrFloatData> mData;
-    MpfrFloatData* mFirstFreeNode;
+    std::vector<Pool> mPools;
+    unsigned mCurrentPool;
+    MpfrFloatData* mRemoteFreeNodes;
+    MpfrFloatDataContainer* mNextIdleContainer;
+
+    // The epsilon is shared by all pools and follows the current precision
+    // (FunctionParser keeps a copy of it as its default comparison epsilon.)
+    MpfrFloatData* mConst_epsilon;
+    std::vector<char> mStringBuffer;
 
-    MpfrFloatData
-    *mConst_0, *mConst_pi, *mConst_e, *mConst_log2, *mConst_epsilon;
+    static __thread MpfrFloatDataContainer* sThreadContainer;
+    static MpfrFloatDataContainer* sIdleContainers;
+
+    Pool& currentPool()
+    {
+        return mPools[mCurrentPool];
+    }
 
     void recalculateEpsilon()
     {
+        const unsigned long precision = currentPool().mPrecision;
+        mpfr_set_prec(mConst_epsilon->mFloat, precision);
         mpfr_set_si(mConst_epsilon->mFloat, 1, GMP_RNDN);
         mpfr_div_2ui(mConst_epsilon->mFloat, mConst_epsilon->mFloat,
-                     mDefaultPrecision*7/8 - 1, GMP_RNDN);
+                     precision*7/8 - 1, GMP_RNDN);
+    }
+
+    void selectPool(unsigned long bits)
+    {
+        for(unsigned i = 0; i < mPools.size(); ++i)
+            if(mPools[i].mPrecision == bits)
+            {
+                mCurrentPool = i;
+                return;
+            }
+
+        mPools.push_back(Pool(bits));
+        mCurrentPool = unsigned(mPools.size() - 1);
+    }
+
+    void pushRemoteFreeNode(MpfrFloatData* data)
+    {
+        MpfrFloatData* head = __atomic_load_n(&mRemoteFreeNodes, __ATOMIC_RELAXED);
+        do data->nextFreeNode = head;
+        while(!__atomic_compare_exchange_n(&mRemoteFreeNodes, &head, data, true,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    // Returns the nodes released by other threads to their pools.
+    void collectRemoteFreeNodes()
+    {
+        MpfrFloatData* node =
+            __atomic_exchange_n(&mRemoteFreeNodes, (MpfrFloatData*)0,
+                                __ATOMIC_ACQUIRE);
+        while(node)
+        {
+            MpfrFloatData* next = node->nextFreeNode;
+            Pool& pool = mPools[node->mPoolIndex];
+            node->nextFreeNode = pool.mFirstFreeNode;
+            pool.mFirstFreeNode = node;
+            node = next;
+        }
+    }
+
+    static void createContainerKey()
+    {
+        pthread_key_create(&gContainerKey, &MpfrFloatDataContainer::park);
+    }
+
+    // Called on thread exit with the container of that thread.
+    static void park(void* data)
+    {
+        MpfrFloatDataContainer* container =
+            static_cast<MpfrFloatDataContainer*>(data);
+        sThreadContainer = 0;
+
+        pthread_mutex_lock(&gContainerMutex);
+        container->mNextIdleContainer = sIdleContainers;
+        sIdleContainers = container;
+        pthread_mutex_unlock(&gContainerMutex);
     }
 
  public:
-    MpfrFloatDataContainer():
-        mDefaultPrecision(256), mFirstFreeNode(0), mConst_0(0),
-        mConst_pi(0), mConst_e(0), mConst_log2(0), mConst_epsilon(0)
+    MpfrFloatDataContainer(unsigned long precision):
+        mPools(1, Pool(precision)), mCurrentPool(0), mRemoteFreeNodes(0),
+        mNextIdleContainer(0), mConst_epsilon(0)
     {}
 
-    ~MpfrFloatDataContainer()
+    static MpfrFloatDataContainer& current()
     {
-        for(size_t i = 0; i < mData.size(); ++i)
-            mpfr_clear(mData[i].mFloat);
+        MpfrFloatDataContainer* container = sThreadContainer;
+        return container ? *container : acquire();
+    }
+
+    // Gives the calling thread a container, preferring a parked one.
+    static MpfrFloatDataContainer& acquire()
+    {
+        pthread_once(&gContainerKeyOnce, &MpfrFloatDataContainer::createContainerKey);
+
+        pthread_mutex_lock(&gContainerMutex);
+        const unsigned long precision = gDefaultPrecision;
+        MpfrFloatDataContainer* container = sIdleContainers;
+        if(container) sIdleContainers = container->mNextIdleContainer;
+        pthread_mutex_unlock(&gContainerMutex);
+
+        if(container)
+        {
+            container->mNextIdleContainer = 0;
+            container->setDefaultPrecision(precision);
+        }
+        else
+            container = new MpfrFloatDataContainer(precision);
+
+        sThreadContainer = container;
+        pthread_setspecific(gContainerKey, container);
+        return *container;
     }
 
     MpfrFloatData* allocateMpfrFloatData(bool initToZero)
     {
-        if(mFirstFreeNode)
+        Pool& pool = currentPool();
+        if(!pool.mFirstFreeNode
+        && __atomic_load_n(&mRemoteFreeNodes, __ATOMIC_RELAXED))
+            collectRemoteFreeNodes();
+
+        if(pool.mFirstFreeNode)
         {
-            MpfrFloatData* node = mFirstFreeNode;
-            mFirstFreeNode = node->nextFreeNode;
+            MpfrFloatData* node = pool.mFirstFreeNode;
+            pool.mFirstFreeNode = node->nextFreeNode;
             if(initToZero) mpfr_set_si(node->mFloat, 0, GMP_RNDN);
-            ++(node->mRefCount);
+            node->mRefCount = 1;
             return node;
         }
 
-        mData.push_back(MpfrFloatData());
-        mpfr_init2(mData.back().mFloat, mDefaultPrecision);
+        mData.push_back(MpfrFloatData(this, mCurrentPool));
+        mpfr_init2(mData.back().mFloat, pool.mPrecision);
         if(initToZero) mpfr_set_si(mData.back().mFloat, 0, GMP_RNDN);
         return &mData.back();
     }
 
     void releaseMpfrFloatData(MpfrFloatData* data)
     {
-        if(--(data->mRefCount) == 0)
+        if(data->removeReference())
         {
-            data->nextFreeNode = mFirstFreeNode;
-            mFirstFreeNode = data;
+            if(data->mOwner == this)
+            {
+                Pool& pool = mPools[data->mPoolIndex];
+                data->nextFreeNode = pool.mFirstFreeNode;
+                pool.mFirstFreeNode = data;
+            }
+            else
+                data->mOwner->pushRemoteFreeNode(data);
         }
     }
 
+    // Only affects this thread's container; see MpfrFloat.hh.
     void setDefaultPrecision(unsigned long bits)
     {
-        if(bits != mDefaultPrecision)
+        if(bits != currentPool().mPrecision)
         {
-            mDefaultPrecision = bits;
-            for(size_t i = 0; i < mData.size(); ++i)
-                mpfr_prec_round(mData[i].mFloat, bits, GMP_RNDN);
-
-            if(mConst_pi) mpfr_const_pi(mConst_pi->mFloat, GMP_RNDN);
-            if(mConst_e)
-            {
-                mpfr_set_si(mConst_e->mFloat, 1, GMP_RNDN);
-                mpfr_exp(mConst_e->mFloat, mConst_e->mFloat, GMP_RNDN);
-            }
-            if(mConst_log2) mpfr_const_log2(mConst_log2->mFloat, GMP_RNDN);
+            selectPool(bits);
             if(mConst_epsilon) recalculateEpsilon();
         }
     }
 
-    unsigned long getDefaultPrecision() const
+    static void setGlobalDefaultPrecision(unsigned long bits)
     {
-        return mDefaultPrecision;
+        pthread_mutex_lock(&gContainerMutex);
+        gDefaultPrecision = bits;
+        pthread_mutex_unlock(&gContainerMutex);
+    }
+
+    unsigned long getDefaultPrecision()
+    {
+        return currentPool().mPrecision;
+    }
+
+    std::vector<char>& stringBuffer()
+    {
+        return mStringBuffer;
     }
 
     MpfrFloatData* const_0()
     {
-        if(!mConst_0) mConst_0 = allocateMpfrFloatData(true);
-        return mConst_0;
+        Pool& pool = currentPool();
+        if(!pool.mConst_0) pool.mConst_0 = allocateMpfrFloatData(true);
+        return pool.mConst_0;
     }
 
     MpfrFloat const_pi()
     {
-        if(!mConst_pi)
+        Pool& pool = currentPool();
+        if(!pool.mConst_pi)
         {
-            mConst_pi = allocateMpfrFloatData(false);
-            mpfr_const_pi(mConst_pi->mFloat, GMP_RNDN);
+            pool.mConst_pi = allocateMpfrFloatData(false);
+            mpfr_const_pi(pool.mConst_pi->mFloat, GMP_RNDN);
         }
-        return MpfrFloat(mConst_pi);
+        return MpfrFloat(pool.mConst_pi);
     }
 
     MpfrFloat const_e()
     {
-        if(!mConst_e)
+        Pool& pool = currentPool();
+        if(!pool.mConst_e)
         {
-            mConst_e = allocateMpfrFloatData(false);
-            mpfr_set_si(mConst_e->mFloat, 1, GMP_RNDN);
-            mpfr_exp(mConst_e->mFloat, mConst_e->mFloat, GMP_RNDN);
+            pool.mConst_e = allocateMpfrFloatData(false);
+            mpfr_set_si(pool.mConst_e->mFloat, 1, GMP_RNDN);
+            mpfr_exp(pool.mConst_e->mFloat, pool.mConst_e->mFloat, GMP_RNDN);
         }
-        return MpfrFloat(mConst_e);
+        return MpfrFloat(pool.mConst_e);
     }
 
     MpfrFloat const_log2()
     {
-        if(!mConst_log2)
+        Pool& pool = currentPool();
+        if(!pool.mConst_log2)
         {
-            mConst_log2 = allocateMpfrFloatData(false);
-            mpfr_const_log2(mConst_log2->mFloat, GMP_RNDN);
+            pool.mConst_log2 = allocateMpfrFloatData(false);
+            mpfr_const_log2(pool.mConst_log2->mFloat, GMP_RNDN);
         }
-        return MpfrFloat(mConst_log2);
+        return MpfrFloat(pool.mConst_log2);
+    }
+
+    // The rest are derived from the ones above.
+    MpfrFloat const_einv()
+    {
+        Pool& pool = currentPool();
+        if(!pool.mConst_einv)
+        {
+            const MpfrFloat e = const_e();
+            pool.mConst_einv = allocateMpfrFloatData(false);
+            mpfr_ui_div(pool.mConst_einv->mFloat, 1, e.mData->mFloat, GMP_RNDN);
+        }
+        return MpfrFloat(pool.mConst_einv);
+    }
+
+    MpfrFloat const_log10()
+    {
+        Pool& pool = currentPool();
+        if(!pool.mConst_log10)
+        {
+            pool.mConst_log10 = allocateMpfrFloatData(false);
+            mpfr_set_si(pool.mConst_log10->mFloat, 10, GMP_RNDN);
+            mpfr_log(pool.mConst_log10->mFloat, pool.mConst_log10->mFloat,
+                     GMP_RNDN);
+        }
+        return MpfrFloat(pool.mConst_log10);
+    }
+
+    MpfrFloat const_log2inv()
+    {
+        Pool& pool = currentPool();
+        if(!pool.mConst_log2inv)
+        {
+            const MpfrFloat log2 = const_log2();
+            pool.mConst_log2inv = allocateMpfrFloatData(false);
+            mpfr_ui_div(pool.mConst_log2inv->mFloat, 1, log2.mData->mFloat,
+                        GMP_RNDN);
+        }
+        return MpfrFloat(pool.mConst_log2inv);
+    }
+
+    MpfrFloat const_log10inv()
+    {
+        Pool& pool = currentPool();
+        if(!pool.mConst_log10inv)
+        {
+            const MpfrFloat log10 = const_log10();
+            pool.mConst_log10inv = allocateMpfrFloatData(false);
+            mpfr_ui_div(pool.mConst_log10inv->mFloat, 1, log10.mData->mFloat,
+                        GMP_RNDN);
+        }
+        return MpfrFloat(pool.mConst_log10inv);
+    }
+
+    MpfrFloat const_deg_to_rad()
+    {
+        Pool& pool = currentPool();
+        if(!pool.mConst_deg_to_rad)
+        {
+            const MpfrFloat pi = const_pi();
+            pool.mConst_deg_to_rad = allocateMpfrFloatData(false);
+            mpfr_div_ui(pool.mConst_deg_to_rad->mFloat, pi.mData->mFloat, 180,
+                        GMP_RNDN);
+        }
+        return MpfrFloat(pool.mConst_deg_to_rad);
+    }
+
+    MpfrFloat const_rad_to_deg()
+    {
+        Pool& pool = currentPool();
+        if(!pool.mConst_rad_to_deg)
+        {
+            const MpfrFloat pi = const_pi();
+            pool.mConst_rad_to_deg = allocateMpfrFloatData(false);
+            mpfr_ui_div(pool.mConst_rad_to_deg->mFloat, 180, pi.mData->mFloat,
+                        GMP_RNDN);
+        }
+        return MpfrFloat(pool.mConst_rad_to_deg);
     }
 
     MpfrFloat const_epsilon()
@@ -145,16 +385,22 @@ class MpfrFloat::MpfrFloatDataContainer
 };
 
 
+__thread MpfrFloat::MpfrFloatDataContainer*
+MpfrFloat::MpfrFloatDataContainer::sThreadContainer = 0;
+
+MpfrFloat::MpfrFloatDataContainer*
+MpfrFloat::MpfrFloatDataContainer::sIdleContainers = 0;
+
+
 //===========================================================================
 // Shared data
 //===========================================================================
-// This should ensure that the container is not accessed by any MpfrFloat
-// instance before it has been constructed or after it has been destroyed
-// (which might otherwise happen if MpfrFloat is instantiated globally.)
+// The containers are created on first use and never destroyed, so MpfrFloat
+// instances can safely be created and destroyed at any time (including
+// global instances and ones that outlive the thread that created them.)
 MpfrFloat::MpfrFloatDataContainer& MpfrFloat::mpfrFloatDataContainer()
 {
-    static MpfrFloat::MpfrFloatDataContainer container;
-    return container;
+    return MpfrFloatDataContainer::current();
 }
 
 
@@ -163,6 +409,7 @@ MpfrFloat::MpfrFloatDataContainer& MpfrFloat::mpfrFloatDataContainer()
 //===========================================================================
 void MpfrFloat::setDefaultMantissaBits(unsigned long bits)
 {
+    MpfrFloatDataContainer::setGlobalDefaultPrecision(bits);
     mpfrFloatDataContainer().setDefaultPrecision(bits);
 }
 
@@ -173,12 +420,12 @@ unsigned long MpfrFloat::getCurrentDefaultMantissaBits()
 
 inline void MpfrFloat::copyIfShared()
 {
-    if(mData->mRefCount > 1)
+    if(mData->isShared())
     {
-        --(mData->mRefCount);
         MpfrFloatData* oldData = mData;
         mData = mpfrFloatDataContainer().allocateMpfrFloatData(false);
         mpfr_set(mData->mFloat, oldData->mFloat, GMP_RNDN);
+        mpfrFloatDataContainer().releaseMpfrFloatData(oldData);
     }
 }
 
@@ -194,13 +441,13 @@ MpfrFloat::MpfrFloat(MpfrFloatData* data):
     mData(data)
 {
     assert(data != 0);
-    ++(mData->mRefCount);
+    mData->addReference();
 }
 
 MpfrFloat::MpfrFloat():
     mData(mpfrFloatDataContainer().const_0())
 {
-    ++(mData->mRefCount);
+    mData->addReference();
 }
 
 MpfrFloat::MpfrFloat(double value)
@@ -208,7 +455,7 @@ MpfrFloat::MpfrFloat(double value)
     if(value == 0.0)
     {
         mData = mpfrFloatDataContainer().const_0();
-        ++(mData->mRefCount);
+        mData->addReference();
     }
     else
     {
@@ -222,7 +469,7 @@ MpfrFloat::MpfrFloat(long double value)
     if(value == 0.0L)
     {
         mData = mpfrFloatDataContainer().const_0();
-        ++(mData->mRefCount);
+        mData->addReference();
     }
     else
     {
@@ -236,7 +483,7 @@ MpfrFloat::MpfrFloat(long value)
     if(value == 0)
     {
         mData = mpfrFloatDataContainer().const_0();
-        ++(mData->mRefCount);
+        mData->addReference();
     }
     else
     {
@@ -250,7 +497,7 @@ MpfrFloat::MpfrFloat(int value)
     if(value == 0)
     {
         mData = mpfrFloatDataContainer().const_0();
-        ++(mData->mRefCount);
+        mData->addReference();
     }
     else
     {
@@ -273,7 +520,7 @@ MpfrFloat::~MpfrFloat()
 MpfrFloat::MpfrFloat(const MpfrFloat& rhs):
     mData(rhs.mData)
 {
-    ++(mData->mRefCount);
+    mData->addReference();
 }
 
 MpfrFloat& MpfrFloat::operator=(const MpfrFloat& rhs)
@@ -282,7 +529,7 @@ MpfrFloat& MpfrFloat::operator=(const MpfrFloat& rhs)
     {
         mpfrFloatDataContainer().releaseMpfrFloatData(mData);
         mData = rhs.mData;
-        ++(mData->mRefCount);
+        mData->addReference();
     }
     return *this;
 }
@@ -293,13 +540,13 @@ MpfrFloat& MpfrFloat::operator=(double value)
     {
         mpfrFloatDataContainer().releaseMpfrFloatData(mData);
         mData = mpfrFloatDataContainer().const_0();
-        ++(mData->mRefCount);
+        mData->addReference();
     }
     else
     {
-        if(mData->mRefCount > 1)
+        if(mData->isShared())
         {
-            --(mData->mRefCount);
+            mpfrFloatDataContainer().releaseMpfrFloatData(mData);
             mData = mpfrFloatDataContainer().allocateMpfrFloatData(false);
         }
         mpfr_set_d(mData->mFloat, value, GMP_RNDN);
@@ -313,13 +560,13 @@ MpfrFloat& MpfrFloat::operator=(long double value)
     {
         mpfrFloatDataContainer().releaseMpfrFloatData(mData);
         mData = mpfrFloatDataContainer().const_0();
-        ++(mData->mRefCount);
+        mData->addReference();
     }
     else
     {
-        if(mData->mRefCount > 1)
+        if(mData->isShared())
         {
-            --(mData->mRefCount);
+            mpfrFloatDataContainer().releaseMpfrFloatData(mData);
             mData = mpfrFloatDataContainer().allocateMpfrFloatData(false);
         }
         mpfr_set_ld(mData->mFloat, value, GMP_RNDN);
@@ -333,13 +580,13 @@ MpfrFloat& MpfrFloat::operator=(long value)
     {
         mpfrFloatDataContainer().releaseMpfrFloatData(mData);
         mData = mpfrFloatDataContainer().const_0();
-        ++(mData->mRefCount);
+        mData->addReference();
     }
     else
     {
-        if(mData->mRefCount > 1)
+        if(mData->isShared())
         {
-            --(mData->mRefCount);
+            mpfrFloatDataContainer().releaseMpfrFloatData(mData);
             mData = mpfrFloatDataContainer().allocateMpfrFloatData(false);
         }
         mpfr_set_si(mData->mFloat, value, GMP_RNDN);
@@ -353,13 +600,13 @@ MpfrFloat& MpfrFloat::operator=(int value)
     {
         mpfrFloatDataContainer().releaseMpfrFloatData(mData);
         mData = mpfrFloatDataContainer().const_0();
-        ++(mData->mRefCount);
+        mData->addReference();
     }
     else
     {
-        if(mData->mRefCount > 1)
+        if(mData->isShared())
         {
-            --(mData->mRefCount);
+            mpfrFloatDataContainer().releaseMpfrFloatData(mData);
             mData = mpfrFloatDataContainer().allocateMpfrFloatData(false);
         }
         mpfr_set_si(mData->mFloat, value, GMP_RNDN);
@@ -370,9 +617,9 @@ MpfrFloat& MpfrFloat::operator=(int value)
 /*
 MpfrFloat& MpfrFloat::operator=(const char* value)
 {
-    if(mData->mRefCount > 1)
+    if(mData->isShared())
     {
-        --(mData->mRefCount);
+        mpfrFloatDataContainer().releaseMpfrFloatData(mData);
         mData = mpfrFloatDataContainer().allocateMpfrFloatData(false);
     }
 
@@ -398,25 +645,63 @@ void MpfrFloat::parseValue(const char* value, char** endptr)
 // Data getters
 //===========================================================================
 template<>
-void MpfrFloat::get_raw_mpfr_data<mpfr_t>(mpfr_t& dest_mpfr_t)
+void MpfrFloat::get_raw_mpfr_data<mpfr_t>(mpfr_t& dest_mpfr_t) const
 {
     std::memcpy(&dest_mpfr_t, mData->mFloat, sizeof(mpfr_t));
 }
 
+template<>
+void MpfrFloat::set_raw_mpfr_data<mpfr_t>(const mpfr_t& src_mpfr_t)
+{
+    if(mData->isShared())
+    {
+        mpfrFloatDataContainer().releaseMpfrFloatData(mData);
+        mData = mpfrFloatDataContainer().allocateMpfrFloatData(false);
+    }
+    mpfr_set(mData->mFloat, src_mpfr_t, GMP_RNDN);
+}
+
 const char* MpfrFloat::getAsString(unsigned precision) const
+{
+    std::vector<char>& str = mpfrFloatDataContainer().stringBuffer();
+    str.resize(getAsStringBufferSize(precision));
+    getAsString(precision, &str[0], str.size());
+    return &str[0];
+}
+
+std::size_t MpfrFloat::getAsStringBufferSize(unsigned precision)
+{
+    // Sign, decimal point, exponent and terminating null fit in 30 chars.
+    return std::size_t(precision) + 30;
+}
+
+std::size_t MpfrFloat::getAsString(unsigned precision,
+                                   char* buffer, std::size_t bufferSize) const
 {
 #if(MPFR_VERSION_MAJOR < 2 || (MPFR_VERSION_MAJOR == 2 && MPFR_VERSION_MINOR < 4))
-    static const char* retval =
+    static const char* const retval =
         "[mpfr_snprintf() is not supported in mpfr versions prior to 2.4]";
-    return retval;
+    const std::size_t length = std::strlen(retval);
+    if(bufferSize > 0)
+    {
+        const std::size_t copied = length < bufferSize ? length : bufferSize-1;
+        std::memcpy(buffer, retval, copied);
+        buffer[copied] = 0;
+    }
+    return length;
 #else
-    static std::vector<char> str;
-    str.resize(precision+30);
-    mpfr_snprintf(&(str[0]), precision+30, "%.*RNg", precision, mData->mFloat);
-    return &(str[0]);
+    const int length = mpfr_snprintf(buffer, bufferSize, "%.*RNg",
+                                     precision, mData->mFloat);
+    return length < 0 ? 0 : std::size_t(length);
 #endif
 }
 
+void MpfrFloat::getAsString(unsigned precision, std::string& dest) const
+{
+    dest.resize(getAsStringBufferSize(precision));
+    dest.resize(getAsString(precision, &dest[0], dest.size()));
+}
+
 bool MpfrFloat::isInteger() const
 {
     return mpfr_integer_p(mData->mFloat) != 0;
@@ -970,6 +1255,36 @@ MpfrFloat MpfrFloat::const_log2()
     return mpfrFloatDataContainer().const_log2();
 }
 
+MpfrFloat MpfrFloat::const_einv()
+{
+    return mpfrFloatDataContainer().const_einv();
+}
+
+MpfrFloat MpfrFloat::const_log10()
+{
+    return mpfrFloatDataContainer().const_log10();
+}
+
+MpfrFloat MpfrFloat::const_log2inv()
+{
+    return mpfrFloatDataContainer().const_log2inv();
+}
+
+MpfrFloat MpfrFloat::const_log10inv()
+{
+    return mpfrFloatDataContainer().const_log10inv();
+}
+
+MpfrFloat MpfrFloat::const_deg_to_rad()
+{
+    return mpfrFloatDataContainer().const_deg_to_rad();
+}
+
+MpfrFloat MpfrFloat::const_rad_to_deg()
+{
+    return mpfrFloatDataContainer().const_rad_to_deg();
+}
+
 MpfrFloat MpfrFloat::someEpsilon()
 {
     return mpfrFloatDataContainer().const_epsilon();
@@ -2,13 +2,21 @@
 #define ONCE_FP_MPFR_FLOAT_
 
 #include <iostream>
+#include <string>
+#include <cstddef>
 
 class MpfrFloat
 {
  public:
     /* A default of 256 bits will be used unless changed with this function.
-       Note that all existing and cached GMP objects will be resized to the
-       specified precision (which can be a somewhat heavy operation).
+       Existing objects keep the precision they were created with; objects
+       created afterwards get the new one. The data is pooled by precision
+       and the constants below are cached per precision, so switching back
+       and forth between precisions is cheap.
+       Each thread has a precision of its own: this function changes it for
+       the calling thread and sets the precision that threads which start
+       using MpfrFloat afterwards will begin with. Values may be copied
+       and destroyed freely between threads.
     */
     static void setDefaultMantissaBits(unsigned long bits);
 
@@ -73,15 +81,37 @@ class MpfrFloat
        functions.
      */
     template<typename Mpfr_t>
-    void get_raw_mpfr_data(Mpfr_t& dest_mpfr_t);
+    void get_raw_mpfr_data(Mpfr_t& dest_mpfr_t) const;
+
+    /* Sets the value of this object from a raw mpfr_t (rounded to the
+       precision of this object, unless its data has to be unshared first,
+       in which case the current default precision is used.)
+     */
+    template<typename Mpfr_t>
+    void set_raw_mpfr_data(const Mpfr_t& src_mpfr_t);
 
 
     /* Note that the returned char* points to an internal (shared) buffer
        which will be valid until the next time this function is called
-       (by any object).
+       (by any object in the same thread).
     */
     const char* getAsString(unsigned precision) const;
 
+    /* Same as above, but writes into a buffer supplied by the caller, so
+       it is reentrant and doesn't allocate. The return value is the length
+       of the full string, as with snprintf(): the output was truncated if
+       it's not less than bufferSize. A buffer of getAsStringBufferSize()
+       characters is always large enough.
+       Only the requested number of significant digits is converted, so a
+       few leading digits of a very high-precision value are cheap to get.
+    */
+    std::size_t getAsString(unsigned precision,
+                            char* buffer, std::size_t bufferSize) const;
+    static std::size_t getAsStringBufferSize(unsigned precision);
+
+    /* Replaces the contents of dest, reusing its capacity. */
+    void getAsString(unsigned precision, std::string& dest) const;
+
     bool isInteger() const;
     long toInt() const;
     double toDouble() const;
@@ -162,11 +192,17 @@ class MpfrFloat
 
     static MpfrFloat parseString(const char* str, char** endptr);
 
-    // These values are cached (and recalculated every time the mantissa bits
-    // change), so it's efficient to call these repeatedly:
+    // These values are cached for each precision, so it's efficient to call
+    // these repeatedly:
     static MpfrFloat const_pi();
     static MpfrFloat const_e();
     static MpfrFloat const_log2();
+    static MpfrFloat const_einv();      // 1/e
+    static MpfrFloat const_log10();     // log(10)
+    static MpfrFloat const_log2inv();   // 1/log(2)
+    static MpfrFloat const_log10inv();  // 1/log(10)
+    static MpfrFloat const_deg_to_rad(); // pi/180
+    static MpfrFloat const_rad_to_deg(); // 180/pi
     static MpfrFloat someEpsilon();
 
 
@@ -0,0 +1,489 @@
+#include <cstring>
+#include <stdint.h>
+#include "numformat.h"
+
+using std::string;
+
+/* ****************** Shortest digits *************************************** */
+
+/* Grisu2 (F. Loitsch, "Printing floating-point numbers quickly and
+   accurately with integers", 2010): the value and its rounding boundaries
+   are scaled by a cached power of ten into 64-bit integers, and as few
+   digits are generated as it takes to stay strictly within the boundaries.
+   The result always reads back as the same double, and is the shortest
+   such string for all but a tiny fraction of values. */
+
+namespace {
+
+/* f * 2^e */
+struct DiyFp {
+	uint64_t f;
+	int e;
+
+	DiyFp() {
+		f = 0;
+		e = 0;
+	}
+
+	DiyFp(uint64_t f_, int e_) {
+		f = f_;
+		e = e_;
+	}
+};
+
+struct CachedPower {
+	uint64_t f;
+	int e;
+};
+
+/* 10^k for k = -348, -340, ..., 340, rounded to 64-bit significands */
+const CachedPower c_cachedPowers[] = {
+	{ 0xfa8fd5a0081c0288ULL, -1220 }, /* 1e-348 */
+	{ 0xbaaee17fa23ebf76ULL, -1193 }, /* 1e-340 */
+	{ 0x8b16fb203055ac76ULL, -1166 }, /* 1e-332 */
+	{ 0xcf42894a5dce35eaULL, -1140 }, /* 1e-324 */
+	{ 0x9a6bb0aa55653b2dULL, -1113 }, /* 1e-316 */
+	{ 0xe61acf033d1a45dfULL, -1087 }, /* 1e-308 */
+	{ 0xab70fe17c79ac6caULL, -1060 }, /* 1e-300 */
+	{ 0xff77b1fcbebcdc4fULL, -1034 }, /* 1e-292 */
+	{ 0xbe5691ef416bd60cULL, -1007 }, /* 1e-284 */
+	{ 0x8dd01fad907ffc3cULL, -980 }, /* 1e-276 */
+	{ 0xd3515c2831559a83ULL, -954 }, /* 1e-268 */
+	{ 0x9d71ac8fada6c9b5ULL, -927 }, /* 1e-260 */
+	{ 0xea9c227723ee8bcbULL, -901 }, /* 1e-252 */
+	{ 0xaecc49914078536dULL, -874 }, /* 1e-244 */
+	{ 0x823c12795db6ce57ULL, -847 }, /* 1e-236 */
+	{ 0xc21094364dfb5637ULL, -821 }, /* 1e-228 */
+	{ 0x9096ea6f3848984fULL, -794 }, /* 1e-220 */
+	{ 0xd77485cb25823ac7ULL, -768 }, /* 1e-212 */
+	{ 0xa086cfcd97bf97f4ULL, -741 }, /* 1e-204 */
+	{ 0xef340a98172aace5ULL, -715 }, /* 1e-196 */
+	{ 0xb23867fb2a35b28eULL, -688 }, /* 1e-188 */
+	{ 0x84c8d4dfd2c63f3bULL, -661 }, /* 1e-180 */
+	{ 0xc5dd44271ad3cdbaULL, -635 }, /* 1e-172 */
+	{ 0x936b9fcebb25c996ULL, -608 }, /* 1e-164 */
+	{ 0xdbac6c247d62a584ULL, -582 }, /* 1e-156 */
+	{ 0xa3ab66580d5fdaf6ULL, -555 }, /* 1e-148 */
+	{ 0xf3e2f893dec3f126ULL, -529 }, /* 1e-140 */
+	{ 0xb5b5ada8aaff80b8ULL, -502 }, /* 1e-132 */
+	{ 0x87625f056c7c4a8bULL, -475 }, /* 1e-124 */
+	{ 0xc9bcff6034c13053ULL, -449 }, /* 1e-116 */
+	{ 0x964e858c91ba2655ULL, -422 }, /* 1e-108 */
+	{ 0xdff9772470297ebdULL, -396 }, /* 1e-100 */
+	{ 0xa6dfbd9fb8e5b88fULL, -369 }, /* 1e-92 */
+	{ 0xf8a95fcf88747d94ULL, -343 }, /* 1e-84 */
+	{ 0xb94470938fa89bcfULL, -316 }, /* 1e-76 */
+	{ 0x8a08f0f8bf0f156bULL, -289 }, /* 1e-68 */
+	{ 0xcdb02555653131b6ULL, -263 }, /* 1e-60 */
+	{ 0x993fe2c6d07b7facULL, -236 }, /* 1e-52 */
+	{ 0xe45c10c42a2b3b06ULL, -210 }, /* 1e-44 */
+	{ 0xaa242499697392d3ULL, -183 }, /* 1e-36 */
+	{ 0xfd87b5f28300ca0eULL, -157 }, /* 1e-28 */
+	{ 0xbce5086492111aebULL, -130 }, /* 1e-20 */
+	{ 0x8cbccc096f5088ccULL, -103 }, /* 1e-12 */
+	{ 0xd1b71758e219652cULL, -77 }, /* 1e-4 */
+	{ 0x9c40000000000000ULL, -50 }, /* 1e4 */
+	{ 0xe8d4a51000000000ULL, -24 }, /* 1e12 */
+	{ 0xad78ebc5ac620000ULL, 3 }, /* 1e20 */
+	{ 0x813f3978f8940984ULL, 30 }, /* 1e28 */
+	{ 0xc097ce7bc90715b3ULL, 56 }, /* 1e36 */
+	{ 0x8f7e32ce7bea5c70ULL, 83 }, /* 1e44 */
+	{ 0xd5d238a4abe98068ULL, 109 }, /* 1e52 */
+	{ 0x9f4f2726179a2245ULL, 136 }, /* 1e60 */
+	{ 0xed63a231d4c4fb27ULL, 162 }, /* 1e68 */
+	{ 0xb0de65388cc8ada8ULL, 189 }, /* 1e76 */
+	{ 0x83c7088e1aab65dbULL, 216 }, /* 1e84 */
+	{ 0xc45d1df942711d9aULL, 242 }, /* 1e92 */
+	{ 0x924d692ca61be758ULL, 269 }, /* 1e100 */
+	{ 0xda01ee641a708deaULL, 295 }, /* 1e108 */
+	{ 0xa26da3999aef774aULL, 322 }, /* 1e116 */
+	{ 0xf209787bb47d6b85ULL, 348 }, /* 1e124 */
+	{ 0xb454e4a179dd1877ULL, 375 }, /* 1e132 */
+	{ 0x865b86925b9bc5c2ULL, 402 }, /* 1e140 */
+	{ 0xc83553c5c8965d3dULL, 428 }, /* 1e148 */
+	{ 0x952ab45cfa97a0b3ULL, 455 }, /* 1e156 */
+	{ 0xde469fbd99a05fe3ULL, 481 }, /* 1e164 */
+	{ 0xa59bc234db398c25ULL, 508 }, /* 1e172 */
+	{ 0xf6c69a72a3989f5cULL, 534 }, /* 1e180 */
+	{ 0xb7dcbf5354e9beceULL, 561 }, /* 1e188 */
+	{ 0x88fcf317f22241e2ULL, 588 }, /* 1e196 */
+	{ 0xcc20ce9bd35c78a5ULL, 614 }, /* 1e204 */
+	{ 0x98165af37b2153dfULL, 641 }, /* 1e212 */
+	{ 0xe2a0b5dc971f303aULL, 667 }, /* 1e220 */
+	{ 0xa8d9d1535ce3b396ULL, 694 }, /* 1e228 */
+	{ 0xfb9b7cd9a4a7443cULL, 720 }, /* 1e236 */
+	{ 0xbb764c4ca7a44410ULL, 747 }, /* 1e244 */
+	{ 0x8bab8eefb6409c1aULL, 774 }, /* 1e252 */
+	{ 0xd01fef10a657842cULL, 800 }, /* 1e260 */
+	{ 0x9b10a4e5e9913129ULL, 827 }, /* 1e268 */
+	{ 0xe7109bfba19c0c9dULL, 853 }, /* 1e276 */
+	{ 0xac2820d9623bf429ULL, 880 }, /* 1e284 */
+	{ 0x80444b5e7aa7cf85ULL, 907 }, /* 1e292 */
+	{ 0xbf21e44003acdd2dULL, 933 }, /* 1e300 */
+	{ 0x8e679c2f5e44ff8fULL, 960 }, /* 1e308 */
+	{ 0xd433179d9c8cb841ULL, 986 }, /* 1e316 */
+	{ 0x9e19db92b4e31ba9ULL, 1013 }, /* 1e324 */
+	{ 0xeb96bf6ebadf77d9ULL, 1039 }, /* 1e332 */
+	{ 0xaf87023b9bf0ee6bULL, 1066 }, /* 1e340 */
+};
+
+const uint64_t c_hiddenBit = uint64_t(1) << 52;
+const uint64_t c_significandMask = c_hiddenBit - 1;
+const int c_exponentBias = 0x3FF + 52;
+
+const uint32_t c_pow10[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/* product rounded to the upper 64 bits */
+DiyFp multiply(const DiyFp& x, const DiyFp& y) {
+	const uint64_t mask = 0xFFFFFFFFu;
+	const uint64_t a = x.f >> 32, b = x.f & mask;
+	const uint64_t c = y.f >> 32, d = y.f & mask;
+	const uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t tmp = (bd >> 32) + (ad & mask) + (bc & mask);
+	tmp += uint64_t(1) << 31;
+	return DiyFp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64);
+}
+
+DiyFp normalize(DiyFp x) {
+	const int shift = __builtin_clzll(x.f);
+	x.f <<= shift;
+	x.e -= shift;
+	return x;
+}
+
+/* cached power c with c * 2^e having its binary exponent in [-60, -32];
+   c = 10^-k */
+DiyFp cachedPower(int e, int& k) {
+	const double dk = (-61 - e) * 0.30102999566398114 + 347;
+	int ik = int(dk);
+	if(dk - ik > 0.0)
+		ik++;
+	const unsigned index = unsigned(ik >> 3) + 1;
+	k = -(-348 + int(index) * 8);
+	return DiyFp(c_cachedPowers[index].f, c_cachedPowers[index].e);
+}
+
+unsigned countDigits(uint32_t n) {
+	unsigned count = 1;
+	while(count < 10 && n >= c_pow10[count])
+		count++;
+	return count;
+}
+
+/* moves the last digit towards w while that stays within the boundaries */
+void roundWeed(char* digits, int n, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t wpw) {
+	while(rest < wpw && delta - rest >= tenKappa &&
+	      (rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw)) {
+		digits[n - 1]--;
+		rest += tenKappa;
+	}
+}
+
+/* digits of the scaled value w, with the upper boundary mp and
+   delta = mp - lower boundary */
+int generateDigits(const DiyFp& w, const DiyFp& mp, uint64_t delta, char* digits, int& k) {
+	const DiyFp one(uint64_t(1) << -mp.e, mp.e);
+	const uint64_t wpw = mp.f - w.f;
+	uint32_t p1 = uint32_t(mp.f >> -one.e);
+	uint64_t p2 = mp.f & (one.f - 1);
+	int kappa = countDigits(p1);
+	int n = 0;
+
+	while(kappa > 0) {
+		const uint32_t divisor = c_pow10[kappa - 1];
+		const uint32_t d = p1 / divisor;
+		p1 %= divisor;
+		if(d || n)
+			digits[n++] = char('0' + d);
+		kappa--;
+		const uint64_t rest = (uint64_t(p1) << -one.e) + p2;
+		if(rest <= delta) {
+			k += kappa;
+			roundWeed(digits, n, delta, rest, uint64_t(c_pow10[kappa]) << -one.e, wpw);
+			return n;
+		}
+	}
+
+	for(;;) {
+		p2 *= 10;
+		delta *= 10;
+		const char d = char(p2 >> -one.e);
+		if(d || n)
+			digits[n++] = char('0' + d);
+		p2 &= one.f - 1;
+		kappa--;
+		if(p2 < delta) {
+			k += kappa;
+			const int index = -kappa;
+			roundWeed(digits, n, delta, p2, one.f, wpw * (index < 10 ? c_pow10[index] : 0));
+			return n;
+		}
+	}
+}
+
+/* Writes the shortest digits of a finite positive value, without leading
+   or trailing zeros, and returns their number. value = 0.digits * 10^point */
+int shortestDigits(double value, char* digits, int& point) {
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	const int biasedExponent = int(bits >> 52) & 0x7FF;
+	const uint64_t significand = bits & c_significandMask;
+
+	DiyFp v;
+	if(biasedExponent != 0)
+		v = DiyFp(significand + c_hiddenBit, biasedExponent - c_exponentBias);
+	else
+		v = DiyFp(significand, 1 - c_exponentBias);
+
+	/* boundaries halfway to the neighbouring doubles; the lower one is
+	   closer when v is a power of two */
+	DiyFp plus = DiyFp((v.f << 1) + 1, v.e - 1);
+	while(!(plus.f & (c_hiddenBit << 1))) {
+		plus.f <<= 1;
+		plus.e--;
+	}
+	plus.f <<= 64 - 52 - 2;
+	plus.e -= 64 - 52 - 2;
+	DiyFp minus = (v.f == c_hiddenBit) ? DiyFp((v.f << 2) - 1, v.e - 2) : DiyFp((v.f << 1) - 1, v.e - 1);
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+
+	int k;
+	const DiyFp c = cachedPower(plus.e, k);
+	const DiyFp w = multiply(normalize(v), c);
+	DiyFp wp = multiply(plus, c);
+	DiyFp wm = multiply(minus, c);
+	wm.f++;
+	wp.f--;
+
+	const int n = generateDigits(w, wp, wp.f - wm.f, digits, k);
+	int end = n;
+	while(end > 1 && digits[end - 1] == '0') {
+		end--;
+		k++;
+	}
+	point = end + k;
+	return end;
+}
+
+/* ****************** Text output ******************************************* */
+
+/* Rounds to the first 'keep' digits, halves away from zero, and returns
+   the new number of digits (0 when everything rounded away). */
+int roundDigits(char* digits, int n, int keep, int& point) {
+	if(keep >= n)
+		return n;
+	if(keep < 0)
+		return 0;
+
+	const bool up = digits[keep] >= '5';
+	n = keep;
+	if(!up)
+		return n;
+
+	while(n > 0 && digits[n - 1] == '9')
+		n--;
+	if(n == 0) {
+		digits[0] = '1';
+		point++;
+		return 1;
+	}
+	digits[n - 1]++;
+	return n;
+}
+
+char* writeZeros(char* p, int count) {
+	for(; count > 0; count--)
+		*p++ = '0';
+	return p;
+}
+
+/* digits (n == 0 is zero) with the decimal point 'point' digits from the
+   left, padded to at least 'decimals' digits after it */
+char* writePlain(char* p, const char* digits, int n, int point, int decimals) {
+	if(n == 0)
+		point = 0;
+
+	if(point <= 0) {
+		*p++ = '0';
+		const int fraction = n - point;
+		if(fraction > 0 || decimals > 0) {
+			*p++ = '.';
+			p = writeZeros(p, -point);
+			std::memcpy(p, digits, n);
+			p += n;
+			p = writeZeros(p, decimals - fraction);
+		}
+	}
+	else if(point >= n) {
+		std::memcpy(p, digits, n);
+		p = writeZeros(p + n, point - n);
+		if(decimals > 0) {
+			*p++ = '.';
+			p = writeZeros(p, decimals);
+		}
+	}
+	else {
+		std::memcpy(p, digits, point);
+		p += point;
+		*p++ = '.';
+		std::memcpy(p, digits + point, n - point);
+		p += n - point;
+		p = writeZeros(p, decimals - (n - point));
+	}
+	return p;
+}
+
+/* e+05, e-12, e+308 */
+char* writeExponent(char* p, int exponent) {
+	*p++ = 'e';
+	*p++ = (exponent < 0) ? '-' : '+';
+	if(exponent < 0)
+		exponent = -exponent;
+	if(exponent >= 100)
+		*p++ = char('0' + exponent / 100);
+	*p++ = char('0' + exponent / 10 % 10);
+	*p++ = char('0' + exponent % 10);
+	return p;
+}
+
+}
+
+/* ****************** NumberFormat ****************************************** */
+
+NumberFormat::NumberFormat() {
+	m_mode = SHORTEST;
+	m_digits = c_maxDigits;
+}
+
+NumberFormat::NumberFormat(Mode mode, unsigned digits) {
+	const unsigned min = (mode == FIXED) ? 0 : 1;
+	m_mode = mode;
+	m_digits = (digits < min) ? min : (digits > c_maxDigits) ? c_maxDigits : digits;
+}
+
+unsigned NumberFormat::format(double value, char* buffer) const {
+	char* p = buffer;
+	if(value != value) {
+		std::strcpy(buffer, "nan");
+		return 3;
+	}
+
+	const bool negative = value < 0;
+	if(negative)
+		value = -value;
+	if(value > 1.7976931348623157e308) {
+		std::strcpy(buffer, negative ? "-inf" : "inf");
+		return negative ? 4 : 3;
+	}
+
+	char digits[32];
+	int point = 0;
+	int n = (value != 0) ? shortestDigits(value, digits, point) : 0;
+
+	Mode mode = m_mode;
+	/* fixed notation of huge values would be mostly made-up zeros */
+	if(mode == FIXED && point > 21)
+		mode = SHORTEST;
+
+	int digitCount = int(m_digits);
+	switch(mode) {
+		case SHORTEST:
+			break;
+		case FIXED:
+			n = roundDigits(digits, n, point + digitCount, point);
+			break;
+		case SCIENTIFIC:
+		case ENGINEERING:
+			n = roundDigits(digits, n, digitCount, point);
+			break;
+	}
+
+	if(negative && n > 0)
+		*p++ = '-';
+
+	const int exponent = (n > 0) ? point - 1 : 0;
+	switch(mode) {
+		case SHORTEST:
+			if(exponent >= -5 && exponent < 15)
+				p = writePlain(p, digits, n, point, 0);
+			else
+				p = writeExponent(writePlain(p, digits, n, 1, 0), exponent);
+			break;
+		case FIXED:
+			p = writePlain(p, digits, n, point, digitCount);
+			break;
+		case SCIENTIFIC:
+			p = writeExponent(writePlain(p, digits, n, 1, digitCount - 1), exponent);
+			break;
+		case ENGINEERING: {
+			const int exponent3 = (exponent >= 0) ? exponent / 3 * 3 : -((2 - exponent) / 3 * 3);
+			const int integerDigits = exponent - exponent3 + 1;
+			const int decimals = (digitCount > integerDigits) ? digitCount - integerDigits : 0;
+			p = writeExponent(writePlain(p, digits, n, integerDigits, decimals), exponent3);
+			break;
+		}
+	}
+
+	*p = '\0';
+	return unsigned(p - buffer);
+}
+
+void NumberFormat::format(double value, string& dest) const {
+	char buffer[c_bufferSize];
+	const unsigned length = format(value, buffer);
+	dest.assign(buffer, length);
+}
+
+bool NumberFormat::parse(const string& text, NumberFormat& result) {
+	static const char* const names[] = { "auto", "fix", "sci", "eng" };
+	static const Mode modes[] = { SHORTEST, FIXED, SCIENTIFIC, ENGINEERING };
+
+	const char* s = text.c_str();
+	while(*s == ' ')
+		s++;
+	for(unsigned i = 0; i < 4; i++) {
+		const unsigned length = std::strlen(names[i]);
+		if(std::strncmp(s, names[i], length) != 0)
+			continue;
+
+		s += length;
+		unsigned digits = c_maxDigits;
+		if(modes[i] != SHORTEST) {
+			while(*s == ' ')
+				s++;
+			if(*s < '0' || *s > '9')
+				return false;
+			for(digits = 0; *s >= '0' && *s <= '9' && digits <= c_maxDigits; s++)
+				digits = digits * 10 + (*s - '0');
+		}
+		while(*s == ' ')
+			s++;
+		if(*s != '\0')
+			return false;
+
+		result = NumberFormat(modes[i], digits);
+		return true;
+	}
+	return false;
+}
+
+string NumberFormat::toString() const {
+	static const char* const names[] = { "auto", "fix", "sci", "eng" };
+	string result = names[m_mode];
+	if(m_mode != SHORTEST) {
+		char digits[8];
+		char* p = digits + sizeof(digits);
+		*--p = '\0';
+		unsigned d = m_digits;
+		do {
+			*--p = char('0' + d % 10);
+			d /= 10;
+		} while(d);
+		result += ' ';
+		result += p;
+	}
+	return result;
+}
@@ -0,0 +1,50 @@
+#ifndef NUMFORMAT_H
+#define NUMFORMAT_H
+#include <string>
+
+/* Converts doubles to text for display. No streams, locales or heap
+   allocations are involved: the text is written into a caller-supplied
+   buffer (or string, whose capacity is reused). */
+class NumberFormat {
+public:
+	enum Mode {
+		SHORTEST,    /* fewest digits that read back as the same double */
+		FIXED,       /* 'digits' digits after the decimal point */
+		SCIENTIFIC,  /* 'digits' significant digits, as in 1.234e+05 */
+		ENGINEERING  /* as SCIENTIFIC, with an exponent that is a multiple of 3 */
+	};
+
+	/* digits are clamped to [1, c_maxDigits] ([0, c_maxDigits] for FIXED) */
+	static const unsigned c_maxDigits = 17;
+
+	/* a buffer of this size holds any value in any mode */
+	static const unsigned c_bufferSize = 64;
+
+	NumberFormat();
+	NumberFormat(Mode mode, unsigned digits);
+
+	Mode mode() const {
+		return m_mode;
+	}
+
+	unsigned digits() const {
+		return m_digits;
+	}
+
+	/* writes value and a terminating '\0' to buffer, returns the length */
+	unsigned format(double value, char* buffer) const;
+
+	/* replaces the contents of dest */
+	void format(double value, std::string& dest) const;
+
+	/* parses "auto", "fix N", "sci N" or "eng N" (as written by toString());
+	   returns false if text is none of these */
+	static bool parse(const std::string& text, NumberFormat& result);
+	std::string toString() const;
+
+private:
+	Mode m_mode;
+	unsigned m_digits;
+};
+
+#endif